@@ -0,0 +1,160 @@
+/**
+ * @file bench_util.h
+ * Timing helpers, test meshes and ray batches shared by the micro-benchmarks.
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+#include "hittables/triangle.h"
+
+/**
+ * @return the seconds elapsed since start
+ */
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * What tracing a batch of rays found, and how long it took.
+ */
+struct trace_result {
+    double seconds = 0;
+    int hits = 0;
+    // the sum of the distances to the hits, to check that two traces agree
+    double t_sum = 0;
+
+    /**
+     * @return rays traced per second, in millions
+     */
+    double mrays_per_second(size_t rays) const {
+        return rays / seconds / 1e6;
+    }
+};
+
+/**
+ * Traces every ray in the batch through an object for its closest hit.
+ */
+inline trace_result trace_batch(const hittable& object, const std::vector<ray>& batch) {
+    trace_result result;
+    hit_record rec;
+    auto start = std::chrono::steady_clock::now();
+    for (const ray& r : batch) {
+        if (object.hit(r, rec, Real(0.001), real_infinity)) {
+            result.hits++;
+            result.t_sum += rec.t;
+        }
+    }
+    result.seconds = seconds_since(start);
+    return result;
+}
+
+/**
+ * Makes rays between two random points in the cube [-extent, extent]^3, so
+ * they are as incoherent as rays get.
+ * @param rng the benchmark's generator, which may have made its scene first
+ */
+inline std::vector<ray> random_rays(int count, Real extent, std::mt19937& rng) {
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::vector<ray> batch;
+    batch.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        point3 origin(position(rng), position(rng), position(rng));
+        batch.push_back(ray(origin, unit_vector(point3(position(rng), position(rng), position(rng)) - origin)));
+    }
+    return batch;
+}
+
+/**
+ * Makes rays from random points at a distance from the origin towards random
+ * points within 12 of it, so most of them hit a bumpy_sphere_grid.
+ */
+inline std::vector<ray> rays_at_sphere(int count, Real distance, std::mt19937& rng) {
+    std::uniform_real_distribution<Real> around(-12, 12);
+    std::vector<ray> batch;
+    batch.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        point3 origin = distance * unit_vector(vec3(around(rng), around(rng), around(rng)));
+        point3 target(around(rng), around(rng), around(rng));
+        batch.push_back(ray(origin, unit_vector(target - origin)));
+    }
+    return batch;
+}
+
+/**
+ * A point on a sphere of radius 10 around the origin, pushed in and out by
+ * up to bump in a fine pattern, at the given polar and azimuthal angles.
+ */
+inline point3 bumpy_sphere_point(Real theta, Real phi, Real bump) {
+    Real radius = 10 + bump * std::sin(23 * theta) * std::cos(31 * phi);
+    return radius * vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+/**
+ * Tessellates a bumpy sphere into a (rings + 1) x (segments + 1) grid of
+ * vertices, the seam duplicated for its uvs, with two triangles per cell.
+ * The faces of ring i start at index 6 * segments * i.
+ */
+inline void bumpy_sphere_grid(int rings, int segments, Real bump, std::vector<point3>& positions,
+                              std::vector<std::pair<Real, Real>>& uvs, std::vector<uint32_t>& indices) {
+    const Real pi = Real(3.14159265358979);
+    positions.clear();
+    uvs.clear();
+    indices.clear();
+    for (int i = 0; i <= rings; ++i) {
+        for (int j = 0; j <= segments; ++j) {
+            positions.push_back(bumpy_sphere_point(pi * i / rings, 2 * pi * j / segments, bump));
+            uvs.push_back(std::make_pair(Real(j) / segments, Real(i) / rings));
+        }
+    }
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            uint32_t a = i * (segments + 1) + j, b = a + 1, d = a + segments + 1, c = d + 1;
+            uint32_t faces[6] = {a, b, c, a, c, d};
+            indices.insert(indices.end(), faces, faces + 6);
+        }
+    }
+}
+
+/**
+ * Tessellates a bumpy sphere into separate triangles.
+ * @param material_of gives the material for the faces of a ring
+ */
+template <typename MaterialOf>
+inline std::vector<shared_ptr<hittable>> bumpy_sphere_triangles_by_ring(int rings, int segments, Real bump,
+                                                                        MaterialOf material_of) {
+    std::vector<point3> positions;
+    std::vector<std::pair<Real, Real>> uvs;
+    std::vector<uint32_t> indices;
+    bumpy_sphere_grid(rings, segments, bump, positions, uvs, indices);
+
+    std::vector<shared_ptr<hittable>> mesh;
+    mesh.reserve(indices.size() / 3);
+    for (size_t f = 0; f < indices.size(); f += 3) {
+        shared_ptr<material> mat = material_of(static_cast<int>(f / (6 * segments)));
+        mesh.push_back(make_shared<triangle>(positions[indices[f]], positions[indices[f + 1]],
+                                             positions[indices[f + 2]], mat));
+    }
+    return mesh;
+}
+
+/**
+ * Tessellates a bumpy sphere into separate triangles of one material.
+ */
+inline std::vector<shared_ptr<hittable>> bumpy_sphere_triangles(int rings, int segments, Real bump,
+                                                                shared_ptr<material> mat) {
+    return bumpy_sphere_triangles_by_ring(rings, segments, bump, [&mat](int) { return mat; });
+}
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file bvh_layout_bench.cpp
+ * Micro-benchmark for flat_bvh's node layouts on a scene far bigger than the
+ * caches.
+ *
+ * Builds one tree over a couple of million small triangles with each layout
+ * and traces the same incoherent rays through both, so most node and
+ * primitive loads miss the caches and many miss the TLB. First checks that
+ * trees small enough for the root to be a leaf still find every hit.
+ * Build with `make bench` and run build/bench/bvh_layout_bench.
+ */
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/sphere.h"
+#include "hittables/triangle.h"
+
+static const int triangles = 2000000;
+static const int rays = 1000000;
+static const Real extent = 100;
+
+static void run(const char* name, const flat_bvh& tree, const std::vector<ray>& batch) {
+    trace_result result = trace_batch(tree, batch);
+    printf("%-12s %6.3f Mrays/s  %8d hits  (t sum %.1f)\n", name, result.mrays_per_second(batch.size()),
+           result.hits, result.t_sum);
+}
+
+/**
+ * Traces a ray at each of one to four spheres, with each layout.
+ * @return whether every ray hit its sphere
+ */
+static bool check_small_scenes() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    bool ok = true;
+    for (int count = 1; count <= 4; ++count) {
+        vector<shared_ptr<hittable>> objects;
+        for (int i = 0; i < count; ++i) {
+            objects.push_back(make_shared<sphere>(point3(3 * i, 0, 0), 1, mat));
+        }
+        flat_bvh depth_first(objects, bvh_split::sah, 1, bvh_layout::depth_first);
+        flat_bvh treelet(objects, bvh_split::sah, 1, bvh_layout::treelet);
+        int hits = 0;
+        hit_record rec;
+        for (int i = 0; i < count; ++i) {
+            ray r(point3(3 * i, 0, -10), vec3(0, 0, 1));
+            hits += depth_first.hit(r, rec, Real(0.001), real_infinity) && rec.t == Real(9);
+            hits += treelet.hit(r, rec, Real(0.001), real_infinity) && rec.t == Real(9);
+        }
+        printf("%d spheres: %zu nodes, %d of %d rays hit\n", count, treelet.node_count(), hits, 2 * count);
+        ok &= hits == 2 * count;
+    }
+    return ok;
+}
+
+int main() {
+    if (!check_small_scenes()) {
+        return 1;
+    }
+
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::uniform_real_distribution<Real> offset(-1, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    vector<shared_ptr<hittable>> objects;
+    for (int i = 0; i < triangles; ++i) {
+        point3 p(position(rng), position(rng), position(rng));
+        vec3 u(offset(rng), offset(rng), offset(rng)), v(offset(rng), offset(rng), offset(rng));
+        objects.push_back(make_shared<triangle>(p, p + u, p + v, mat));
+    }
+
+    std::vector<ray> batch = random_rays(rays, extent, rng);
+
+    flat_bvh depth_first(objects, bvh_split::sah, 1, bvh_layout::depth_first);
+    flat_bvh treelet(objects, bvh_split::sah, 1, bvh_layout::treelet);
+    objects.clear();
+
+    printf("%d triangles, %zu nodes of %zu bytes (%.0f MB) plus %.0f MB of triangles, %d rays\n", triangles,
+           treelet.node_count(), sizeof(flat_bvh_node), treelet.node_count() * sizeof(flat_bvh_node) / 1e6,
+           treelet.primitive_count() * sizeof(triangle) / 1e6, rays);
+    for (int pass = 0; pass < 2; ++pass) {
+        run("depth first", depth_first, batch);
+        run("treelet", treelet, batch);
+    }
+    return 0;
+}
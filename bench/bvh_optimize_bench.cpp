@@ -0,0 +1,83 @@
+/**
+ * @file bvh_optimize_bench.cpp
+ * Micro-benchmark for bvh_node::optimize.
+ *
+ * Builds a midpoint-split bvh_node over clustered spheres and triangles of
+ * mixed sizes (where midpoint splits do badly), traces random rays, then
+ * optimizes the tree under growing time budgets and traces the same rays
+ * again after each. Prints the SAH cost and rays/s before and after, which
+ * should both improve with identical hits.
+ * Build with `make bench` and run build/bench/bvh_optimize_bench.
+ */
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/bvh_node.h"
+#include "hittables/sphere.h"
+#include "hittables/triangle.h"
+
+static const int clusters = 200;
+static const int per_cluster = 1000;
+static const int rays = 300000;
+static const Real extent = 100;
+
+static double trace(const bvh_node& tree, const std::vector<ray>& batch, int& hits, double& t_sum) {
+    trace_result result = trace_batch(tree, batch);
+    hits = result.hits;
+    t_sum = result.t_sum;
+    return result.mrays_per_second(batch.size());
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::normal_distribution<Real> spread(0, 1);
+    std::uniform_real_distribution<Real> unit(0, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    vector<shared_ptr<hittable>> objects;
+    for (int c = 0; c < clusters; ++c) {
+        point3 center(position(rng), position(rng), position(rng));
+        Real radius = 1 + 10 * unit(rng);
+        for (int i = 0; i < per_cluster; ++i) {
+            point3 p = center + radius * vec3(spread(rng), spread(rng), spread(rng));
+            Real size = Real(0.05) + Real(0.5) * unit(rng) * unit(rng) * unit(rng) * radius;
+            if (i % 2) {
+                objects.push_back(make_shared<sphere>(p, size, mat));
+            } else {
+                vec3 u = size * vec3(spread(rng), spread(rng), spread(rng));
+                vec3 v = size * vec3(spread(rng), spread(rng), spread(rng));
+                objects.push_back(make_shared<triangle>(p, p + u, p + v, mat));
+            }
+        }
+    }
+
+    std::vector<ray> batch = random_rays(rays, extent, rng);
+
+    bvh_node tree(objects);
+    int hits;
+    double t_sum;
+    double before = trace(tree, batch, hits, t_sum);
+    printf("%zu primitives in %d clusters, %d rays\n", objects.size(), clusters, rays);
+    printf("midpoint build             SAH %7.1f  %6.3f Mrays/s  %7d hits (t sum %.1f)\n", tree.sah_cost(), before,
+           hits, t_sum);
+
+    const double budgets[] = {0.1, 0.5, 2, 10};
+    double spent = 0;
+    for (double budget : budgets) {
+        bvh_optimize_report report = tree.optimize(budget - spent);
+        spent = budget;
+        double after = trace(tree, batch, hits, t_sum);
+        printf("optimized for %5.1f s  SAH %7.1f  %6.3f Mrays/s  %7d hits (t sum %.1f)  %zu rotations, %d passes%s"
+               "  (%+.0f%% rays/s)\n",
+               budget, report.sah_after, after, hits, t_sum, report.rotations, report.passes,
+               report.converged ? ", converged" : "", 100 * (after / before - 1));
+        if (report.converged) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file bvh_refit_bench.cpp
+ * Micro-benchmark for keeping a BVH up to date in an animation.
+ *
+ * Spheres drift through a box for a number of frames. Each frame the scene's
+ * BVH is brought up to date three ways:
+ *  - build: a new bvh_node from scratch
+ *  - refit: bvh_node::refit only, so the tree's quality slowly degrades
+ *  - update: bvh_node::update, refitting and rebuilding degraded subtrees
+ * and the same random rays are traced through each, to show what the cheaper
+ * updates cost at render time.
+ * Build with `make bench` and run build/bench/bvh_refit_bench.
+ */
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/bvh_node.h"
+#include "hittables/sphere.h"
+
+static const int spheres = 20000;
+static const int frames = 60;
+static const int rays = 20000;
+static const Real extent = 100;
+
+/**
+ * Traces rays through the tree.
+ * @return the time taken, in seconds
+ */
+static double trace(const bvh_node& tree, const std::vector<ray>& batch, int& hits) {
+    trace_result result = trace_batch(tree, batch);
+    hits += result.hits;
+    return result.seconds;
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::uniform_real_distribution<Real> velocity(-1, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    vector<shared_ptr<hittable>> objects;
+    vector<shared_ptr<sphere>> balls;
+    vector<vec3> velocities;
+    for (int i = 0; i < spheres; ++i) {
+        auto ball = make_shared<sphere>(point3(position(rng), position(rng), position(rng)), Real(0.5), mat);
+        balls.push_back(ball);
+        objects.push_back(ball);
+        velocities.push_back(vec3(velocity(rng), velocity(rng), velocity(rng)));
+    }
+
+    std::vector<ray> batch;
+    for (int i = 0; i < rays; ++i) {
+        point3 origin(position(rng), position(rng), position(rng));
+        batch.push_back(ray(origin, point3(position(rng), position(rng), position(rng)) - origin));
+    }
+
+    bvh_node refit_tree(objects);
+    bvh_node update_tree(objects);
+    double build_time = 0, refit_time = 0, update_time = 0;
+    double build_trace = 0, refit_trace = 0, update_trace = 0;
+    size_t rebuilt = 0;
+    int hits[3] = {0, 0, 0};
+
+    printf("%d spheres, %d frames, %d rays per frame\n", spheres, frames, rays);
+    printf("%6s %12s %12s %12s %10s\n", "frame", "build SAH", "refit SAH", "update SAH", "rebuilt");
+    for (int frame = 1; frame <= frames; ++frame) {
+        for (int i = 0; i < spheres; ++i) {
+            point3 p = balls[i]->center() + velocities[i];
+            for (int a = 0; a < 3; ++a) {
+                if (p[a] < -extent || p[a] > extent) {
+                    velocities[i][a] = -velocities[i][a];
+                }
+            }
+            balls[i]->move_to(p);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bvh_node built(objects);
+        build_time += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        refit_tree.refit();
+        refit_time += seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        bvh_update_report report = update_tree.update();
+        update_time += seconds_since(start);
+        rebuilt += report.rebuilt_primitives;
+
+        build_trace += trace(built, batch, hits[0]);
+        refit_trace += trace(refit_tree, batch, hits[1]);
+        update_trace += trace(update_tree, batch, hits[2]);
+
+        if (frame % 10 == 0) {
+            printf("%6d %12.2f %12.2f %12.2f %10zu\n", frame, built.sah_cost(), refit_tree.sah_cost(),
+                   report.sah_after, report.rebuilt_primitives);
+        }
+    }
+
+    printf("\n%-8s %14s %14s %8s\n", "", "update ms/frame", "trace ms/frame", "hits");
+    printf("%-8s %14.2f %14.2f %8d\n", "build", 1e3 * build_time / frames, 1e3 * build_trace / frames, hits[0]);
+    printf("%-8s %14.2f %14.2f %8d\n", "refit", 1e3 * refit_time / frames, 1e3 * refit_trace / frames, hits[1]);
+    printf("%-8s %14.2f %14.2f %8d\n", "update", 1e3 * update_time / frames, 1e3 * update_trace / frames, hits[2]);
+    printf("update rebuilt %.1f primitives per frame on average\n", static_cast<double>(rebuilt) / frames);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file dispatch_bench.cpp
+ * Micro-benchmark for static versus virtual primitive dispatch.
+ *
+ * Builds a flat_bvh over a scene of mixed spheres, triangles and rectangles
+ * twice: once over the primitives, whose leaves dispatch once on their type,
+ * and once over the same primitives each hidden behind an opaque wrapper, so
+ * every leaf makes a virtual call on each object. The two trees are built
+ * from the same boxes, though wrapped objects can't be clipped for spatial
+ * splits, so the difference is mostly the cost of the calls and of chasing
+ * the pointers to the objects. Also traces the same random rays
+ * through a bvh_node, where every node is a virtual call too, for reference;
+ * its tree is built differently. First checks that a scene keeps a plane
+ * held in a list out of each kind of BVH and still hits it.
+ * Build with `make bench` and run build/bench/dispatch_bench.
+ */
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "scene.h"
+#include "hittables/bvh_node.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/hittable_list.h"
+#include "hittables/plane.h"
+#include "hittables/rectangle.h"
+#include "hittables/sphere.h"
+#include "hittables/triangle.h"
+
+static const int per_type = 100000;
+static const int rays = 1000000;
+static const Real extent = 100;
+
+/**
+ * Hides an object's type, so a flat_bvh keeps it as a custom primitive.
+ */
+class opaque : public hittable {
+public:
+    opaque(shared_ptr<hittable> object) : object_(object) {}
+
+    virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override {
+        return object_->hit(r, rec, tmin, tmax);
+    }
+    virtual void finalize_interaction(const ray& r, hit_record& rec) const override {
+        object_->finalize_interaction(r, rec);
+    }
+    virtual vec3 surface_normal(const point3 position) const override {
+        return object_->surface_normal(position);
+    }
+    virtual aabb bounding_box() const override {
+        return object_->bounding_box();
+    }
+    virtual std::string type() const override {
+        return "opaque";
+    }
+
+private:
+    shared_ptr<hittable> object_;
+};
+
+static void run(const char* name, const hittable& tree, const std::vector<ray>& batch, double build) {
+    trace_result result = trace_batch(tree, batch);
+    printf("%-10s %6.2f s build  %6.2f Mrays/s  %8d hits  (t sum %.3f)\n", name, build,
+           result.mrays_per_second(batch.size()), result.hits, result.t_sum);
+}
+
+/**
+ * Builds each kind of scene over a list holding a ground plane and two
+ * spheres, and traces a ray down onto a sphere and one onto the plane.
+ * @return whether every ray hit what it aimed at
+ */
+static bool check_unbounded() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    hittable_list list;
+    list.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), mat));
+    list.add(make_shared<sphere>(point3(0, 1, 0), 1, mat));
+    list.add(make_shared<sphere>(point3(5, 1, 0), 1, mat));
+    vector<shared_ptr<hittable>> objects(1, make_shared<hittable_list>(list));
+
+    const scene_bvh kinds[] = {scene_bvh::automatic, scene_bvh::flat, scene_bvh::refittable, scene_bvh::compressed};
+    const char* names[] = {"automatic", "flat", "refittable", "compressed"};
+    bool ok = true;
+    for (int k = 0; k < 4; ++k) {
+        scene world(objects, 0, 1, kinds[k]);
+        hit_record rec;
+        bool sphere_hit = world.hit(ray(point3(5, 10, 0), vec3(0, -1, 0)), rec, Real(0.001), real_infinity) &&
+                          std::fabs(rec.t - 8) < Real(1e-3);
+        bool plane_hit = world.hit(ray(point3(-5, 10, 0), vec3(0, -1, 0)), rec, Real(0.001), real_infinity) &&
+                         std::fabs(rec.t - 10) < Real(1e-3);
+        printf("%-10s scene: %zu unbounded, sphere %s, plane %s\n", names[k], world.unbounded().size(),
+               sphere_hit ? "hit" : "MISSED", plane_hit ? "hit" : "MISSED");
+        ok &= sphere_hit && plane_hit && world.unbounded().size() == 1;
+    }
+    return ok;
+}
+
+int main() {
+    if (!check_unbounded()) {
+        return 1;
+    }
+
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::uniform_real_distribution<Real> offset(-1, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    vector<shared_ptr<hittable>> objects;
+    for (int i = 0; i < per_type; ++i) {
+        point3 p(position(rng), position(rng), position(rng));
+        objects.push_back(make_shared<sphere>(p, Real(0.5), mat));
+
+        point3 q(position(rng), position(rng), position(rng));
+        vec3 u(offset(rng), offset(rng), offset(rng)), v(offset(rng), offset(rng), offset(rng));
+        objects.push_back(make_shared<triangle>(q, q + u, q + v, mat));
+
+        point3 c(position(rng), position(rng), position(rng));
+        vec3 e1(offset(rng), offset(rng), offset(rng)), e2(offset(rng), offset(rng), offset(rng));
+        objects.push_back(make_shared<rectangle>(c, e1, e2, mat));
+    }
+
+    std::vector<ray> batch = random_rays(rays, extent, rng);
+
+    auto start = std::chrono::steady_clock::now();
+    bvh_node tree(objects);
+    double tree_build = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    flat_bvh flat(objects);
+    double flat_build = seconds_since(start);
+    vector<shared_ptr<hittable>> wrapped;
+    for (const auto& object : objects) {
+        wrapped.push_back(make_shared<opaque>(object));
+    }
+    start = std::chrono::steady_clock::now();
+    flat_bvh flat_virtual(wrapped);
+    double virtual_build = seconds_since(start);
+
+    printf("%d primitives (spheres, triangles, rectangles), %d rays\n", 3 * per_type, rays);
+    run("by type", flat, batch, flat_build);
+    run("virtual", flat_virtual, batch, virtual_build);
+    run("bvh_node", tree, batch, tree_build);
+    printf("flat_bvh: %zu nodes of %zu bytes\n", flat.node_count(), sizeof(flat_bvh_node));
+    return 0;
+}
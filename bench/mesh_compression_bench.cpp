@@ -0,0 +1,120 @@
+/**
+ * @file mesh_compression_bench.cpp
+ * Micro-benchmark for compressed mesh storage.
+ *
+ * Tessellates a bumpy sphere, with vertex normals and uvs, into about a
+ * million faces, then traces the same rays through a flat_bvh over triangles
+ * and one over mesh_triangles of a compressed_mesh. Prints the memory the
+ * geometry takes each way, rays/s, how far apart the hits are and the largest
+ * error of the decoded normals and uvs.
+ * Build with `make bench` and run build/bench/mesh_compression_bench.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/mesh_triangle.h"
+#include "hittables/triangle.h"
+
+static const int rings = 500;
+static const int segments = 1000;
+static const int rays = 1000000;
+
+/**
+ * Traces every ray, keeping the distance to each hit (or -1 for a miss).
+ */
+static double trace(const flat_bvh& tree, const std::vector<ray>& batch, std::vector<Real>& t) {
+    auto start = std::chrono::steady_clock::now();
+    hit_record rec;
+    t.assign(batch.size(), -1);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (tree.hit(batch[i], rec, Real(0.001), real_infinity)) {
+            t[i] = rec.t;
+        }
+    }
+    return batch.size() / seconds_since(start) / 1e6;
+}
+
+int main() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    const Real pi = Real(3.14159265358979);
+
+    std::vector<point3> positions;
+    std::vector<std::pair<Real, Real>> uvs;
+    std::vector<uint32_t> indices;
+    bumpy_sphere_grid(rings, segments, Real(0.3), positions, uvs, indices);
+    std::vector<vec3> normals(positions.size(), vec3(0, 0, 0));
+    for (size_t f = 0; f < indices.size(); f += 3) {
+        const point3& a = positions[indices[f]];
+        vec3 n = cross(positions[indices[f + 1]] - a, positions[indices[f + 2]] - a);
+        for (int k = 0; k < 3; ++k) {
+            normals[indices[f + k]] += n;
+        }
+    }
+    for (vec3& n : normals) {
+        n = n.length_squared() > 0 ? unit_vector(n) : vec3(0, 1, 0);
+    }
+
+    vector<shared_ptr<hittable>> triangles;
+    auto packed = make_shared<const compressed_mesh>(positions, normals, uvs, indices, mat);
+    vector<shared_ptr<hittable>> mesh_triangles = mesh_faces(packed);
+    for (size_t f = 0; f < indices.size(); f += 3) {
+        auto t = make_shared<triangle>(positions[indices[f]], positions[indices[f + 1]], positions[indices[f + 2]],
+                                       mat);
+        t->set_vertex_normals(normals[indices[f]], normals[indices[f + 1]], normals[indices[f + 2]]);
+        triangles.push_back(t);
+    }
+
+    Real normal_error = 0, uv_error = 0;
+    for (size_t v = 0; v < positions.size(); ++v) {
+        // asin of the cross product's length resolves small angles better than acos of the dot product
+        normal_error = std::max(normal_error, std::asin(std::min(Real(1), cross(normals[v], packed->normal(v)).length())));
+        Real u, w;
+        packed->uv(v, u, w);
+        uv_error = std::max(uv_error, std::max(std::fabs(u - uvs[v].first), std::fabs(w - uvs[v].second)));
+    }
+
+    std::mt19937 rng(419);
+    std::vector<ray> batch = rays_at_sphere(rays, 20, rng);
+
+    flat_bvh plain(triangles);
+    flat_bvh compressed(mesh_triangles);
+    triangles.clear();
+    mesh_triangles.clear();
+
+    std::vector<Real> t_plain, t_compressed;
+    double plain_rate = trace(plain, batch, t_plain);
+    double compressed_rate = trace(compressed, batch, t_compressed);
+    std::vector<double> t_error;
+    size_t far_apart = 0, disagree = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (t_plain[i] >= 0 && t_compressed[i] >= 0) {
+            double error = std::fabs(t_plain[i] - t_compressed[i]);
+            t_error.push_back(error);
+            // slipped through an edge on one side and hit the back of the mesh
+            far_apart += error > 1;
+        } else if ((t_plain[i] >= 0) != (t_compressed[i] >= 0)) {
+            disagree++;
+        }
+    }
+
+    size_t plain_bytes = plain.primitive_count() * sizeof(triangle);
+    size_t compressed_bytes = compressed.primitive_count() * sizeof(mesh_triangle) + packed->memory_bytes();
+    printf("%zu faces, %zu vertices, %d rays\n", packed->face_count(), packed->vertex_count(), rays);
+    printf("triangles       %7.1f MB  %6.3f Mrays/s\n", plain_bytes / 1e6, plain_rate);
+    printf("compressed mesh %7.1f MB  %6.3f Mrays/s  (%.1f MB of it in the compressed_mesh)\n",
+           compressed_bytes / 1e6, compressed_rate, packed->memory_bytes() / 1e6);
+    std::sort(t_error.begin(), t_error.end());
+    printf("%zu rays hit both: t differs by %.2g (median), %.2g (99.9th percentile), %zu by more than 1 "
+           "(mesh extent 20.6); %zu hit only one\n", t_error.size(), t_error[t_error.size() / 2],
+           t_error[t_error.size() * 999 / 1000], far_apart, disagree);
+    printf("largest normal error %.3g degrees, largest uv error %.2g\n", normal_error * 180 / pi, uv_error);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file motion_blur_bench.cpp
+ * Micro-benchmark for BVH traversal with motion blur.
+ *
+ * Traces the same random rays, at random times in the shutter, through:
+ *  - static: spheres that don't move (the cost without motion blur)
+ *  - swept: moving spheres whose BVH only sees boxes swept over the shutter
+ *    (how the BVH worked before it kept motion bounds)
+ *  - motion bounds: the same moving spheres, with each node's box
+ *    interpolated to the ray's time
+ *  - keyframed: the same motion as motion_instance keyframes of one sphere
+ * The three moving scenes should report the same number of hits.
+ * Build with `make bench` and run build/bench/motion_blur_bench.
+ */
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/bvh_node.h"
+#include "hittables/motion_instance.h"
+#include "hittables/moving_sphere.h"
+#include "hittables/sphere.h"
+
+static const int spheres = 20000;
+static const int rays = 200000;
+static const Real extent = 100;
+static const Real travel = 4;
+
+/**
+ * Hides an object's motion bounds, so a BVH falls back to its swept box.
+ */
+class swept : public hittable {
+public:
+    swept(shared_ptr<hittable> object) : object_(object) {}
+
+    virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override {
+        return object_->hit(r, rec, tmin, tmax);
+    }
+    virtual void finalize_interaction(const ray& r, hit_record& rec) const override {
+        object_->finalize_interaction(r, rec);
+    }
+    virtual vec3 surface_normal(const point3 position) const override {
+        return object_->surface_normal(position);
+    }
+    virtual aabb bounding_box() const override {
+        return object_->bounding_box();
+    }
+    virtual std::string type() const override {
+        return "swept";
+    }
+
+private:
+    shared_ptr<hittable> object_;
+};
+
+static void run(const char* name, const bvh_node& tree, const std::vector<ray>& batch) {
+    trace_result result = trace_batch(tree, batch);
+    printf("%-16s %8.2f Mrays/s  %8d hits  SAH %.1f\n", name, result.mrays_per_second(batch.size()), result.hits,
+           tree.sah_cost());
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::uniform_real_distribution<Real> direction(-travel, travel);
+    std::uniform_real_distribution<Real> shutter(0, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto unit_sphere = make_shared<sphere>(point3(0, 0, 0), Real(1), mat);
+    const Real radius = Real(0.5);
+
+    vector<shared_ptr<hittable>> still, sweeping, moving, keyframed;
+    for (int i = 0; i < spheres; ++i) {
+        point3 start(position(rng), position(rng), position(rng));
+        point3 end = start + vec3(direction(rng), direction(rng), direction(rng));
+        auto mover = make_shared<moving_sphere>(start, end, 0.0, 1.0, radius, mat);
+        still.push_back(make_shared<sphere>(start, radius, mat));
+        sweeping.push_back(make_shared<swept>(mover));
+        moving.push_back(mover);
+        std::vector<keyframe> keys = {
+            {0, affine_transform::translate(start) * affine_transform::scale(radius)},
+            {1, affine_transform::translate(end) * affine_transform::scale(radius)}};
+        keyframed.push_back(make_shared<motion_instance>(unit_sphere, keys));
+    }
+
+    std::vector<ray> batch;
+    for (int i = 0; i < rays; ++i) {
+        point3 origin(position(rng), position(rng), position(rng));
+        vec3 dir = point3(position(rng), position(rng), position(rng)) - origin;
+        batch.push_back(ray(origin, dir, shutter(rng)));
+    }
+
+    printf("%d spheres moving up to %.0f units, %d rays\n", spheres, travel * std::sqrt(3.0), rays);
+    run("static", bvh_node(still), batch);
+    run("swept", bvh_node(sweeping), batch);
+    run("motion bounds", bvh_node(moving), batch);
+    run("keyframed", bvh_node(keyframed), batch);
+    return 0;
+}
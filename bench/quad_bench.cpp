@@ -0,0 +1,83 @@
+/**
+ * @file quad_bench.cpp
+ * Micro-benchmark for quad intersection.
+ *
+ * Compares a quad made of two triangles (how rectangle used to be built)
+ * against the rectangle primitive, on rays that hit the quad about half the
+ * time, and prints the memory each one takes.
+ *
+ * Also checks the rectangle's area sampling for lights from a few points: the
+ * solid angle estimated from random_point() and pdf_value() should match the
+ * share of uniform directions that hit it, and pdf_value() over the sphere of
+ * directions should integrate to 1.
+ * Build with `make bench` and run build/bench/quad_bench.
+ */
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/hittable_list.h"
+#include "hittables/rectangle.h"
+#include "hittables/triangle.h"
+
+static const int rays = 1 << 22;
+static const int samples = 1 << 20;
+
+static void run(const char* name, const hittable& quad, const std::vector<ray>& batch) {
+    trace_result result = trace_batch(quad, batch);
+    printf("%-16s %8.1f Mrays/s  %8d hits\n", name, result.mrays_per_second(batch.size()), result.hits);
+}
+
+static void check_sampling(const rectangle& quad, const point3& origin, std::mt19937& rng) {
+    const Real sphere = 4 * real_pi;
+    double by_pdf = 0;
+    for (int i = 0; i < samples; ++i) {
+        Real pdf = quad.pdf_value(origin, quad.random_point() - origin);
+        by_pdf += pdf > 0 ? 1 / pdf : 0;
+    }
+
+    std::normal_distribution<Real> gaussian;
+    int hits = 0;
+    double pdf_sum = 0;
+    for (int i = 0; i < samples; ++i) {
+        vec3 direction = unit_vector(vec3(gaussian(rng), gaussian(rng), gaussian(rng)));
+        Real pdf = quad.pdf_value(origin, direction);
+        hits += pdf > 0;
+        pdf_sum += pdf;
+    }
+    printf("from (%g, %g, %g): solid angle %.4f sr by pdf_value, %.4f sr by uniform directions, "
+           "pdf integrates to %.4f\n", origin.x(), origin.y(), origin.z(), by_pdf / samples,
+           sphere * hits / samples, sphere * pdf_sum / samples);
+}
+
+int main() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    point3 a(-1, -1, -2), b(-1, 1, -2), c(1, 1, -2.5), d(1, -1, -2.5);
+
+    hittable_list triangles;
+    triangles.add(make_shared<triangle>(a, b, c, mat));
+    triangles.add(make_shared<triangle>(a, c, d, mat));
+    rectangle quad(a, b, c, d, mat);
+
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> spread(-1.4, 1.4);
+    std::vector<ray> batch;
+    for (int i = 0; i < rays; ++i) {
+        batch.push_back(ray(point3(0, 0, 0), vec3(spread(rng), spread(rng), -2)));
+    }
+
+    printf("%d rays\n", rays);
+    run("two triangles", triangles, batch);
+    run("rectangle", quad, batch);
+    printf("memory: two triangles %zu bytes (plus a list or a rectangle to hold them), rectangle %zu bytes\n",
+           2 * sizeof(triangle), sizeof(rectangle));
+
+    const point3 origins[] = {point3(0, 0, 0), point3(2, 0.5, 0), point3(0.3, -0.2, -1.5)};
+    for (const point3& origin : origins) {
+        check_sampling(quad, origin, rng);
+    }
+    return 0;
+}
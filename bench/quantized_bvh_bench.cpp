@@ -0,0 +1,51 @@
+/**
+ * @file quantized_bvh_bench.cpp
+ * Micro-benchmark for quantized BVH nodes.
+ *
+ * Tessellates a bumpy sphere into a mesh of about a million triangles, builds
+ * a bvh_node, a flat_bvh and a quantized_bvh over it, and traces the same
+ * rays through each. Prints the memory each tree's nodes take (not counting
+ * the triangles) and rays/s. All three should report the same hits.
+ * Build with `make bench` and run build/bench/quantized_bvh_bench.
+ */
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/bvh_node.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/quantized_bvh.h"
+#include "hittables/triangle.h"
+
+static const int rings = 500;
+static const int segments = 1000;
+static const int rays = 1000000;
+
+static void run(const char* name, const hittable& tree, size_t node_bytes, const std::vector<ray>& batch) {
+    trace_result result = trace_batch(tree, batch);
+    printf("%-14s %7.1f MB of nodes  %6.3f Mrays/s  %7d hits (t sum %.2f)\n", name, node_bytes / 1e6,
+           result.mrays_per_second(batch.size()), result.hits, result.t_sum);
+}
+
+int main() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    vector<shared_ptr<hittable>> mesh = bumpy_sphere_triangles(rings, segments, Real(0.3), mat);
+
+    std::mt19937 rng(419);
+    std::vector<ray> batch = rays_at_sphere(rays, 20, rng);
+
+    bvh_node tree(mesh);
+    flat_bvh flat(mesh);
+    quantized_bvh quantized(mesh);
+
+    // A bvh_node for every pair of children, each with a control block from make_shared
+    size_t tree_bytes = (mesh.size() - 1) * (sizeof(bvh_node) + 2 * sizeof(void*));
+    printf("%zu triangles, %d rays\n", mesh.size(), rays);
+    run("bvh_node", tree, tree_bytes, batch);
+    run("flat_bvh", flat, flat.node_count() * sizeof(flat_bvh_node), batch);
+    run("quantized_bvh", quantized, quantized.node_bytes(), batch);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file sbvh_bench.cpp
+ * Micro-benchmark for flat_bvh's split strategies.
+ *
+ * Builds an architecture-style scene (a grid of rooms with big wall and floor
+ * rectangles, long thin triangles for pipes and railings, and small clutter)
+ * with median, SAH and spatial (SBVH) splits, then traces the same rays from
+ * inside the building through each. Reports nodes visited per ray, rays/s,
+ * the SAH cost and how many primitive references the spatial splits added.
+ * All three trees should report the same hits.
+ * Build with `make bench` and run build/bench/sbvh_bench.
+ */
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/rectangle.h"
+#include "hittables/sphere.h"
+#include "hittables/triangle.h"
+
+static const int rooms = 12;           // per side, on each of the floors
+static const int floors = 4;
+static const Real room_size = 10;
+static const Real storey = 4;
+static const int clutter_per_room = 200;
+static const int rays = 500000;
+
+static void run(const char* name, const vector<shared_ptr<hittable>>& objects, bvh_split split,
+                const std::vector<ray>& batch) {
+    auto start = std::chrono::steady_clock::now();
+    flat_bvh tree(objects, split);
+    double build = seconds_since(start);
+
+    size_t visits = 0;
+    for (const ray& r : batch) {
+        visits += tree.nodes_visited(r, Real(0.001), real_infinity);
+    }
+
+    trace_result result = trace_batch(tree, batch);
+
+    printf("%-8s %6.2f s build  %6.2f Mrays/s  %6.1f nodes/ray  SAH %6.1f  %7zu refs (%.2fx)  %7d hits (t sum %.1f)\n",
+           name, build, result.mrays_per_second(batch.size()), double(visits) / batch.size(), tree.sah_cost(),
+           tree.primitive_count(), double(tree.primitive_count()) / objects.size(), result.hits, result.t_sum);
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::uniform_real_distribution<Real> unit(0, 1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    const Real width = rooms * room_size;
+
+    vector<shared_ptr<hittable>> objects;
+    for (int f = 0; f <= floors; ++f) {
+        // One slab per storey, spanning the whole building
+        Real y = f * storey;
+        objects.push_back(make_shared<rectangle>(point3(0, y, 0), vec3(width, 0, 0), vec3(0, 0, width), mat));
+    }
+    for (int f = 0; f < floors; ++f) {
+        Real y = f * storey;
+        for (int i = 0; i <= rooms; ++i) {
+            // Walls run the length of the building along x and z
+            Real p = i * room_size;
+            objects.push_back(make_shared<rectangle>(point3(p, y, 0), vec3(0, 0, width), vec3(0, storey, 0), mat));
+            objects.push_back(make_shared<rectangle>(point3(0, y, p), vec3(width, 0, 0), vec3(0, storey, 0), mat));
+
+            // A pipe along each wall, as long thin triangles
+            point3 start(p + Real(0.3), y + storey - Real(0.3), 0);
+            objects.push_back(make_shared<triangle>(start, start + vec3(0, 0, width),
+                                                    start + vec3(Real(0.1), Real(0.1), 0), mat));
+            objects.push_back(make_shared<triangle>(start + vec3(Real(0.1), Real(0.1), 0), start + vec3(0, 0, width),
+                                                    start + vec3(Real(0.1), Real(0.1), width), mat));
+        }
+        for (int i = 0; i < rooms; ++i) {
+            for (int j = 0; j < rooms; ++j) {
+                point3 corner(i * room_size, y, j * room_size);
+                // A diagonal railing across the room
+                objects.push_back(make_shared<triangle>(corner + vec3(1, 1, 1), corner + vec3(9, 1, 9),
+                                                        corner + vec3(1, Real(1.05), 1), mat));
+                for (int k = 0; k < clutter_per_room; ++k) {
+                    point3 p = corner + vec3(1 + 8 * unit(rng), storey * unit(rng), 1 + 8 * unit(rng));
+                    if (k % 2) {
+                        objects.push_back(make_shared<sphere>(p, Real(0.1), mat));
+                    } else {
+                        objects.push_back(make_shared<triangle>(p, p + vec3(Real(0.2), 0, 0),
+                                                                p + vec3(0, Real(0.2), Real(0.1)), mat));
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<ray> batch;
+    for (int i = 0; i < rays; ++i) {
+        point3 origin(width * unit(rng), floors * storey * unit(rng), width * unit(rng));
+        vec3 dir(2 * unit(rng) - 1, 2 * unit(rng) - 1, 2 * unit(rng) - 1);
+        batch.push_back(ray(origin, unit_vector(dir)));
+    }
+
+    printf("%zu primitives in %d rooms, %d rays\n", objects.size(), rooms * rooms * floors, rays);
+    run("median", objects, bvh_split::median, batch);
+    run("sah", objects, bvh_split::sah, batch);
+    run("spatial", objects, bvh_split::spatial, batch);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file smooth_shading_bench.cpp
+ * Micro-benchmark for smooth shading of triangle meshes.
+ *
+ * Traces and finalizes the same rays against a tessellated sphere three ways:
+ *  - flat: no vertex normals, so each face's geometric normal is used
+ *  - smooth: vertex normals interpolated with the barycentrics hit() stores
+ *  - by areas: the same vertex normals interpolated with barycentrics
+ *    recomputed from the hit point by triangle areas (how it used to be done)
+ * Build with `make bench` and run build/bench/smooth_shading_bench.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/triangle.h"
+
+static const int rings = 200;
+static const int segments = 400;
+static const int rays = 2000000;
+
+static void run(const char* name, const flat_bvh& tree, const std::vector<ray>& batch, bool by_areas) {
+    auto start = std::chrono::steady_clock::now();
+    hit_record rec;
+    double facing = 0;
+    for (const ray& r : batch) {
+        if (tree.hit(r, rec, Real(0.001), real_infinity)) {
+            rec.object->finalize_interaction(r, rec);
+            if (by_areas) {
+                const triangle& t = *static_cast<const triangle*>(rec.object);
+                vec3 bc = t.barycentric_coordinates(rec.point);
+                rec.set_normal(r, unit_vector(t.normal_a * bc[0] + t.normal_b * bc[1] + t.normal_c * bc[2]));
+            }
+            facing += dot(rec.normal, unit_vector(rec.point));
+        }
+    }
+    printf("%-9s %6.3f Mrays/s  (normals sum %.1f)\n", name, batch.size() / seconds_since(start) / 1e6, facing);
+}
+
+int main() {
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    std::vector<point3> positions;
+    std::vector<std::pair<Real, Real>> uvs;
+    std::vector<uint32_t> indices;
+    bumpy_sphere_grid(rings, segments, 0, positions, uvs, indices);
+
+    vector<shared_ptr<hittable>> flat, smooth;
+    for (size_t f = 0; f < indices.size(); f += 3) {
+        const point3& a = positions[indices[f]];
+        const point3& b = positions[indices[f + 1]];
+        const point3& c = positions[indices[f + 2]];
+        flat.push_back(make_shared<triangle>(a, b, c, mat));
+        auto t = make_shared<triangle>(a, b, c, mat);
+        // on a sphere, the vertex normal is the direction from the center
+        t->set_vertex_normals(unit_vector(a), unit_vector(b), unit_vector(c));
+        smooth.push_back(t);
+    }
+
+    std::mt19937 rng(419);
+    std::vector<ray> batch = rays_at_sphere(rays, 20, rng);
+
+    flat_bvh flat_tree(flat), smooth_tree(smooth);
+    printf("%zu triangles, %d rays\n", flat.size(), rays);
+    for (int pass = 0; pass < 2; ++pass) {
+        run("flat", flat_tree, batch, false);
+        run("smooth", smooth_tree, batch, false);
+        run("by areas", smooth_tree, batch, true);
+    }
+    return 0;
+}
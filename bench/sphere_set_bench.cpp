@@ -0,0 +1,148 @@
+/**
+ * @file sphere_set_bench.cpp
+ * Micro-benchmark for scenes made of many small spheres.
+ *
+ * Builds the same random sphere cloud as separate sphere objects under a
+ * bvh_node and as one sphere_set, then traces the same random rays through
+ * both. For accuracy, it reports how far the hit points lie from the surface
+ * of the sphere that was hit, measured in double precision. Finally builds a
+ * ten-million-sphere set to show its memory use.
+ * Build with `make bench` and run build/bench/sphere_set_bench.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "hittables/bvh_node.h"
+#include "hittables/sphere.h"
+#include "hittables/sphere_set.h"
+
+static const int spheres = 1000000;
+static const int large_set = 10000000;
+static const int rays = 500000;
+static const Real extent = 100;
+
+/**
+ * Makes a random sphere cloud.
+ */
+static void make_cloud(int count, std::mt19937& rng, std::vector<point3>& centers, std::vector<Real>& radii,
+                       std::vector<uint32_t>& material_ids) {
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::uniform_real_distribution<Real> size(0.05, 0.25);
+    for (int i = 0; i < count; ++i) {
+        centers.push_back(point3(position(rng), position(rng), position(rng)));
+        radii.push_back(size(rng));
+        material_ids.push_back(static_cast<uint32_t>(i % 4));
+    }
+}
+
+/**
+ * @return how far a hit point is from the surface of a sphere
+ */
+static double surface_error(const ray& r, Real t, const point3& center, Real radius) {
+    double offset[3];
+    for (int a = 0; a < 3; ++a) {
+        offset[a] = static_cast<double>(r.orig[a]) + static_cast<double>(t) * r.dir[a] - center[a];
+    }
+    return std::fabs(std::sqrt(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]) - radius);
+}
+
+/**
+ * Traces the rays, then checks the hits.
+ * @param sphere_of gives the center and radius of the sphere a finalized hit is on
+ */
+template <typename F>
+static void run(const char* name, const hittable& object, const std::vector<ray>& batch, F sphere_of) {
+    std::vector<hit_record> records(batch.size());
+    std::vector<char> hit(batch.size());
+    auto start = std::chrono::steady_clock::now();
+    int hits = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        hit[i] = object.hit(batch[i], records[i], Real(0.001), real_infinity);
+        hits += hit[i];
+    }
+    double elapsed = seconds_since(start);
+
+    double error = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (hit[i]) {
+            finalize_hit(batch[i], records[i]);
+            point3 center;
+            Real radius;
+            sphere_of(records[i], center, radius);
+            error += surface_error(batch[i], records[i].t, center, radius);
+        }
+    }
+    printf("%-16s %8.2f Mrays/s  %8d hits  mean surface error %.2g\n", name, batch.size() / elapsed / 1e6, hits,
+           error / std::max(hits, 1));
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::vector<shared_ptr<material>> materials;
+    for (int i = 0; i < 4; ++i) {
+        materials.push_back(make_shared<lambertian>(color(0.2 * i, 0.5, 0.5)));
+    }
+
+    std::vector<point3> centers;
+    std::vector<Real> radii;
+    std::vector<uint32_t> material_ids;
+    make_cloud(spheres, rng, centers, radii, material_ids);
+
+    auto start = std::chrono::steady_clock::now();
+    vector<shared_ptr<hittable>> objects;
+    for (int i = 0; i < spheres; ++i) {
+        objects.push_back(make_shared<sphere>(centers[i], radii[i], materials[material_ids[i]]));
+    }
+    bvh_node tree(objects);
+    double tree_build = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    sphere_set set(centers, radii, material_ids, materials);
+    double set_build = seconds_since(start);
+
+    std::uniform_real_distribution<Real> position(-extent, extent);
+    std::vector<ray> batch;
+    for (int i = 0; i < rays; ++i) {
+        point3 origin(position(rng), position(rng), position(rng));
+        batch.push_back(ray(origin, point3(position(rng), position(rng), position(rng)) - origin));
+    }
+
+    // A sphere with its control block from make_shared, plus about one bvh_node
+    // with its control block per sphere
+    size_t object_bytes = sizeof(sphere) + 16 + sizeof(bvh_node) + 16;
+    printf("%d spheres, %d rays\n", spheres, rays);
+    printf("%-16s %8.2f s build  ~%5.0f bytes/sphere\n", "bvh of spheres", tree_build,
+           static_cast<double>(object_bytes));
+    printf("%-16s %8.2f s build  %6.1f bytes/sphere\n", "sphere set", set_build,
+           static_cast<double>(set.memory_bytes()) / spheres);
+
+    run("bvh of spheres", tree, batch, [](const hit_record& rec, point3& center, Real& radius) {
+        const sphere* hit = static_cast<const sphere*>(rec.object);
+        center = hit->center();
+        radius = hit->radius();
+    });
+    auto set_sphere = [&](const hit_record& rec, point3& center, Real& radius) {
+        center = centers[rec.prim_index];
+        radius = radii[rec.prim_index];
+    };
+    run("sphere set", set, batch, set_sphere);
+
+    objects.clear();
+    tree = bvh_node();
+    centers.clear();
+    radii.clear();
+    material_ids.clear();
+    make_cloud(large_set, rng, centers, radii, material_ids);
+    start = std::chrono::steady_clock::now();
+    sphere_set large(centers, radii, material_ids, materials);
+    set_build = seconds_since(start);
+    printf("\n%d-sphere set: %.2f s build, %.0f MB (%.1f bytes/sphere)\n", large_set, set_build,
+           large.memory_bytes() / 1e6, static_cast<double>(large.memory_bytes()) / large_set);
+    run("10M sphere set", large, batch, set_sphere);
+    return 0;
+}
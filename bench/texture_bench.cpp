@@ -0,0 +1,110 @@
+/**
+ * @file texture_bench.cpp
+ * Micro-benchmark for texture memory layouts.
+ *
+ * Compares bilinear lookups in a plain row-major RGB8 image (the old
+ * image_texture layout) against the tiled RGBA8 layout in tiled_image, for:
+ *  - random: independent lookups anywhere in the texture, so the CPU can overlap
+ *    many cache misses (throughput bound)
+ *  - random, dependent: each lookup's coordinates depend on the previous result,
+ *    like a shading point waiting on traversal (latency bound)
+ *  - coherent: a random walk with small steps, like neighbouring rays hitting
+ *    the same surface
+ * Build with `make bench` and run build/bench/texture_bench.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "tiled_image.h"
+
+// Large enough (48 MB as RGB8, 64 MB as RGBA8) that lookups miss in cache
+static const int size = 4096;
+static const int lookups = 1 << 22;
+
+// Fixed bilinear weights; the lookups convert texels to floats like image_texture does
+static const float weights[4] = {0.4f, 0.3f, 0.2f, 0.1f};
+
+/**
+ * A bilinear footprint in a row-major RGB8 image.
+ * @return the filtered color, collapsed to one number for the checksum
+ */
+static uint32_t row_major_bilinear(const std::vector<unsigned char>& img, int i, int j) {
+    color c;
+    for (int k = 0; k < 4; ++k) {
+        const unsigned char* p = &img[(static_cast<size_t>(j + k / 2) * size + (i + k % 2)) * 3];
+        c += weights[k] * color(p[0], p[1], p[2]);
+    }
+    return static_cast<uint32_t>(c.x() + c.y() + c.z());
+}
+
+/**
+ * The same bilinear footprint in the tiled RGBA8 layout.
+ */
+static uint32_t tiled_bilinear(const tiled_image& img, int i, int j) {
+    uint32_t quad[4];
+    img.texel_quad(i, j, quad);
+    color c;
+    for (int k = 0; k < 4; ++k) {
+        c += weights[k] * color(quad[k] & 0xFF, (quad[k] >> 8) & 0xFF, (quad[k] >> 16) & 0xFF);
+    }
+    return static_cast<uint32_t>(c.x() + c.y() + c.z());
+}
+
+/**
+ * Times a lookup function over the given coordinates.
+ * @param dependent if true, each lookup's column depends on the previous result
+ */
+template <typename F>
+static void run(const char* name, const std::vector<int>& is, const std::vector<int>& js,
+                bool dependent, F lookup) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t checksum = 0;
+    for (size_t k = 0; k < is.size(); ++k) {
+        int i = dependent ? std::min(is[k] + static_cast<int>(checksum & 1), size - 2) : is[k];
+        checksum += lookup(i, js[k]);
+    }
+    printf("%-36s %8.1f Mlookups/s  (checksum %u)\n", name, is.size() / seconds_since(start) / 1e6, checksum);
+}
+
+int main() {
+    std::mt19937 rng(419);
+    std::vector<unsigned char> row_major(static_cast<size_t>(size) * size * 3);
+    for (auto& c : row_major) {
+        c = static_cast<unsigned char>(rng());
+    }
+    tiled_image tiled(row_major.data(), size, size, 3);
+
+    std::uniform_int_distribution<int> anywhere(0, size - 2);
+    std::vector<int> random_i(lookups), random_j(lookups);
+    for (int k = 0; k < lookups; ++k) {
+        random_i[k] = anywhere(rng);
+        random_j[k] = anywhere(rng);
+    }
+
+    std::uniform_int_distribution<int> step(-2, 2);
+    std::vector<int> walk_i(lookups), walk_j(lookups);
+    int i = size / 2, j = size / 2;
+    for (int k = 0; k < lookups; ++k) {
+        i = std::min(std::max(i + step(rng), 0), size - 2);
+        j = std::min(std::max(j + step(rng), 0), size - 2);
+        walk_i[k] = i;
+        walk_j[k] = j;
+    }
+
+    auto row_major_lookup = [&](int x, int y) { return row_major_bilinear(row_major, x, y); };
+    auto tiled_lookup = [&](int x, int y) { return tiled_bilinear(tiled, x, y); };
+
+    printf("%d bilinear lookups in a %dx%d texture\n", lookups, size, size);
+    run("row-major RGB8, random", random_i, random_j, false, row_major_lookup);
+    run("tiled RGBA8, random", random_i, random_j, false, tiled_lookup);
+    run("row-major RGB8, random, dependent", random_i, random_j, true, row_major_lookup);
+    run("tiled RGBA8, random, dependent", random_i, random_j, true, tiled_lookup);
+    run("row-major RGB8, coherent", walk_i, walk_j, false, row_major_lookup);
+    run("tiled RGBA8, coherent", walk_i, walk_j, false, tiled_lookup);
+    return 0;
+}
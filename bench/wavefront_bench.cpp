@@ -0,0 +1,111 @@
+/**
+ * @file wavefront_bench.cpp
+ * Micro-benchmark for wavefront path tracing.
+ *
+ * Tessellates a bumpy sphere into about a million triangles, in bands of
+ * diffuse and fuzzy mirror material, and traces the same camera paths through
+ * it recursively, as ray_color does, and with a wavefront_integrator at a few
+ * batch sizes, with and without sorting secondary rays. Prints paths/s and
+ * rays/s, and the average radiance of the paths, which should agree to within
+ * noise. For the wavefront runs it also prints how fast the extend stage
+ * traces rays and what sorting costs, and how much sorting speeds up
+ * tracing: the gain in coherence.
+ * Build with `make bench` and run build/bench/wavefront_bench.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "bench_util.h"
+#include "scene.h"
+#include "wavefront.h"
+#include "hittables/triangle.h"
+
+static const int rings = 500;
+static const int segments = 1000;
+static const int paths = 300000;
+static const int max_depth = 50;
+static const color background(0.8, 0.9, 0.99);
+
+static color ray_color(const hittable& world, const ray& r, int depth, size_t& rays) {
+    if (depth <= 0) {
+        return color(0, 0, 0);
+    }
+    rays++;
+    hit_record rec;
+    if (!world.hit(r, rec, Real(0.001), real_infinity)) {
+        return background;
+    }
+    finalize_hit(r, rec);
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat->emitted();
+    if (rec.mat->scatter(r, rec, scattered, attenuation)) {
+        return emitted + attenuation * ray_color(world, scattered, depth - 1, rays);
+    }
+    return emitted;
+}
+
+static void report(const char* name, double seconds, size_t rays, const color& sum) {
+    printf("%-24s %6.3f Mpaths/s  %6.3f Mrays/s  (%.2f rays per path, average radiance %.4f %.4f %.4f)\n", name,
+           paths / seconds / 1e6, rays / seconds / 1e6, double(rays) / paths, sum.x() / paths, sum.y() / paths,
+           sum.z() / paths);
+}
+
+/**
+ * Traces the paths with a wavefront_integrator.
+ * @return how fast the extend stage traced rays, in Mrays/s
+ */
+static double run_wavefront(const scene& world, const std::vector<ray>& batch, size_t batch_size, bool sort_rays) {
+    // One "pixel" per path, so the sum over pixels is the sum over paths
+    wavefront_integrator integrator(world, background, max_depth, paths, batch_size, sort_rays);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < paths; ++i) {
+        integrator.add_sample(batch[i], i);
+    }
+    integrator.flush();
+    double seconds = seconds_since(start);
+    color sum(0, 0, 0);
+    for (int i = 0; i < paths; ++i) {
+        sum += integrator.pixel_color(i);
+    }
+    char name[48];
+    snprintf(name, sizeof(name), "wavefront %zuK %s", batch_size >> 10, sort_rays ? "sorted" : "unsorted");
+    report(name, seconds, integrator.rays(), sum);
+    double extend_rate = integrator.rays() / integrator.extend_seconds() / 1e6;
+    printf("%24s extend %6.3f Mrays/s, sorting took %.3f s\n", "", extend_rate, integrator.sort_seconds());
+    return extend_rate;
+}
+
+int main() {
+    auto diffuse = make_shared<lambertian>(color(0.7, 0.5, 0.3));
+    auto shiny = make_shared<mirror>(color(0.8, 0.8, 0.9), Real(0.3));
+    vector<shared_ptr<hittable>> mesh = bumpy_sphere_triangles_by_ring(rings, segments, Real(0.6), [&](int ring) {
+        return (ring / 25) % 2 ? shared_ptr<material>(shiny) : shared_ptr<material>(diffuse);
+    });
+    scene world(mesh);
+
+    std::mt19937 rng(419);
+    std::vector<ray> batch = rays_at_sphere(paths, 25, rng);
+    printf("%zu triangles, %d paths\n", mesh.size(), paths);
+    mesh.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    size_t rays = 0;
+    color sum(0, 0, 0);
+    for (const ray& r : batch) {
+        sum += ray_color(world, r, max_depth, rays);
+    }
+    report("recursive", seconds_since(start), rays, sum);
+
+    const size_t batch_sizes[] = {1 << 12, 1 << 14, 1 << 16, 1 << 18};
+    for (size_t batch_size : batch_sizes) {
+        double unsorted = run_wavefront(world, batch, batch_size, false);
+        double sorted = run_wavefront(world, batch, batch_size, true);
+        printf("%24s sorting traces %+.0f%% rays/s\n", "", 100 * (sorted / unsorted - 1));
+    }
+    return 0;
+}
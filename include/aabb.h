@@ -1,6 +1,9 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include <algorithm>
+
+#include "real.h"
 #include "vec3.h"
 #include "ray.h"
 
@@ -12,49 +15,87 @@ class aabb {
          * @param p0 min point
          * @param p1 max point
          **/
-        aabb(const point3& p0, const point3& p1) : minimum(p0), maximum(p1) {
+        aabb(const point3& p0, const point3& p1) : bounds{p0, p1} {
             center = calculate_centroid();
         }
         
         point3 min() const {
-            return minimum;
+            return bounds[0];
         }
 
         point3 max() const {
-            return maximum;
+            return bounds[1];
         }
 
         point3 centroid() const {
             return center;
         }
+
+        /**
+         * @return the total area of the box's six faces
+         */
+        Real surface_area() const {
+            vec3 d = bounds[1] - bounds[0];
+            return 2 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
         
-        virtual bool hit(const ray& r, double tmin, double tmax) const;
+        virtual bool hit(const ray& r, Real tmin, Real tmax) const;
         point3 calculate_centroid() const;
 
     public:
-        point3 minimum;
-        point3 maximum;
+        /** bounds[0] is the min point and bounds[1] the max, so ray sign bits can index them */
+        point3 bounds[2];
         point3 center;
 };
 
 /**
  * Determines if there is any intersection between the aabb and the given ray.
+ * Branch-free slab test: the ray's sign bits pick the near and far plane on each
+ * axis, and its cached inverse direction replaces the divisions.
  * @param r the ray that intersects with the aabb
  * @return true or false depending on if it intersects
  **/
-bool aabb::hit(const ray& r, double tmin, double tmax) const {
-    for (int i = 0; i < 3; i++) {
-        double a = (minimum[i] - r.origin()[i]) / r.direction()[i];
-        double b = (maximum[i] - r.origin()[i]) / r.direction()[i];
-        tmin = fmax(tmin, fmin(a,b));
-        tmax = fmin(tmax, fmax(a,b));
-        if (tmax <= tmin) {
-        // if (fmax(a, b) <= fmin(a, b)) {
-            return false;
-        }
+bool aabb::hit(const ray& r, Real tmin, Real tmax) const {
+    Real tx0 = (bounds[r.sign[0]].e[0] - r.orig.e[0]) * r.inv_dir.e[0];
+    Real tx1 = (bounds[1 - r.sign[0]].e[0] - r.orig.e[0]) * r.inv_dir.e[0];
+    Real ty0 = (bounds[r.sign[1]].e[1] - r.orig.e[1]) * r.inv_dir.e[1];
+    Real ty1 = (bounds[1 - r.sign[1]].e[1] - r.orig.e[1]) * r.inv_dir.e[1];
+    Real tz0 = (bounds[r.sign[2]].e[2] - r.orig.e[2]) * r.inv_dir.e[2];
+    Real tz1 = (bounds[1 - r.sign[2]].e[2] - r.orig.e[2]) * r.inv_dir.e[2];
+
+    tmin = std::max(std::max(tx0, ty0), std::max(tz0, tmin));
+    tmax = std::min(std::min(tx1, ty1), std::min(tz1, tmax));
+    return tmin <= tmax;
+}
+
+/**
+ * The slab test of aabb::hit, for boxes stored as plain arrays in compact BVH
+ * nodes.
+ * @param lo, hi the box's min and max corners
+ **/
+inline bool hit_slabs(const Real lo[3], const Real hi[3], const ray& r, Real tmin, Real tmax) {
+    for (int a = 0; a < 3; a++) {
+        Real t0 = ((r.sign[a] ? hi[a] : lo[a]) - r.orig.e[a]) * r.inv_dir.e[a];
+        Real t1 = ((r.sign[a] ? lo[a] : hi[a]) - r.orig.e[a]) * r.inv_dir.e[a];
+        tmin = std::max(t0, tmin);
+        tmax = std::min(t1, tmax);
     }
-    return true;
+    return tmin <= tmax;
+}
 
+/**
+ * Slab test like the one above that also reports where the ray enters the box.
+ * @param entry set to the entry distance (clamped to tmin) if the box is hit
+ **/
+inline bool hit_slabs(const Real lo[3], const Real hi[3], const ray& r, Real tmin, Real tmax, Real& entry) {
+    for (int a = 0; a < 3; a++) {
+        Real t0 = ((r.sign[a] ? hi[a] : lo[a]) - r.orig.e[a]) * r.inv_dir.e[a];
+        Real t1 = ((r.sign[a] ? lo[a] : hi[a]) - r.orig.e[a]) * r.inv_dir.e[a];
+        tmin = std::max(t0, tmin);
+        tmax = std::min(t1, tmax);
+    }
+    entry = tmin;
+    return tmin <= tmax;
 }
 
 /**
@@ -64,24 +105,25 @@ bool aabb::hit(const ray& r, double tmin, double tmax) const {
  * @return the surrounding/outer aabb
  **/
 inline aabb surrounding_box(const aabb& a, const aabb& b) {
-    point3 p0(  fmin(a.min().x(), b.min().x()),
-                fmin(a.min().y(), b.min().y()),
-                fmin(a.min().z(), b.min().z()));
-    point3 p1(  fmax(a.max().x(), b.max().x()),
-                fmax(a.max().y(), b.max().y()),
-                fmax(a.max().z(), b.max().z()));
+    point3 p0(simd_min(a.min().simd(), b.min().simd()));
+    point3 p1(simd_max(a.max().simd(), b.max().simd()));
     return aabb(p0, p1);
 }
 
+/**
+ * Linearly interpolates between two boxes, corner by corner.
+ * @param t 0 for box a, 1 for box b
+ **/
+inline aabb interpolate_box(const aabb& a, const aabb& b, Real t) {
+    return aabb(a.min() + t * (b.min() - a.min()), a.max() + t * (b.max() - a.max()));
+}
+
 /**
  * Calculates the centroid for the bounding box
  * @return point3 containing the centroid
  **/
 point3 aabb::calculate_centroid() const {
-    double x = (maximum[0] + minimum[0]) / 2;
-    double y = (maximum[1] + minimum[1]) / 2;
-    double z = (maximum[2] + minimum[2]) / 2;
-    return point3(x, y, z);
+    return Real(0.5) * (bounds[1] + bounds[0]);
 }
 
 inline ostream& operator<<(ostream &out, const aabb& bbox) {
@@ -0,0 +1,71 @@
+/**
+ * @file aligned_allocator.h
+ * An allocator for standard containers whose storage must start on a
+ * boundary stricter than the element type's alignment, e.g. a cache line.
+ */
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+/**
+ * Allocates arrays of T that start on a multiple of Alignment bytes.
+ * Alignment must be a power of two and a multiple of sizeof(void*).
+ */
+template <typename T, size_t Alignment>
+class aligned_allocator {
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef aligned_allocator<U, Alignment> other;
+        };
+
+        aligned_allocator() {}
+
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+        T* allocate(size_t n) {
+            void* p = nullptr;
+#ifdef WIN32
+            // MinGW and MSVC have no posix_memalign
+            p = _aligned_malloc(n * sizeof(T), Alignment);
+            if (!p) {
+                throw std::bad_alloc();
+            }
+#else
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+                throw std::bad_alloc();
+            }
+#endif
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, size_t) {
+#ifdef WIN32
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&) {
+    return true;
+}
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&) {
+    return false;
+}
+
+#endif
@@ -8,11 +8,14 @@
 
 class camera {
     public:
-        camera(point3 eye, vec3 view, vec3 up, double d, int image_width, int image_height, double s,
-                double _time0 = 0, double _time1 = 0) {
+        camera(point3 eye, vec3 view, vec3 up, Real d, int image_width, int image_height, Real s,
+                Real _time0 = 0, Real _time1 = 0) {
             eyepoint = eye;
             dir = d;
 
+            // angle one pixel covers, so ray cones start at the pixel footprint
+            pixel_spread = s / d;
+
             // calculate orthonormal basis
             w = unit_vector(eyepoint - view);
             u = unit_vector(cross(up, w));
@@ -27,12 +30,13 @@ class camera {
 
     private:
         point3 eyepoint;
-        double dir;
+        Real dir;
+        Real pixel_spread;
         vec3 w;
         vec3 u;
         vec3 v;
-        double time0;
-        double time1;
+        Real time0;
+        Real time1;
 };
 
 /**
@@ -41,9 +45,11 @@ class camera {
  * @return a ray that can intersect objects in the world space system
  */
 ray camera::get_ray(vec3 coordinate) const {
-    vec3 pv = coordinate - eyepoint - vec3(0.0, 0.0, dir);
+    vec3 pv = coordinate - eyepoint - vec3(0, 0, dir);
     vec3 pw = u * pv.x() + v * pv.y() + w * pv.z();
-    return ray(eyepoint, pw, random_double(time0, time1));
+    ray r(eyepoint, pw, random_double(time0, time1));
+    r.set_cone(0, pixel_spread);
+    return r;
 }
 
 #endif
@@ -19,10 +19,10 @@ void write_color(std::ostream &out, color pixel_color) {
 /**
  * Darkens the given color by the factor. The smaller the factor, the darker the result
  * @param pixel_color vec3 containing color information, with each channel in [0,1]
- * @param factor double between [0.0, 1.0]
+ * @param factor Real between [0.0, 1.0]
  * @return the new color after it's been shaded
  **/
-color shade(color pixel_color, double factor) {
+color shade(color pixel_color, Real factor) {
     return pixel_color * factor;
 }
 
@@ -0,0 +1,176 @@
+/**
+ * @file fast_math.h
+ * Polynomial approximations of the transcendental functions used in shading.
+ *
+ * The kernels are branch-free (selects only, no tables), so loops that call
+ * them can be auto-vectorized. Error bounds below are the measured maximum
+ * over the stated domain for float, built with the Makefile's -Ofast.
+ *
+ * Build with -DRT_EXACT_MATH to replace every kernel with the libm call it
+ * approximates, e.g. to check a render against the exact result.
+ */
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "real.h"
+
+#ifndef RT_EXACT_MATH
+
+/**
+ * Approximates sin(x) with a degree 9 odd polynomial after reducing x to
+ * [-pi/2, pi/2].
+ * Absolute error < 3e-7 for |x| < 10. Beyond that it grows roughly as 6e-8 * |x|,
+ * because -Ofast folds the two-step reduction back into one.
+ */
+inline Real fast_sin(Real x) {
+    // Cody-Waite reduction: x = k*pi + r, with pi split in two so k*pi_hi is exact
+    const Real inv_pi = Real(0.31830988618379067);
+    const Real pi_hi = Real(3.140625);
+    const Real pi_lo = Real(9.67653589793e-4);
+    Real kf = x * inv_pi;
+    int k = static_cast<int>(kf + (kf >= 0 ? Real(0.5) : Real(-0.5)));
+    Real r = (x - k * pi_hi) - k * pi_lo;
+
+    Real s = r * r;
+    Real p = Real(2.6051662761e-06);
+    p = p * s + Real(-1.9809046357e-04);
+    p = p * s + Real(8.3330506173e-03);
+    p = p * s + Real(-1.6666657970e-01);
+    p = p * s + Real(9.9999999572e-01);
+    p *= r;
+
+    // sin(k*pi + r) = (-1)^k sin(r)
+    return (k & 1) ? -p : p;
+}
+
+/**
+ * Approximates acos(x) for x in [-1, 1] (Abramowitz & Stegun 4.4.46).
+ * Absolute error < 5e-7 rad.
+ */
+inline Real fast_acos(Real x) {
+    Real a = std::fabs(x);
+    Real p = Real(-0.0012624911);
+    p = p * a + Real(0.0066700901);
+    p = p * a + Real(-0.0170881256);
+    p = p * a + Real(0.0308918810);
+    p = p * a + Real(-0.0501743046);
+    p = p * a + Real(0.0889789874);
+    p = p * a + Real(-0.2145988016);
+    p = p * a + Real(1.5707963050);
+    p *= std::sqrt(std::max(1 - a, Real(0)));
+    return x < 0 ? real_pi - p : p;
+}
+
+/**
+ * Approximates atan2(y, x) with a degree 15 polynomial for atan on [0, 1]
+ * (Abramowitz & Stegun 4.4.49) plus octant fix-ups.
+ * Absolute error < 4e-7 rad. Returns 0 for atan2(0, 0).
+ */
+inline Real fast_atan2(Real y, Real x) {
+    Real ax = std::fabs(x);
+    Real ay = std::fabs(y);
+    Real hi = std::max(ax, ay);
+    Real lo = std::min(ax, ay);
+    Real z = hi > 0 ? lo / hi : Real(0);
+
+    Real s = z * z;
+    Real p = Real(-0.0040540580);
+    p = p * s + Real(0.0218612288);
+    p = p * s + Real(-0.0559098861);
+    p = p * s + Real(0.0964200441);
+    p = p * s + Real(-0.1390853351);
+    p = p * s + Real(0.1994653599);
+    p = p * s + Real(-0.3332985605);
+    p = p * s + Real(0.9999993329);
+    p *= z;
+
+    p = ay > ax ? real_pi / 2 - p : p;
+    p = x < 0 ? real_pi - p : p;
+    return y < 0 ? -p : p;
+}
+
+/**
+ * Approximates log2(x) for finite x > 0 from the float exponent plus a degree 7
+ * polynomial on the mantissa.
+ * Absolute error < 4.2e-7 for x in [0.5, 2]. Past that, rounding the sum to
+ * single precision dominates, and the error stays below 4.2e-7 * |log2(x)|.
+ */
+inline Real fast_log2(Real x) {
+    float f = static_cast<float>(x);
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    Real e = static_cast<Real>(static_cast<int>((bits >> 23) & 0xFF) - 127);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+
+    Real t = m - 1;
+    Real p = Real(1.4778720766e-02);
+    p = p * t + Real(-7.6848725967e-02);
+    p = p * t + Real(1.9042083139e-01);
+    p = p * t + Real(-3.2311593513e-01);
+    p = p * t + Real(4.7249952519e-01);
+    p = p * t + Real(-7.2038661194e-01);
+    p = p * t + Real(1.4426521110e+00);
+    p = p * t + Real(3.1969782881e-07);
+    return e + p;
+}
+
+/**
+ * Approximates 2^x by splitting x into integer and fractional parts and
+ * using a degree 5 polynomial on the fraction. x is clamped to [-126, 127].
+ * Relative error < 2e-7.
+ */
+inline Real fast_exp2(Real x) {
+    x = std::min(std::max(x, Real(-126)), Real(127));
+    int i = static_cast<int>(x);
+    i -= (x < i);
+    Real f = x - i;
+
+    Real p = Real(1.8951072910e-03);
+    p = p * f + Real(8.9462146663e-03);
+    p = p * f + Real(5.5863282659e-02);
+    p = p * f + Real(2.4014077009e-01);
+    p = p * f + Real(6.9315462000e-01);
+    p = p * f + Real(9.9999989576e-01);
+
+    uint32_t bits = static_cast<uint32_t>(i + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/**
+ * Approximates pow(x, y) as exp2(y * log2(x)). Returns 0 for x <= 0.
+ * Relative error < 2e-5 for |y| <= 32 with a finite, non-underflowing result.
+ */
+inline Real fast_pow(Real x, Real y) {
+    return x > 0 ? fast_exp2(y * fast_log2(x)) : Real(0);
+}
+
+#else
+
+inline Real fast_sin(Real x) { return std::sin(x); }
+inline Real fast_acos(Real x) { return std::acos(x); }
+inline Real fast_atan2(Real y, Real x) { return std::atan2(y, x); }
+inline Real fast_log2(Real x) { return std::log2(x); }
+inline Real fast_exp2(Real x) { return std::exp2(x); }
+inline Real fast_pow(Real x, Real y) { return x > 0 ? std::pow(x, y) : Real(0); }
+
+#endif
+
+/**
+ * Computes x^5 with three multiplies. Exact in both modes, so Schlick's
+ * approximation doesn't need a general pow.
+ */
+inline Real pow5(Real x) {
+    Real x2 = x * x;
+    return x2 * x2 * x;
+}
+
+#endif
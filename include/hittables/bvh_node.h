@@ -9,11 +9,60 @@
 #include "hittables/hittable_list.h"
 
 #include <algorithm>
+#include <chrono>
 #include <vector>
 #include <cstdlib>
 
 using std::vector;
 
+// Relative costs of visiting a node and of testing a primitive, for the
+// surface area heuristic (SAH)
+const Real bvh_traversal_cost = 1;
+const Real bvh_intersection_cost = 1;
+
+/**
+ * What bvh_node::update did to keep the tree in shape.
+ */
+struct bvh_update_report {
+    size_t rebuilt_subtrees = 0;   // subtrees rebuilt from their primitives
+    size_t rebuilt_primitives = 0; // primitives in those subtrees
+    bool full_rebuild = false;     // whether the whole tree was rebuilt
+    Real sah_before = 0;           // SAH cost after the refit
+    Real sah_after = 0;            // SAH cost after any rebuilds
+};
+
+/**
+ * What bvh_node::optimize did to the tree.
+ */
+struct bvh_optimize_report {
+    size_t rotations = 0;          // subtrees swapped between nodes
+    int passes = 0;                // passes over the tree, the last possibly cut short
+    bool converged = false;        // whether the last pass found nothing to improve
+    double seconds = 0;            // time spent
+    Real sah_before = 0;
+    Real sah_after = 0;
+};
+
+/**
+ * A node of a bounding volume hierarchy.
+ *
+ * For animation, move the primitives (sphere::move_to, instance::set_transform)
+ * and call update() on the root once per frame instead of building a new tree.
+ * It refits every box bottom-up in one linear pass, then rebuilds only the
+ * subtrees whose SAH cost has degraded too far since they were built.
+ *
+ * Nodes that are children of this tree are refit with it; instances are
+ * leaves, so a bottom-level BVH shared through them is left alone.
+ *
+ * For motion blur, each node whose subtree moves also keeps its box at
+ * shutter open and at shutter close, and rays are tested against the box
+ * interpolated to their time rather than the box swept over the whole shutter.
+ * Rays with times outside the shutter are tested at its nearest end.
+ *
+ * The midpoint split builds quickly but not the best tree. For a tree that
+ * will be traced for many frames, optimize() improves it afterwards with tree
+ * rotations, for as long as it is given.
+ */
 class bvh_node : public hittable {
     public: 
         /**
@@ -23,14 +72,15 @@ class bvh_node : public hittable {
 
         /**
          * Constructs a BVH subtree from a list of objects.
+         * @param time0, time1 the camera's shutter interval, for motion bounds
          */
-        bvh_node(const vector<shared_ptr<hittable>>& objects);
+        bvh_node(const vector<shared_ptr<hittable>>& objects, Real time0 = 0, Real time1 = 1);
 
         /**
          * Constructs a BVH subtree from a list of objects.
          */
-        bvh_node(const hittable_list& list)
-        : bvh_node(list.objects_) {}
+        bvh_node(const hittable_list& list, Real time0 = 0, Real time1 = 1)
+        : bvh_node(list.objects_, time0, time1) {}
 
         /**
          * @return The type of hittable this is ("bvh node")
@@ -40,13 +90,100 @@ class bvh_node : public hittable {
         }
 
         virtual vec3 surface_normal(const point3 position) const override;
-        virtual bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const override;
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
         virtual aabb bounding_box() const override;
+        virtual bool motion_bounds(Real time0, Real time1, aabb& box0, aabb& box1) const override;
+
+        /**
+         * Recomputes the boxes of this subtree bottom-up from its primitives'
+         * current bounds, keeping the tree's structure.
+         */
+        void refit();
+
+        /**
+         * Refits the subtree, then rebuilds each subtree whose SAH cost grew by
+         * more than the threshold factor since it was built. If the damage
+         * reaches this node, the whole subtree is rebuilt.
+         * @param threshold allowed ratio of current to build-time SAH cost
+         */
+        bvh_update_report update(Real threshold = 1.5);
+
+        /**
+         * Lowers the subtree's SAH cost by tree rotations: at each node,
+         * bottom-up, swaps a child with a grandchild or two grandchildren if
+         * that lowers the node's cost, and repeats over the whole subtree until
+         * nothing improves or time runs out. The optimized tree becomes the
+         * baseline for update()'s degradation threshold.
+         * @param seconds the time budget
+         */
+        bvh_optimize_report optimize(double seconds);
+
+        /**
+         * @return the expected cost of tracing a ray that enters this node's box
+         */
+        Real sah_cost() const {
+            return cost_;
+        }
+
+        /**
+         * @return the SAH cost now, relative to when the subtree was built
+         */
+        Real degradation() const {
+            return built_cost_ > 0 ? cost_ / built_cost_ : 1;
+        }
+
+        /**
+         * Gathers the primitives at the leaves of this subtree.
+         */
+        void collect_primitives(vector<shared_ptr<hittable>>& primitives) const;
 
     public:
         shared_ptr<hittable> left;
         shared_ptr<hittable> right;
         aabb bbox;
+
+    private:
+        // left and right, if they are nodes of this tree (refit descends into them)
+        bvh_node* left_node_ = nullptr;
+        bvh_node* right_node_ = nullptr;
+        Real cost_ = 0;
+        Real built_cost_ = 0;
+
+        // boxes at shutter open and close; only used if the subtree moves
+        bool moving_ = false;
+        aabb motion_box_[2];
+        Real time0_ = 0;
+        Real time1_ = 1;
+        Real inv_shutter_ = 1;
+
+        void link();
+        void update_motion_bounds();
+        void update_cost();
+        bool rebuild_degraded(Real threshold, bvh_update_report& report);
+        void optimize_subtree(std::chrono::steady_clock::time_point deadline, bvh_optimize_report& report);
+        bool rotate();
+
+        /**
+         * @return a child's SAH cost times its surface area, which is what it
+         * adds to its parent's cost times the parent's area
+         */
+        static Real weighted_cost(const shared_ptr<hittable>& child, const bvh_node* node) {
+            return child->bounding_box().surface_area() * (node ? node->cost_ : bvh_intersection_cost);
+        }
+
+        /**
+         * @return the weighted cost of a new node over two children
+         */
+        static Real pair_cost(const shared_ptr<hittable>& a, Real a_cost, const shared_ptr<hittable>& b, Real b_cost) {
+            return bvh_traversal_cost * surrounding_box(a->bounding_box(), b->bounding_box()).surface_area()
+                 + a_cost + b_cost;
+        }
+
+        static Real area_ratio(const aabb& child, const aabb& parent) {
+            Real area = parent.surface_area();
+            return (area > 0 && area < real_infinity) ? child.surface_area() / area : 1;
+        }
 };
 
 
@@ -58,21 +195,63 @@ vec3 bvh_node::surface_normal(const point3 position) const {
 }
 
 
-bool bvh_node::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
-    if (!bbox.hit(r, tmin, tmax)) {
+bool bvh_node::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    if (moving_) {
+        // Interpolate just the corners, not a whole aabb with its centroid
+        Real u = clamp((r.time() - time0_) * inv_shutter_, 0, 1);
+        const point3* open = motion_box_[0].bounds;
+        const point3* close = motion_box_[1].bounds;
+        Real lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = open[0].e[a] + u * (close[0].e[a] - open[0].e[a]);
+            hi[a] = open[1].e[a] + u * (close[1].e[a] - open[1].e[a]);
+        }
+        if (!hit_slabs(lo, hi, r, tmin, tmax)) {
+            return false;
+        }
+    } else if (!bbox.hit(r, tmin, tmax)) {
         return false;
     }
     
-    double hit_left = left->hit(r, rec, tmin, tmax);
-    double hit_right = right->hit(r, rec, tmin, hit_left ? rec.t : tmax);
+    bool hit_left = left->hit(r, rec, tmin, tmax);
+    bool hit_right = right->hit(r, rec, tmin, hit_left ? rec.t : tmax);
     return hit_left || hit_right;
 }
 
 
+/**
+ * Hits are recorded against the leaf primitive, so this just forwards to it.
+ */
+void bvh_node::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.object->finalize_interaction(r, rec);
+}
+
+
 aabb bvh_node::bounding_box() const {
     return bbox;
 }
 
+
+bool bvh_node::motion_bounds(Real time0, Real time1, aabb& box0, aabb& box1) const {
+    if (!left || !moving_) {
+        box0 = box1 = bbox;
+        return false;
+    }
+    if (time0 == time0_ && time1 == time1_) {
+        box0 = motion_box_[0];
+        box1 = motion_box_[1];
+        return true;
+    }
+
+    // Built for another shutter, so ask the children
+    aabb left0, left1, right0, right1;
+    left->motion_bounds(time0, time1, left0, left1);
+    right->motion_bounds(time0, time1, right0, right1);
+    box0 = surrounding_box(left0, right0);
+    box1 = surrounding_box(left1, right1);
+    return true;
+}
+
 /**
  * BVH node constructor
  * Recursively creates sub trees for both left and right sides
@@ -81,7 +260,8 @@ aabb bvh_node::bounding_box() const {
  * @param start: the starting index of objects to look at
  * @param end: the ending index of objects to look at
  */
-bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
+bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects, Real time0, Real time1)
+: time0_(time0), time1_(time1), inv_shutter_(time1 > time0 ? 1 / (time1 - time0) : 0) {
     vector<shared_ptr<hittable>> objs_list = objects;
     if (objs_list.size() == 0) {
         return;
@@ -93,12 +273,12 @@ bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
         left = objs_list[1];
     } else {
         // Compute (xmin, ymin, zmin) and (xmax, ymax, zmax) for centroids
-        double min[3];
-        double max[3];
+        Real min[3];
+        Real max[3];
         bool first = true;
         for (unsigned o = 0; o < objs_list.size(); o++) {
             for (int i = 0; i < 3; i++) {
-                double var = objs_list[o]->bounding_box().centroid()[i];
+                Real var = objs_list[o]->bounding_box().centroid()[i];
                 if (first) {
                     min[i] = max[i] = var;
                 } else {
@@ -115,9 +295,9 @@ bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
 
         // pick axis based on largest spread
         int axis = 0;
-        double range = max[0] - min[0];
-        double yrange = max[1] - min[1];
-        double zrange = max[2] - min[2];
+        Real range = max[0] - min[0];
+        Real yrange = max[1] - min[1];
+        Real zrange = max[2] - min[2];
         if (yrange > range) {
             axis = 1;
             range = yrange;
@@ -133,7 +313,7 @@ bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
         vector<shared_ptr<hittable>> left_split;
         vector<shared_ptr<hittable>> right_split;
         for (unsigned o = 0; o < objs_list.size(); o++) {
-            double curr = objs_list[o]->bounding_box().centroid()[axis];
+            Real curr = objs_list[o]->bounding_box().centroid()[axis];
             if (curr >= median_split) {
                 right_split.push_back(objs_list[o]);
             } else {
@@ -141,16 +321,28 @@ bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
             }
         }
 
+        // All centroids on one side, e.g. objects moved onto each other, so
+        // split at half the count instead
+        if (left_split.empty() || right_split.empty()) {
+            size_t half = objs_list.size() / 2;
+            std::nth_element(objs_list.begin(), objs_list.begin() + half, objs_list.end(),
+                             [axis](const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
+                                 return a->bounding_box().centroid()[axis] < b->bounding_box().centroid()[axis];
+                             });
+            left_split.assign(objs_list.begin(), objs_list.begin() + half);
+            right_split.assign(objs_list.begin() + half, objs_list.end());
+        }
+
         if (left_split.size() == 1) {
             left = left_split[0];
         } else {
-            left = make_shared<bvh_node>(left_split);
+            left = make_shared<bvh_node>(left_split, time0, time1);
         }
 
         if (right_split.size() == 1) {
             right = right_split[0];
         } else {
-            right = make_shared<bvh_node>(right_split);
+            right = make_shared<bvh_node>(right_split, time0, time1);
         }
     }
 
@@ -158,6 +350,256 @@ bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects) {
     aabb box_right = right->bounding_box();
     
     bbox = surrounding_box(box_left, box_right);
+    link();
+    update_motion_bounds();
+    update_cost();
+    built_cost_ = cost_;
+}
+
+
+/**
+ * Finds which children are nodes of this tree.
+ */
+void bvh_node::link() {
+    left_node_ = dynamic_cast<bvh_node*>(left.get());
+    right_node_ = dynamic_cast<bvh_node*>(right.get());
+}
+
+
+/**
+ * Recomputes the node's boxes at shutter open and close from its children's.
+ */
+void bvh_node::update_motion_bounds() {
+    aabb left0, left1, right0, right1;
+    bool left_moves = left->motion_bounds(time0_, time1_, left0, left1);
+    bool right_moves = right->motion_bounds(time0_, time1_, right0, right1);
+    moving_ = left_moves || right_moves;
+    if (moving_) {
+        motion_box_[0] = surrounding_box(left0, right0);
+        motion_box_[1] = surrounding_box(left1, right1);
+    }
+}
+
+
+/**
+ * Recomputes this node's SAH cost from its children's: a traversal step, then
+ * each child's cost weighted by the chance that a ray through this box also
+ * enters the child's box (the ratio of their surface areas).
+ */
+void bvh_node::update_cost() {
+    if (!left) {
+        cost_ = 0;
+        return;
+    }
+    Real left_cost = left_node_ ? left_node_->cost_ : bvh_intersection_cost;
+    if (left == right) {
+        cost_ = bvh_traversal_cost + left_cost;
+        return;
+    }
+    Real right_cost = right_node_ ? right_node_->cost_ : bvh_intersection_cost;
+    cost_ = bvh_traversal_cost
+          + area_ratio(left->bounding_box(), bbox) * left_cost
+          + area_ratio(right->bounding_box(), bbox) * right_cost;
+}
+
+
+void bvh_node::refit() {
+    if (!left) {
+        return;
+    }
+    if (left_node_) {
+        left_node_->refit();
+    }
+    if (right_node_ && right != left) {
+        right_node_->refit();
+    }
+    bbox = surrounding_box(left->bounding_box(), right->bounding_box());
+    update_motion_bounds();
+    update_cost();
+}
+
+
+bvh_update_report bvh_node::update(Real threshold) {
+    bvh_update_report report;
+    refit();
+    report.sah_before = cost_;
+    report.full_rebuild = rebuild_degraded(threshold, report);
+    report.sah_after = cost_;
+    return report;
+}
+
+
+/**
+ * Fixes degraded children first, since a rebuild there is cheaper and often
+ * enough; rebuilds this subtree only if it is still degraded after that.
+ * Every child is visited, since a badly degraded subtree can hide under a
+ * node whose cost barely moved.
+ * @return whether this whole subtree was rebuilt
+ */
+bool bvh_node::rebuild_degraded(Real threshold, bvh_update_report& report) {
+    if (!left) {
+        return false;
+    }
+    if (left_node_) {
+        left_node_->rebuild_degraded(threshold, report);
+    }
+    if (right_node_ && right != left) {
+        right_node_->rebuild_degraded(threshold, report);
+    }
+    update_cost();
+
+    if (degradation() <= threshold) {
+        return false;
+    }
+
+    vector<shared_ptr<hittable>> primitives;
+    collect_primitives(primitives);
+    report.rebuilt_subtrees++;
+    report.rebuilt_primitives += primitives.size();
+
+    bvh_node rebuilt(primitives, time0_, time1_);
+    left = rebuilt.left;
+    right = rebuilt.right;
+    bbox = rebuilt.bbox;
+    moving_ = rebuilt.moving_;
+    motion_box_[0] = rebuilt.motion_box_[0];
+    motion_box_[1] = rebuilt.motion_box_[1];
+    link();
+    cost_ = built_cost_ = rebuilt.cost_;
+    return true;
+}
+
+
+bvh_optimize_report bvh_node::optimize(double seconds) {
+    bvh_optimize_report report;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>(seconds));
+    report.sah_before = cost_;
+    while (!report.converged && std::chrono::steady_clock::now() < deadline) {
+        size_t rotations = report.rotations;
+        optimize_subtree(deadline, report);
+        report.passes++;
+        report.converged = report.rotations == rotations;
+    }
+    report.sah_after = cost_;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+
+/**
+ * One bottom-up pass of rotations. Costs are brought up to date all the way
+ * to this node even after the deadline, so they stay right for the parents.
+ */
+void bvh_node::optimize_subtree(std::chrono::steady_clock::time_point deadline, bvh_optimize_report& report) {
+    if (!left) {
+        return;
+    }
+    if (left_node_) {
+        left_node_->optimize_subtree(deadline, report);
+    }
+    if (right_node_ && right != left) {
+        right_node_->optimize_subtree(deadline, report);
+    }
+    update_cost();
+    if (left != right && std::chrono::steady_clock::now() < deadline && rotate()) {
+        report.rotations++;
+    }
+    built_cost_ = cost_;
+}
+
+
+/**
+ * Tries swapping each child with its sibling's children, and the children of
+ * one child with those of the other, and makes the swap that lowers this
+ * node's cost the most. This node's box doesn't change, so comparing the
+ * children's weighted costs is enough.
+ * @return whether a swap was made
+ */
+bool bvh_node::rotate() {
+    bvh_node* l = left_node_;
+    bvh_node* r = right_node_;
+    bool l_split = l && l->left && l->left != l->right;
+    bool r_split = r && r->left && r->left != r->right;
+    if (!l_split && !r_split) {
+        return false;
+    }
+
+    Real wl = weighted_cost(left, l), wr = weighted_cost(right, r);
+    Real best = wl + wr;
+    if (!(best < real_infinity)) {
+        return false;
+    }
+    // Swaps must beat the current cost by a margin, so rounding can't make them cycle
+    Real margin = Real(0.999);
+    shared_ptr<hittable>* swap_a = nullptr;
+    shared_ptr<hittable>* swap_b = nullptr;
+    bvh_node* changed[2] = {nullptr, nullptr};
+    auto consider = [&](Real cost, shared_ptr<hittable>* a, shared_ptr<hittable>* b, bvh_node* c0, bvh_node* c1) {
+        if (cost < best * margin) {
+            best = cost;
+            swap_a = a;
+            swap_b = b;
+            changed[0] = c0;
+            changed[1] = c1;
+        }
+    };
+
+    Real wll = 0, wlr = 0, wrl = 0, wrr = 0;
+    if (l_split) {
+        wll = weighted_cost(l->left, l->left_node_);
+        wlr = weighted_cost(l->right, l->right_node_);
+        // right <-> left.left makes left (right, left.right), and so on
+        consider(wll + pair_cost(right, wr, l->right, wlr), &right, &l->left, l, nullptr);
+        consider(wlr + pair_cost(l->left, wll, right, wr), &right, &l->right, l, nullptr);
+    }
+    if (r_split) {
+        wrl = weighted_cost(r->left, r->left_node_);
+        wrr = weighted_cost(r->right, r->right_node_);
+        consider(wrl + pair_cost(left, wl, r->right, wrr), &left, &r->left, r, nullptr);
+        consider(wrr + pair_cost(r->left, wrl, left, wl), &left, &r->right, r, nullptr);
+    }
+    if (l_split && r_split) {
+        consider(pair_cost(r->left, wrl, l->right, wlr) + pair_cost(l->left, wll, r->right, wrr),
+                 &l->left, &r->left, l, r);
+        consider(pair_cost(r->right, wrr, l->right, wlr) + pair_cost(r->left, wrl, l->left, wll),
+                 &l->left, &r->right, l, r);
+    }
+    if (!swap_a) {
+        return false;
+    }
+
+    std::swap(*swap_a, *swap_b);
+    for (bvh_node* node : changed) {
+        if (node) {
+            node->link();
+            node->bbox = surrounding_box(node->left->bounding_box(), node->right->bounding_box());
+            node->update_motion_bounds();
+            node->update_cost();
+            node->built_cost_ = node->cost_;
+        }
+    }
+    link();
+    update_motion_bounds();
+    update_cost();
+    return true;
+}
+
+
+void bvh_node::collect_primitives(vector<shared_ptr<hittable>>& primitives) const {
+    if (!left) {
+        return;
+    }
+    const shared_ptr<hittable>* children[2] = {&left, &right};
+    const bvh_node* nodes[2] = {left_node_, right_node_};
+    for (int i = 0; i < (left == right ? 1 : 2); i++) {
+        if (nodes[i]) {
+            nodes[i]->collect_primitives(primitives);
+        } else {
+            primitives.push_back(*children[i]);
+        }
+    }
 }
 
 #endif
\ No newline at end of file
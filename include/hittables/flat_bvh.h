@@ -0,0 +1,1178 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <iterator>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "aligned_allocator.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+#include "hittables/hittable_list.h"
+#include "hittables/bvh_node.h"
+#include "hittables/mesh_triangle.h"
+#include "hittables/moving_sphere.h"
+#include "hittables/rectangle.h"
+#include "hittables/sphere.h"
+#include "hittables/triangle.h"
+
+/**
+ * The kinds of primitive a flat_bvh stores in arrays of their own.
+ * Anything else is a custom primitive, reached through the virtual hittable API.
+ */
+enum class primitive_type : uint8_t {
+    sphere,
+    moving_sphere,
+    triangle,
+    rectangle,
+    mesh_triangle,
+    custom
+};
+
+/**
+ * How a flat_bvh chooses where to split its nodes.
+ */
+enum class bvh_split {
+    median,   // at the median centroid on the widest axis: fastest to build
+    sah,      // binned surface area heuristic over object splits
+    spatial   // SAH over object splits and spatial splits (an SBVH)
+};
+
+/**
+ * How a flat_bvh orders its nodes in memory once it is built.
+ */
+enum class bvh_layout {
+    depth_first,  // each pair of siblings is followed by the subtree of the first
+    treelet       // breadth-first within page-sized treelets, so the top levels share a page
+};
+
+/**
+ * A node of a flat_bvh, in 32 bytes. The two children of an interior node
+ * are next to each other, at even indices of a 64-byte aligned array, so a
+ * pair of siblings fills one cache line.
+ */
+struct flat_bvh_node {
+    Real min[3];
+    uint32_t offset;   // leaf: first primitive in its type's array; interior: index of the first child
+    Real max[3];
+    uint16_t count;    // leaf: number of primitives; 0 for interior nodes
+    uint8_t axis;      // interior: axis the children were split on
+    primitive_type type; // leaf: the type of all its primitives
+};
+
+/**
+ * A primitive waiting to be placed in the tree while it is being built.
+ */
+struct flat_bvh_ref {
+    aabb box;
+    shared_ptr<hittable> object;
+    primitive_type type;
+};
+
+/**
+ * A bounding volume hierarchy for static scenes, stored as one array of
+ * compact nodes, with primitives stored by value in one array per type.
+ *
+ * Every leaf holds primitives of a single type, as a range of that type's
+ * array, so a leaf is intersected by a switch on its type followed by a loop
+ * of non-virtual, inlinable hit calls. Traversal is a loop with a small stack
+ * instead of virtual calls on child nodes. Primitives of other types (meshes
+ * behind instances, sphere sets, user-defined hittables) are custom leaves,
+ * hit through the virtual hittable API.
+ *
+ * The default builder is an SBVH: besides splitting the list of primitives
+ * in two (object splits), it may cut space with a plane and put the parts of
+ * the primitives crossing it into both children (spatial splits), clipping
+ * their boxes to each side. This keeps big or long, thin triangles and
+ * rectangles from bloating the boxes they share with everything else. A
+ * primitive in several leaves is copied into each, and the number of copies
+ * is capped by a growth factor.
+ *
+ * After building, the nodes are laid out again with siblings in one cache
+ * line, depth-first or with the top levels of each subtree clustered in one
+ * page (which only pays off where TLB misses dominate), and the primitive
+ * arrays are permuted into the order their leaves appear.
+ * Traversal tests both children of a node together and prefetches the
+ * children of the one it defers.
+ *
+ * Primitives are copied in, so moving the originals later has no effect; use
+ * bvh_node, which can be refit, for animated scenes. Moving spheres are
+ * bounded by their box over the whole shutter (no motion bounds, unlike
+ * bvh_node), which is why a scene uses bvh_node when anything moves.
+ */
+class flat_bvh : public hittable {
+    public:
+        /**
+         * Builds the tree over a list of objects. bvh_nodes and hittable_lists
+         * among them are opened up and their primitives added directly.
+         * @param split how to choose splits
+         * @param max_growth for spatial splits, the most primitive references
+         * the tree may hold, as a multiple of the number of primitives
+         * @param layout how to order the nodes in memory
+         */
+        flat_bvh(const vector<shared_ptr<hittable>>& objects, bvh_split split = bvh_split::spatial,
+                 Real max_growth = Real(1.3), bvh_layout layout = bvh_layout::depth_first);
+
+        flat_bvh(const hittable_list& list, bvh_split split = bvh_split::spatial, Real max_growth = Real(1.3),
+                 bvh_layout layout = bvh_layout::depth_first)
+        : flat_bvh(list.objects_, split, max_growth, layout) {}
+
+        // Trees are big enough that a copy is almost certainly a mistake.
+        // Moving takes the nodes and primitives and leaves an empty tree.
+        flat_bvh(const flat_bvh&) = delete;
+        flat_bvh& operator=(const flat_bvh&) = delete;
+
+        flat_bvh(flat_bvh&& other) noexcept {
+            take(other);
+        }
+
+        flat_bvh& operator=(flat_bvh&& other) noexcept {
+            if (this != &other) {
+                take(other);
+            }
+            return *this;
+        }
+
+        /**
+         * The deepest a leaf may be, so that traversal can keep the nodes it
+         * defers on a fixed stack. Building asserts it.
+         */
+        static const int max_depth = 128;
+
+        virtual std::string type() const override {
+            return "flat bvh";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+
+        /**
+         * Hits are recorded against the primitive that was hit, so this just
+         * forwards to it.
+         */
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override {
+            rec.object->finalize_interaction(r, rec);
+        }
+
+        /**
+         * This function should never be used
+         */
+        virtual vec3 surface_normal(const point3 position) const override {
+            return vec3(0, 0, 0);
+        }
+
+        virtual aabb bounding_box() const override {
+            return bbox_;
+        }
+
+        /**
+         * @return the number of nodes in the tree
+         */
+        size_t node_count() const {
+            return nodes_.size();
+        }
+
+        /**
+         * @return the number of primitives stored in the leaves
+         */
+        size_t primitive_count() const {
+            return spheres_.size() + moving_spheres_.size() + triangles_.size() + rectangles_.size()
+                 + mesh_triangles_.size() + customs_.size();
+        }
+
+        /**
+         * @return the number of primitives of one type, which is the size of
+         * the array that leaves of that type index into
+         */
+        size_t primitive_count(primitive_type type) const;
+
+        /**
+         * @return the laid out nodes, starting with the root, or null once
+         * they have been released
+         */
+        const flat_bvh_node* nodes() const {
+            return nodes_.empty() ? nullptr : nodes_.data();
+        }
+
+        /**
+         * Frees the nodes but keeps the primitives, for a structure that has
+         * copied the tree into a form of its own and intersects the leaves
+         * with hit_leaf(). hit() finds nothing afterwards.
+         */
+        void release_nodes() {
+            decltype(nodes_)().swap(nodes_);
+        }
+
+        bool hit_leaf(const flat_bvh_node& node, const ray& r, hit_record& rec, Real tmin, Real& closest) const;
+
+        /**
+         * @return the expected cost of tracing a ray that enters the root box,
+         * by the surface area heuristic
+         */
+        Real sah_cost() const;
+
+        /**
+         * Traces a ray like hit() does.
+         * @return how many nodes the ray visited
+         */
+        size_t nodes_visited(const ray& r, Real tmin, Real tmax) const {
+            hit_record rec;
+            size_t visits = 0;
+            traverse<true>(r, rec, tmin, tmax, visits);
+            return visits;
+        }
+
+    private:
+        static const int max_leaf_size = 4;
+        // Bins per axis when evaluating splits
+        static const int split_bins = 16;
+        // Deeper than this, nodes are split at the median centroid. That halves
+        // their references, so the tree ends well within max_depth.
+        static const int max_sah_depth = 48;
+        // Pairs of siblings per treelet: 64 pairs of 64 bytes fill a 4 KB page
+        static const int treelet_pairs = 64;
+
+        /**
+         * A candidate split and its SAH cost.
+         */
+        struct split_choice {
+            Real cost = real_infinity;
+            int axis = 0;
+            Real position = 0;  // spatial split: the plane; object split: the centroid bound
+            bool spatial = false;
+            aabb left, right;
+        };
+
+        // Only used while building with spatial splits
+        size_t ref_budget_ = 0;
+        size_t ref_count_ = 0;
+        Real root_area_ = 0;
+
+        // The tree as it is built: an interior node's first child follows it
+        std::vector<flat_bvh_node> built_;
+        // The laid out tree, starting on a cache line
+        std::vector<flat_bvh_node, aligned_allocator<flat_bvh_node, 64>> nodes_;
+
+        std::vector<sphere> spheres_;
+        std::vector<moving_sphere> moving_spheres_;
+        std::vector<triangle> triangles_;
+        std::vector<rectangle> rectangles_;
+        std::vector<mesh_triangle> mesh_triangles_;
+        std::vector<shared_ptr<hittable>> customs_;
+        // the meshes mesh_triangles_ point into, which they don't own
+        std::vector<shared_ptr<const compressed_mesh>> meshes_;
+        aabb bbox_;
+
+        void take(flat_bvh& other);
+        static void add_object(const shared_ptr<hittable>& object, std::vector<flat_bvh_ref>& refs);
+        uint32_t build(std::vector<flat_bvh_ref>& refs, size_t begin, size_t end, int depth);
+        uint32_t build_sah(std::vector<flat_bvh_ref>& refs, bool spatial, int depth);
+        split_choice best_object_split(const std::vector<flat_bvh_ref>& refs, const aabb& centroids) const;
+        split_choice best_spatial_split(const std::vector<flat_bvh_ref>& refs, const aabb& box) const;
+        static bool clip_ref(const flat_bvh_ref& ref, int axis, Real lo, Real hi, aabb& clipped);
+        Real subtree_cost(uint32_t index) const;
+        void lay_out(bvh_layout layout);
+        void reorder_primitives();
+
+        template <bool count_visits>
+        bool traverse(const ray& r, hit_record& rec, Real tmin, Real tmax, size_t& visits) const;
+        void make_leaf(flat_bvh_node& node, const std::vector<flat_bvh_ref>& refs, size_t begin, size_t end);
+        void keep_mesh(const compressed_mesh* mesh);
+
+        /**
+         * Moves the contents of one container into another and frees the
+         * source's storage.
+         */
+        template <typename C>
+        static void take_contents(C& to, C& from) {
+            to.swap(from);
+            C().swap(from);
+        }
+
+        /**
+         * Copies the primitives of refs[begin, end) into one type's array.
+         * @return the index of the first one
+         */
+        template <typename T>
+        static uint32_t append(std::vector<T>& primitives, const std::vector<flat_bvh_ref>& refs,
+                               size_t begin, size_t end) {
+            uint32_t first = static_cast<uint32_t>(primitives.size());
+            for (size_t i = begin; i < end; i++) {
+                primitives.push_back(*static_cast<const T*>(refs[i].object.get()));
+            }
+            return first;
+        }
+
+        /**
+         * Moves a leaf's primitives to the end of a new array, in leaf order.
+         */
+        template <typename T>
+        static void gather(const std::vector<T>& primitives, std::vector<T>& reordered, flat_bvh_node& leaf) {
+            uint32_t first = static_cast<uint32_t>(reordered.size());
+            reordered.insert(reordered.end(), primitives.begin() + leaf.offset,
+                             primitives.begin() + leaf.offset + leaf.count);
+            leaf.offset = first;
+        }
+
+        /**
+         * Intersects a range of one type's array. The qualified call is not
+         * virtual, so the compiler can inline it.
+         */
+        template <typename T>
+        static bool hit_range(const std::vector<T>& primitives, uint32_t first, uint32_t count,
+                              const ray& r, hit_record& rec, Real tmin, Real& closest) {
+            bool found = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i].T::hit(r, rec, tmin, closest)) {
+                    closest = rec.t;
+                    found = true;
+                }
+            }
+            return found;
+        }
+};
+
+
+flat_bvh::flat_bvh(const vector<shared_ptr<hittable>>& objects, bvh_split split, Real max_growth,
+                   bvh_layout layout) {
+    std::vector<flat_bvh_ref> refs;
+    refs.reserve(objects.size());
+    for (const auto& object : objects) {
+        add_object(object, refs);
+    }
+    if (refs.empty()) {
+        bbox_ = aabb(point3(0, 0, 0), point3(0, 0, 0));
+        return;
+    }
+
+    if (split == bvh_split::median) {
+        build(refs, 0, refs.size(), 0);
+    } else {
+        aabb box = refs[0].box;
+        for (const auto& ref : refs) {
+            box = surrounding_box(box, ref.box);
+        }
+        root_area_ = box.surface_area();
+        ref_count_ = refs.size();
+        ref_budget_ = static_cast<size_t>(max_growth * refs.size());
+        build_sah(refs, split == bvh_split::spatial, 0);
+    }
+    lay_out(layout);
+    reorder_primitives();
+    const flat_bvh_node& root = nodes_[0];
+    bbox_ = aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+}
+
+
+size_t flat_bvh::primitive_count(primitive_type type) const {
+    switch (type) {
+        case primitive_type::sphere:
+            return spheres_.size();
+        case primitive_type::moving_sphere:
+            return moving_spheres_.size();
+        case primitive_type::triangle:
+            return triangles_.size();
+        case primitive_type::rectangle:
+            return rectangles_.size();
+        case primitive_type::mesh_triangle:
+            return mesh_triangles_.size();
+        case primitive_type::custom:
+            return customs_.size();
+    }
+    return 0;
+}
+
+
+/**
+ * Takes another tree's nodes and primitives, leaving it an empty tree that
+ * hits nothing.
+ */
+void flat_bvh::take(flat_bvh& other) {
+    take_contents(nodes_, other.nodes_);
+    take_contents(spheres_, other.spheres_);
+    take_contents(moving_spheres_, other.moving_spheres_);
+    take_contents(triangles_, other.triangles_);
+    take_contents(rectangles_, other.rectangles_);
+    take_contents(mesh_triangles_, other.mesh_triangles_);
+    take_contents(customs_, other.customs_);
+    take_contents(meshes_, other.meshes_);
+    bbox_ = other.bbox_;
+    other.bbox_ = aabb(point3(0, 0, 0), point3(0, 0, 0));
+}
+
+
+/**
+ * Adds a reference for an object, sorted by its exact type, or for each
+ * primitive inside it if it is a bvh_node or hittable_list.
+ */
+void flat_bvh::add_object(const shared_ptr<hittable>& object, std::vector<flat_bvh_ref>& refs) {
+    const hittable& o = *object;
+    if (typeid(o) == typeid(bvh_node) || typeid(o) == typeid(hittable_list)) {
+        vector<shared_ptr<hittable>> inner;
+        if (typeid(o) == typeid(bvh_node)) {
+            static_cast<const bvh_node&>(o).collect_primitives(inner);
+        } else {
+            inner = static_cast<const hittable_list&>(o).objects_;
+        }
+        for (const auto& primitive : inner) {
+            add_object(primitive, refs);
+        }
+        return;
+    }
+
+    // An unbounded object's infinite box would wreck the splits; scene keeps
+    // such objects out of the tree
+    assert(o.is_bounded());
+    primitive_type type = primitive_type::custom;
+    if (typeid(o) == typeid(sphere)) {
+        type = primitive_type::sphere;
+    } else if (typeid(o) == typeid(moving_sphere)) {
+        type = primitive_type::moving_sphere;
+    } else if (typeid(o) == typeid(triangle)) {
+        type = primitive_type::triangle;
+    } else if (typeid(o) == typeid(rectangle)) {
+        type = primitive_type::rectangle;
+    } else if (typeid(o) == typeid(mesh_triangle)) {
+        type = primitive_type::mesh_triangle;
+    }
+    refs.push_back(flat_bvh_ref{object->bounding_box(), object, type});
+}
+
+
+/**
+ * Builds the subtree over refs[begin, end), splitting at the median centroid
+ * on the axis where the centroids spread the most. Small ranges that mix
+ * primitive types are split by type, so every leaf has a single type.
+ * @param depth how many interior nodes are above this one
+ * @return the index of the subtree's root node
+ */
+uint32_t flat_bvh::build(std::vector<flat_bvh_ref>& refs, size_t begin, size_t end, int depth) {
+    assert(depth <= max_depth);
+    uint32_t index = static_cast<uint32_t>(built_.size());
+    built_.push_back(flat_bvh_node());
+
+    aabb box = refs[begin].box;
+    point3 centroid_lo = box.centroid(), centroid_hi = box.centroid();
+    bool one_type = true;
+    for (size_t i = begin; i < end; i++) {
+        box = surrounding_box(box, refs[i].box);
+        centroid_lo = vec_min(centroid_lo, refs[i].box.centroid());
+        centroid_hi = vec_max(centroid_hi, refs[i].box.centroid());
+        one_type = one_type && refs[i].type == refs[begin].type;
+    }
+    flat_bvh_node node;
+    for (int a = 0; a < 3; a++) {
+        node.min[a] = box.min()[a];
+        node.max[a] = box.max()[a];
+    }
+    node.axis = 0;
+    node.type = primitive_type::custom;
+
+    size_t count = end - begin;
+    size_t mid;
+    if (count <= static_cast<size_t>(max_leaf_size) && one_type) {
+        make_leaf(node, refs, begin, end);
+        built_[index] = node;
+        return index;
+    } else if (count <= static_cast<size_t>(max_leaf_size)) {
+        primitive_type first = refs[begin].type;
+        mid = std::stable_partition(refs.begin() + begin, refs.begin() + end,
+                                    [first](const flat_bvh_ref& ref) { return ref.type == first; })
+            - refs.begin();
+    } else {
+        vec3 spread = centroid_hi - centroid_lo;
+        int axis = 0;
+        if (spread.y() > spread[axis]) {
+            axis = 1;
+        }
+        if (spread.z() > spread[axis]) {
+            axis = 2;
+        }
+        node.axis = static_cast<uint8_t>(axis);
+        mid = begin + count / 2;
+        std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                         [axis](const flat_bvh_ref& a, const flat_bvh_ref& b) {
+                             return a.box.centroid()[axis] < b.box.centroid()[axis];
+                         });
+    }
+
+    build(refs, begin, mid, depth + 1);
+    node.offset = build(refs, mid, end, depth + 1);
+    node.count = 0;
+    built_[index] = node;
+    return index;
+}
+
+
+/**
+ * Builds the subtree over refs by the surface area heuristic, trying binned
+ * object splits and, if allowed, spatial splits. Consumes refs.
+ * @param spatial whether spatial splits may be tried
+ * @param depth how many interior nodes are above this one
+ * @return the index of the subtree's root node
+ */
+uint32_t flat_bvh::build_sah(std::vector<flat_bvh_ref>& refs, bool spatial, int depth) {
+    assert(depth <= max_depth);
+    uint32_t index = static_cast<uint32_t>(built_.size());
+    built_.push_back(flat_bvh_node());
+
+    aabb box = refs[0].box;
+    aabb centroids(refs[0].box.centroid(), refs[0].box.centroid());
+    bool one_type = true;
+    for (const auto& ref : refs) {
+        box = surrounding_box(box, ref.box);
+        centroids = surrounding_box(centroids, aabb(ref.box.centroid(), ref.box.centroid()));
+        one_type = one_type && ref.type == refs[0].type;
+    }
+    flat_bvh_node node;
+    for (int a = 0; a < 3; a++) {
+        node.min[a] = box.min()[a];
+        node.max[a] = box.max()[a];
+    }
+    node.axis = 0;
+    node.type = primitive_type::custom;
+    node.count = 0;
+
+    size_t count = refs.size();
+    if (count <= static_cast<size_t>(max_leaf_size) && one_type) {
+        make_leaf(node, refs, 0, count);
+        built_[index] = node;
+        return index;
+    }
+
+    std::vector<flat_bvh_ref> left, right;
+    if (count <= static_cast<size_t>(max_leaf_size)) {
+        // Few enough for a leaf, but of mixed types
+        primitive_type first = refs[0].type;
+        for (auto& ref : refs) {
+            (ref.type == first ? left : right).push_back(std::move(ref));
+        }
+    } else {
+        split_choice best = depth < max_sah_depth ? best_object_split(refs, centroids) : split_choice();
+
+        // Spatial splits only pay off where the object split's children overlap
+        if (spatial && depth < max_sah_depth && ref_count_ < ref_budget_) {
+            aabb overlap(vec_max(best.left.min(), best.right.min()), vec_min(best.left.max(), best.right.max()));
+            vec3 extent = overlap.max() - overlap.min();
+            bool overlapping = best.cost == real_infinity
+                            || (extent.x() > 0 && extent.y() > 0 && extent.z() > 0
+                                && overlap.surface_area() > Real(1e-5) * root_area_);
+            if (overlapping) {
+                split_choice spatial_best = best_spatial_split(refs, box);
+                if (spatial_best.cost < best.cost) {
+                    best = spatial_best;
+                }
+            }
+        }
+
+        if (best.cost == real_infinity) {
+            // Too deep for the SAH, or no useful split (e.g. all centroids in
+            // one place): split at the median centroid on the widest axis
+            vec3 spread = centroids.max() - centroids.min();
+            best.axis = spread.y() > spread.x() ? 1 : 0;
+            if (spread.z() > spread[best.axis]) {
+                best.axis = 2;
+            }
+            int axis = best.axis;
+            size_t half = count / 2;
+            std::nth_element(refs.begin(), refs.begin() + half, refs.end(),
+                             [axis](const flat_bvh_ref& a, const flat_bvh_ref& b) {
+                                 return a.box.centroid()[axis] < b.box.centroid()[axis];
+                             });
+            for (size_t i = 0; i < count; i++) {
+                (i < half ? left : right).push_back(std::move(refs[i]));
+            }
+        } else if (best.spatial) {
+            for (auto& ref : refs) {
+                if (ref.box.max()[best.axis] <= best.position) {
+                    left.push_back(std::move(ref));
+                } else if (ref.box.min()[best.axis] >= best.position) {
+                    right.push_back(std::move(ref));
+                } else {
+                    // The reference crosses the plane: clip it into both sides
+                    flat_bvh_ref part = ref;
+                    bool in_left = clip_ref(ref, best.axis, -real_infinity, best.position, part.box);
+                    if (in_left) {
+                        left.push_back(part);
+                    }
+                    bool in_right = clip_ref(ref, best.axis, best.position, real_infinity, part.box);
+                    if (in_right) {
+                        right.push_back(part);
+                        ref_count_ += in_left;
+                    }
+                    // Rounding can leave a sliver of a polygon on neither side;
+                    // keep it whole on the side of its centroid
+                    if (!in_left && !in_right) {
+                        (ref.box.centroid()[best.axis] < best.position ? left : right).push_back(std::move(ref));
+                    }
+                }
+            }
+        } else {
+            for (auto& ref : refs) {
+                (ref.box.centroid()[best.axis] < best.position ? left : right).push_back(std::move(ref));
+            }
+        }
+
+        // A split that leaves one side empty would recurse forever
+        if (left.empty() || right.empty()) {
+            std::vector<flat_bvh_ref>& all = left.empty() ? right : left;
+            size_t half = all.size() / 2;
+            std::vector<flat_bvh_ref>& other = left.empty() ? left : right;
+            other.assign(std::make_move_iterator(all.begin() + half), std::make_move_iterator(all.end()));
+            all.resize(half);
+        }
+        node.axis = static_cast<uint8_t>(best.axis);
+    }
+
+    refs.clear();
+    refs.shrink_to_fit();
+    build_sah(left, spatial, depth + 1);
+    node.offset = build_sah(right, spatial, depth + 1);
+    built_[index] = node;
+    return index;
+}
+
+
+/**
+ * Finds the cheapest object split, binning the references by centroid.
+ */
+flat_bvh::split_choice flat_bvh::best_object_split(const std::vector<flat_bvh_ref>& refs,
+                                                   const aabb& centroids) const {
+    split_choice best;
+    for (int axis = 0; axis < 3; axis++) {
+        Real lo = centroids.min()[axis];
+        Real extent = centroids.max()[axis] - lo;
+        if (extent <= 0) {
+            continue;
+        }
+
+        aabb bin_box[split_bins];
+        size_t bin_count[split_bins] = {0};
+        Real scale = split_bins / extent;
+        for (const auto& ref : refs) {
+            int b = std::min(split_bins - 1, static_cast<int>((ref.box.centroid()[axis] - lo) * scale));
+            bin_box[b] = bin_count[b] ? surrounding_box(bin_box[b], ref.box) : ref.box;
+            bin_count[b]++;
+        }
+
+        // Sweep from the right to get each suffix's box, then from the left
+        aabb right_box[split_bins];
+        size_t right_count[split_bins];
+        size_t running = 0;
+        aabb accumulated;
+        for (int b = split_bins - 1; b > 0; b--) {
+            if (bin_count[b]) {
+                accumulated = running ? surrounding_box(accumulated, bin_box[b]) : bin_box[b];
+                running += bin_count[b];
+            }
+            right_box[b] = accumulated;
+            right_count[b] = running;
+        }
+
+        aabb left_box;
+        size_t left_count = 0;
+        for (int b = 0; b < split_bins - 1; b++) {
+            if (bin_count[b]) {
+                left_box = left_count ? surrounding_box(left_box, bin_box[b]) : bin_box[b];
+                left_count += bin_count[b];
+            }
+            if (left_count == 0 || right_count[b + 1] == 0) {
+                continue;
+            }
+            Real cost = left_box.surface_area() * left_count + right_box[b + 1].surface_area() * right_count[b + 1];
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = lo + (b + 1) / scale;
+                best.spatial = false;
+                best.left = left_box;
+                best.right = right_box[b + 1];
+            }
+        }
+    }
+    return best;
+}
+
+
+/**
+ * Finds the cheapest spatial split, cutting the node's box into equal slabs
+ * and clipping every reference to each slab it crosses. Splits that would
+ * copy more references than the budget has left are not considered.
+ */
+flat_bvh::split_choice flat_bvh::best_spatial_split(const std::vector<flat_bvh_ref>& refs,
+                                                    const aabb& box) const {
+    split_choice best;
+    for (int axis = 0; axis < 3; axis++) {
+        Real lo = box.min()[axis];
+        Real extent = box.max()[axis] - lo;
+        if (extent <= 0) {
+            continue;
+        }
+
+        aabb bin_box[split_bins];
+        bool bin_used[split_bins] = {false};
+        size_t entries[split_bins] = {0};
+        size_t exits[split_bins] = {0};
+        Real width = extent / split_bins;
+        for (const auto& ref : refs) {
+            int first = std::max(0, std::min(split_bins - 1, static_cast<int>((ref.box.min()[axis] - lo) / width)));
+            int last = std::max(first, std::min(split_bins - 1, static_cast<int>((ref.box.max()[axis] - lo) / width)));
+            entries[first]++;
+            exits[last]++;
+            for (int b = first; b <= last; b++) {
+                aabb clipped;
+                if (clip_ref(ref, axis, lo + b * width, lo + (b + 1) * width, clipped)) {
+                    bin_box[b] = bin_used[b] ? surrounding_box(bin_box[b], clipped) : clipped;
+                    bin_used[b] = true;
+                }
+            }
+        }
+
+        aabb right_box[split_bins];
+        bool right_used[split_bins];
+        size_t right_count[split_bins];
+        size_t running = 0;
+        bool used = false;
+        aabb accumulated;
+        for (int b = split_bins - 1; b > 0; b--) {
+            if (bin_used[b]) {
+                accumulated = used ? surrounding_box(accumulated, bin_box[b]) : bin_box[b];
+                used = true;
+            }
+            running += exits[b];
+            right_box[b] = accumulated;
+            right_used[b] = used;
+            right_count[b] = running;
+        }
+
+        aabb left_box;
+        bool left_used = false;
+        size_t left_count = 0;
+        for (int b = 0; b < split_bins - 1; b++) {
+            if (bin_used[b]) {
+                left_box = left_used ? surrounding_box(left_box, bin_box[b]) : bin_box[b];
+                left_used = true;
+            }
+            left_count += entries[b];
+            if (!left_used || !right_used[b + 1] || left_count == 0 || right_count[b + 1] == 0) {
+                continue;
+            }
+            // References that cross the plane go to both sides
+            size_t duplicates = left_count + right_count[b + 1] - refs.size();
+            if (ref_count_ + duplicates > ref_budget_) {
+                continue;
+            }
+            Real cost = left_box.surface_area() * left_count + right_box[b + 1].surface_area() * right_count[b + 1];
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = lo + (b + 1) * width;
+                best.spatial = true;
+                best.left = left_box;
+                best.right = right_box[b + 1];
+            }
+        }
+    }
+    return best;
+}
+
+
+/**
+ * Gets the box around the part of a reference between two planes on an axis.
+ * Triangles and rectangles are clipped exactly; other primitives just have
+ * their box cut.
+ * @param clipped set to the box of the part inside
+ * @return false if no part of the reference is inside
+ */
+bool flat_bvh::clip_ref(const flat_bvh_ref& ref, int axis, Real lo, Real hi, aabb& clipped) {
+    point3 corners[4];
+    int n = 0;
+    if (ref.type == primitive_type::triangle) {
+        const triangle& t = *static_cast<const triangle*>(ref.object.get());
+        corners[0] = t.a;
+        corners[1] = t.b;
+        corners[2] = t.c;
+        n = 3;
+    } else if (ref.type == primitive_type::rectangle) {
+        const rectangle& q = *static_cast<const rectangle*>(ref.object.get());
+        corners[0] = q.Q;
+        corners[1] = q.Q + q.u;
+        corners[2] = q.Q + q.u + q.v;
+        corners[3] = q.Q + q.v;
+        n = 4;
+    } else if (ref.type == primitive_type::mesh_triangle) {
+        static_cast<const mesh_triangle*>(ref.object.get())->vertices(corners[0], corners[1], corners[2]);
+        n = 3;
+    }
+
+    point3 box_lo = ref.box.min(), box_hi = ref.box.max();
+    box_lo[axis] = std::max(box_lo[axis], lo);
+    box_hi[axis] = std::min(box_hi[axis], hi);
+    if (box_lo[axis] > box_hi[axis]) {
+        return false;
+    }
+    if (n == 0) {
+        clipped = aabb(box_lo, box_hi);
+        return true;
+    }
+
+    // Bound the polygon's vertices inside the slab and the points where its
+    // edges cross the slab's planes
+    point3 poly_lo(real_infinity, real_infinity, real_infinity), poly_hi = -poly_lo;
+    bool any = false;
+    for (int i = 0; i < n; i++) {
+        const point3& p = corners[i];
+        const point3& q = corners[(i + 1) % n];
+        if (p[axis] >= lo && p[axis] <= hi) {
+            poly_lo = vec_min(poly_lo, p);
+            poly_hi = vec_max(poly_hi, p);
+            any = true;
+        }
+        Real planes[2] = {lo, hi};
+        for (Real plane : planes) {
+            if ((p[axis] < plane && q[axis] > plane) || (p[axis] > plane && q[axis] < plane)) {
+                point3 crossing = p + ((plane - p[axis]) / (q[axis] - p[axis])) * (q - p);
+                crossing[axis] = plane;
+                poly_lo = vec_min(poly_lo, crossing);
+                poly_hi = vec_max(poly_hi, crossing);
+                any = true;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+
+    // Stay inside the reference's box, which may already be clipped
+    poly_lo = vec_max(poly_lo, box_lo);
+    poly_hi = vec_min(poly_hi, box_hi);
+    for (int a = 0; a < 3; a++) {
+        if (poly_lo[a] > poly_hi[a]) {
+            return false;
+        }
+    }
+    clipped = aabb(poly_lo, poly_hi);
+    return true;
+}
+
+
+Real flat_bvh::sah_cost() const {
+    return nodes_.empty() ? 0 : subtree_cost(0);
+}
+
+
+/**
+ * Gets the SAH cost of a subtree: a traversal step, then each child's cost
+ * weighted by the ratio of its box's area to this node's.
+ */
+Real flat_bvh::subtree_cost(uint32_t index) const {
+    const flat_bvh_node& node = nodes_[index];
+    if (node.count) {
+        return bvh_intersection_cost * node.count;
+    }
+    auto area = [this](uint32_t i) {
+        const flat_bvh_node& n = nodes_[i];
+        Real dx = n.max[0] - n.min[0], dy = n.max[1] - n.min[1], dz = n.max[2] - n.min[2];
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    };
+    Real parent = area(index);
+    uint32_t first = node.offset, second = node.offset + 1;
+    if (parent <= 0) {
+        return bvh_traversal_cost + subtree_cost(first) + subtree_cost(second);
+    }
+    return bvh_traversal_cost + (area(first) * subtree_cost(first) + area(second) * subtree_cost(second)) / parent;
+}
+
+
+/**
+ * Copies the built tree into its final order, with the children of every
+ * interior node next to each other at an even index. The root goes first,
+ * with an unused node after it so that every pair starts a cache line; a
+ * root that is a leaf is copied as it is.
+ *
+ * A treelet layout places the pairs below a subtree's root breadth-first
+ * until it has placed treelet_pairs of them, then lays out the subtrees left
+ * hanging below it the same way, one after another. A depth-first layout is
+ * the same with one pair per treelet.
+ */
+void flat_bvh::lay_out(bvh_layout layout) {
+    std::vector<flat_bvh_node> laid;
+    if (!built_.empty()) {
+        laid.reserve(built_.size() + 1);
+        laid.push_back(built_[0]);
+
+        const size_t budget = layout == bvh_layout::treelet ? treelet_pairs : 1;
+        // Nodes whose children are still to be placed: (built index, laid index)
+        std::vector<std::pair<uint32_t, uint32_t>> treelet_roots;
+        if (!built_[0].count) {
+            // A leaf root is the whole tree; an interior one gets its padding
+            laid.push_back(built_[0]);
+            treelet_roots.push_back(std::make_pair(0u, 0u));
+        }
+        std::vector<std::pair<uint32_t, uint32_t>> frontier, hanging;
+        while (!treelet_roots.empty()) {
+            frontier.assign(1, treelet_roots.back());
+            treelet_roots.pop_back();
+            hanging.clear();
+
+            size_t pairs = 0;
+            for (size_t i = 0; i < frontier.size(); i++) {
+                uint32_t built = frontier[i].first, placed = frontier[i].second;
+                if (pairs == budget) {
+                    hanging.push_back(frontier[i]);
+                    continue;
+                }
+                uint32_t children[2] = {built + 1, built_[built].offset};
+                uint32_t first = static_cast<uint32_t>(laid.size());
+                laid[placed].offset = first;
+                for (int c = 0; c < 2; c++) {
+                    laid.push_back(built_[children[c]]);
+                    if (!built_[children[c]].count) {
+                        frontier.push_back(std::make_pair(children[c], first + c));
+                    }
+                }
+                pairs++;
+            }
+
+            // Lay out the first hanging subtree next, so subtrees follow their parents
+            treelet_roots.insert(treelet_roots.end(), hanging.rbegin(), hanging.rend());
+        }
+    }
+    std::vector<flat_bvh_node>().swap(built_);
+    nodes_.assign(laid.begin(), laid.end());
+}
+
+
+/**
+ * Permutes the primitive arrays into the order a depth-first walk of the tree
+ * reaches their leaves, so the primitives of nearby leaves share cache lines
+ * and pages whichever layout the nodes have.
+ */
+void flat_bvh::reorder_primitives() {
+    std::vector<sphere> spheres;
+    std::vector<moving_sphere> moving_spheres;
+    std::vector<triangle> triangles;
+    std::vector<rectangle> rectangles;
+    std::vector<mesh_triangle> mesh_triangles;
+    std::vector<shared_ptr<hittable>> customs;
+    spheres.reserve(spheres_.size());
+    moving_spheres.reserve(moving_spheres_.size());
+    triangles.reserve(triangles_.size());
+    rectangles.reserve(rectangles_.size());
+    mesh_triangles.reserve(mesh_triangles_.size());
+    customs.reserve(customs_.size());
+
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        flat_bvh_node& node = nodes_[stack.back()];
+        stack.pop_back();
+        if (!node.count) {
+            stack.push_back(node.offset + 1);
+            stack.push_back(node.offset);
+            continue;
+        }
+        switch (node.type) {
+            case primitive_type::sphere:
+                gather(spheres_, spheres, node);
+                break;
+            case primitive_type::moving_sphere:
+                gather(moving_spheres_, moving_spheres, node);
+                break;
+            case primitive_type::triangle:
+                gather(triangles_, triangles, node);
+                break;
+            case primitive_type::rectangle:
+                gather(rectangles_, rectangles, node);
+                break;
+            case primitive_type::mesh_triangle:
+                gather(mesh_triangles_, mesh_triangles, node);
+                break;
+            case primitive_type::custom:
+                gather(customs_, customs, node);
+                break;
+        }
+    }
+    spheres_.swap(spheres);
+    moving_spheres_.swap(moving_spheres);
+    triangles_.swap(triangles);
+    rectangles_.swap(rectangles);
+    mesh_triangles_.swap(mesh_triangles);
+    customs_.swap(customs);
+}
+
+
+/**
+ * Makes a node a leaf holding refs[begin, end), which all have one type.
+ */
+void flat_bvh::make_leaf(flat_bvh_node& node, const std::vector<flat_bvh_ref>& refs, size_t begin, size_t end) {
+    node.type = refs[begin].type;
+    node.count = static_cast<uint16_t>(end - begin);
+    switch (node.type) {
+        case primitive_type::sphere:
+            node.offset = append(spheres_, refs, begin, end);
+            break;
+        case primitive_type::moving_sphere:
+            node.offset = append(moving_spheres_, refs, begin, end);
+            break;
+        case primitive_type::triangle:
+            node.offset = append(triangles_, refs, begin, end);
+            break;
+        case primitive_type::rectangle:
+            node.offset = append(rectangles_, refs, begin, end);
+            break;
+        case primitive_type::mesh_triangle:
+            node.offset = append(mesh_triangles_, refs, begin, end);
+            for (size_t i = begin; i < end; i++) {
+                keep_mesh(static_cast<const mesh_triangle*>(refs[i].object.get())->mesh());
+            }
+            break;
+        case primitive_type::custom:
+            node.offset = static_cast<uint32_t>(customs_.size());
+            for (size_t i = begin; i < end; i++) {
+                customs_.push_back(refs[i].object);
+            }
+            break;
+    }
+}
+
+
+/**
+ * Shares ownership of a mesh the tree's mesh_triangles point into, unless the
+ * tree already does.
+ */
+void flat_bvh::keep_mesh(const compressed_mesh* mesh) {
+    if (!meshes_.empty() && meshes_.back().get() == mesh) {
+        return;
+    }
+    for (const auto& kept : meshes_) {
+        if (kept.get() == mesh) {
+            return;
+        }
+    }
+    meshes_.push_back(mesh->shared_from_this());
+}
+
+
+bool flat_bvh::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    size_t visits = 0;
+    return traverse<false>(r, rec, tmin, tmax, visits);
+}
+
+
+/**
+ * Hints the CPU to start loading memory that will be read soon.
+ */
+inline void prefetch(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#endif
+}
+
+
+/**
+ * Finds the closest hit. Both children of a node are tested together, as
+ * they share a cache line; if both are hit, the one nearer the ray is visited
+ * first, so closest shrinks sooner, and the other is deferred with its entry
+ * distance while its children are prefetched.
+ * @param visits counts the nodes whose boxes were tested, if count_visits is set
+ */
+template <bool count_visits>
+bool flat_bvh::traverse(const ray& r, hit_record& rec, Real tmin, Real tmax, size_t& visits) const {
+    Real entry;
+    if (count_visits) {
+        visits++;
+    }
+    if (nodes_.empty() || !hit_slabs(nodes_[0].min, nodes_[0].max, r, tmin, tmax, entry)) {
+        return false;
+    }
+
+    // At most one node is deferred per level
+    struct deferred {
+        uint32_t index;
+        Real entry;
+    } stack[max_depth];
+    int top = 0;
+    uint32_t current = 0;
+    Real closest = tmax;
+    bool hit_anything = false;
+
+    while (true) {
+        const flat_bvh_node& node = nodes_[current];
+        if (node.count) {
+            hit_anything |= hit_leaf(node, r, rec, tmin, closest);
+        } else {
+            uint32_t first = node.offset, second = node.offset + 1;
+            if (r.sign[node.axis]) {
+                std::swap(first, second);
+            }
+            Real first_entry, second_entry;
+            bool hit_first = hit_slabs(nodes_[first].min, nodes_[first].max, r, tmin, closest, first_entry);
+            bool hit_second = hit_slabs(nodes_[second].min, nodes_[second].max, r, tmin, closest, second_entry);
+            if (count_visits) {
+                visits += 2;
+            }
+            if (hit_first && hit_second) {
+                const flat_bvh_node& later = nodes_[second];
+                if (!later.count) {
+                    prefetch(&nodes_[later.offset]);
+                }
+                stack[top++] = deferred{second, second_entry};
+                current = first;
+                continue;
+            } else if (hit_first || hit_second) {
+                current = hit_first ? first : second;
+                continue;
+            }
+        }
+
+        // Skip deferred nodes that a hit found since has put out of reach
+        while (top > 0 && stack[top - 1].entry > closest) {
+            top--;
+        }
+        if (top == 0) {
+            break;
+        }
+        current = stack[--top].index;
+    }
+    return hit_anything;
+}
+
+
+/**
+ * Intersects a leaf's primitives, dispatching once on the leaf's type.
+ * @param closest the nearest hit so far, updated if one of these is nearer
+ */
+bool flat_bvh::hit_leaf(const flat_bvh_node& node, const ray& r, hit_record& rec, Real tmin, Real& closest) const {
+    switch (node.type) {
+        case primitive_type::sphere:
+            return hit_range(spheres_, node.offset, node.count, r, rec, tmin, closest);
+        case primitive_type::moving_sphere:
+            return hit_range(moving_spheres_, node.offset, node.count, r, rec, tmin, closest);
+        case primitive_type::triangle:
+            return hit_range(triangles_, node.offset, node.count, r, rec, tmin, closest);
+        case primitive_type::rectangle:
+            return hit_range(rectangles_, node.offset, node.count, r, rec, tmin, closest);
+        case primitive_type::mesh_triangle:
+            return hit_range(mesh_triangles_, node.offset, node.count, r, rec, tmin, closest);
+        case primitive_type::custom: {
+            bool found = false;
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (customs_[i]->hit(r, rec, tmin, closest)) {
+                    closest = rec.t;
+                    found = true;
+                }
+            }
+            return found;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <memory>
 #include <stdlib.h>
 #include <vector>
@@ -15,15 +18,33 @@ using std::make_shared;
 class material;
 
 
+class hittable;
+
+
 /**
  * Structure for storing data about ray-object intersections.
+ * Intersection tests only fill in t, object and the barycentrics (b1, b2).
+ * The surface details (point, normal, tangent, uv and material) are filled in
+ * by hittable::finalize_interaction once the closest hit is known.
  */
 struct hit_record {
     point3 point;
     vec3 normal;
-    double t;
-    double u, v;
-    // color kD;
+    vec3 tangent;
+    Real t;
+    Real u, v;
+    Real b1, b2;
+    // world-space length covered by one unit of uv, 0 if the uv has no meaningful scale
+    Real uv_extent = 0;
+    // ray cone width at the hit in world units, and in uv units for texture filtering
+    Real cone_width = 0;
+    Real footprint = 0;
+    const hittable* object = nullptr;
+    // the primitive hit inside an instance, in which case object is the instance
+    const hittable* instanced = nullptr;
+    // which primitive of the object was hit, for objects holding many (such as
+    // sphere_set); after finalize_interaction, its index in the object's input
+    uint32_t prim_index = 0;
     shared_ptr<material> mat;
 
     /**
@@ -35,6 +56,22 @@ struct hit_record {
         bool front = dot(r.direction(), n) < 0;
         normal = front ? n : -n;
     }
+
+    /**
+     * Computes the ray cone width at the hit and projects it into uv space.
+     * Needs the normal and uv_extent, so call it after finalize_interaction.
+     * @param r the ray that hit the object
+     **/
+    inline void set_footprint(const ray& r) {
+        cone_width = r.cone_width_at(t);
+        if (uv_extent <= 0) {
+            footprint = 0;
+            return;
+        }
+        // grazing hits stretch the footprint, capped so it doesn't blow up at the silhouette
+        Real cos_theta = std::fabs(dot(unit_vector(r.direction()), normal));
+        footprint = cone_width / (uv_extent * std::max(cos_theta, Real(0.1)));
+    }
 };
 
 
@@ -51,7 +88,15 @@ class hittable {
          * @param rec if the ray intersects, this stores information about how it hit
          * @return true or false depending on if it intersects
          **/
-        virtual bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const = 0;
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const = 0;
+
+        /**
+         * Computes the surface details (point, normal, tangent, uv, material) for a hit on this object.
+         * Only called once per ray, for the closest hit found by hit().
+         * @param r the ray that hit the object
+         * @param rec the hit record filled in by hit(), completed in place
+         **/
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const = 0;
         
         /**
          * Calculates the outward surface normal at the given point on the object
@@ -66,10 +111,44 @@ class hittable {
          **/
         virtual aabb bounding_box() const = 0;
 
+        /**
+         * Gets boxes around the object at the start and end of a time interval,
+         * such that interpolating between them bounds the object at any time in
+         * between. Objects that don't move return their bounding box twice.
+         * @param time0 start of the interval (shutter open)
+         * @param time1 end of the interval (shutter close)
+         * @return whether the object moves, i.e. whether the boxes may differ
+         **/
+        virtual bool motion_bounds(Real time0, Real time1, aabb& box0, aabb& box1) const {
+            box0 = box1 = bounding_box();
+            return false;
+        }
+
+        /**
+         * Unbounded objects (such as planes) have no meaningful bounding box,
+         * so they must not be put in a bvh_node; a scene keeps them in a
+         * separate list instead.
+         * @return whether the object fits in its bounding box
+         **/
+        virtual bool is_bounded() const {
+            return true;
+        }
+
         /**
          * @return a string saying the type of object it is
          */
         virtual std::string type() const = 0;
 };
 
+/**
+ * Completes a hit record for the closest hit: surface details from the object
+ * that was hit, then the ray cone footprint used for texture filtering.
+ * @param r the ray that hit the object
+ * @param rec the hit record filled in by hittable::hit
+ **/
+inline void finalize_hit(const ray& r, hit_record& rec) {
+    rec.object->finalize_interaction(r, rec);
+    rec.set_footprint(r);
+}
+
 #endif
\ No newline at end of file
@@ -44,7 +44,7 @@ public:
 	 */
     virtual bool hit(const ray& ray,
 					 hit_record& record,
-                     double tmin, double tmax) const override
+                     Real tmin, Real tmax) const override
 	{
 		hit_record temp_record;
 		bool hit_anything = false;
@@ -62,6 +62,16 @@ public:
 		return hit_anything;
 	}
 
+	/**
+	 * Hits are recorded against the object that was hit, so this just forwards
+	 * to it.
+	 */
+	virtual void finalize_interaction(const ray& ray,
+									  hit_record& record) const override
+	{
+		record.object->finalize_interaction(ray, record);
+	}
+
 	/**
 	 * This function should not be a virtual function in the hittable class,
 	 * but it is, so we have to implement it.
@@ -101,6 +111,19 @@ public:
 		return output_box;
 	}
 
+	/**
+	 * A list is only bounded if everything in it is.
+	 * @return Whether every object in the list is bounded.
+	 */
+	virtual bool is_bounded() const override {
+		for (const auto& object : this->objects_) {
+			if (!object->is_bounded()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
 	/**
 	 * @return The string "hittable_list".
 	 */
@@ -0,0 +1,129 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <memory>
+#include <string>
+
+#include "aabb.h"
+#include "ray.h"
+#include "transform.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+
+/**
+ * Maps a world-space ray into an instance's object space. The direction is
+ * not renormalized, so ray parameters t are the same in both spaces.
+ */
+inline ray object_space_ray(const ray& r, const affine_transform& to_object) {
+    ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    local.set_cone(r.cone_width, r.cone_spread);
+    return local;
+}
+
+
+/**
+ * Finalizes a hit on an instanced object in object space, then maps the
+ * surface details back into world space.
+ * @param scale how much the transform scales lengths, for the uv footprint
+ * @param mat if set, replaces the object's material
+ */
+inline void finalize_instanced_hit(const ray& r, hit_record& rec, const affine_transform& to_world,
+                                   const affine_transform& to_object, Real scale,
+                                   const shared_ptr<material>& mat) {
+    rec.object = rec.instanced;
+    rec.object->finalize_interaction(object_space_ray(r, to_object), rec);
+
+    // affine maps keep the sign of dot(direction, normal), so the normal still faces the ray
+    rec.point = r.at(rec.t);
+    rec.normal = unit_vector(to_world.apply_normal(rec.normal));
+    rec.tangent = unit_vector(to_world.apply_vector(rec.tangent));
+    rec.uv_extent *= scale;
+    if (mat) {
+        rec.mat = mat;
+    }
+}
+
+
+/**
+ * A placed copy of a shared object, usually the bvh_node of a mesh.
+ *
+ * Rays are mapped into the object's space instead of moving the geometry, so
+ * any number of instances share one bottom-level BVH and memory grows with the
+ * unique geometry, not with the instance count. Put instances in a bvh_node to
+ * get the top level of a two-level acceleration structure.
+ *
+ * The shared object must not itself contain instances: a hit record only
+ * remembers one level of instancing.
+ */
+class instance : public hittable {
+    public:
+        /**
+         * @param object the shared geometry, in its own object space
+         * @param object_to_world where to place this copy
+         * @param override_mat if set, used instead of the object's own material
+         */
+        instance(shared_ptr<hittable> object, const affine_transform& object_to_world,
+                 shared_ptr<material> override_mat = nullptr)
+        : object_(object), to_world_(object_to_world), to_object_(object_to_world.inverse()),
+          scale_(object_to_world.scale_factor()), mat_(override_mat) {
+            bbox_ = to_world_.apply_box(object_->bounding_box());
+        }
+
+        virtual std::string type() const override {
+            return "instance";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
+        virtual vec3 surface_normal(const point3 position) const override;
+
+        virtual aabb bounding_box() const override {
+            return bbox_;
+        }
+
+        /**
+         * Moves this copy, e.g. between frames of an animation. A BVH holding
+         * it must be refit before the next render (see bvh_node::refit).
+         */
+        void set_transform(const affine_transform& object_to_world) {
+            to_world_ = object_to_world;
+            to_object_ = object_to_world.inverse();
+            scale_ = object_to_world.scale_factor();
+            bbox_ = to_world_.apply_box(object_->bounding_box());
+        }
+
+        shared_ptr<hittable> object() const {
+            return object_;
+        }
+
+    private:
+        shared_ptr<hittable> object_;
+        affine_transform to_world_;
+        affine_transform to_object_;
+        Real scale_;
+        shared_ptr<material> mat_;
+        aabb bbox_;
+};
+
+
+bool instance::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    if (!object_->hit(object_space_ray(r, to_object_), rec, tmin, tmax)) {
+        return false;
+    }
+    rec.instanced = rec.object;
+    rec.object = this;
+    return true;
+}
+
+
+void instance::finalize_interaction(const ray& r, hit_record& rec) const {
+    finalize_instanced_hit(r, rec, to_world_, to_object_, scale_, mat_);
+}
+
+
+vec3 instance::surface_normal(const point3 position) const {
+    point3 local = to_object_.apply_point(position);
+    return unit_vector(to_world_.apply_normal(object_->surface_normal(local)));
+}
+
+#endif
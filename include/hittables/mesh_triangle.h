@@ -0,0 +1,366 @@
+#ifndef MESH_TRIANGLE_H
+#define MESH_TRIANGLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "material.h"
+#include "packing.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+
+/**
+ * A triangle mesh's vertices and faces, compressed:
+ *  - positions as 16 bits per coordinate relative to the mesh's bounds (the
+ *    error is at most 1/131070 of the mesh's extent on each axis),
+ *  - normals octahedral-encoded in 32 bits,
+ *  - uvs as pairs of half floats,
+ *  - faces as three 32-bit vertex indices.
+ * That is 14 bytes per vertex and 12 per face, against 48 per vertex and a
+ * 192-byte triangle per face uncompressed. Shared vertices decode to the same
+ * point, so a closed mesh stays watertight.
+ *
+ * Faces are traced as mesh_triangles, which decode what they need on demand.
+ * They point at the mesh without owning it, so a mesh must be owned by a
+ * shared_ptr for as long as its faces are traced; mesh_faces() and flat_bvh
+ * take care of that.
+ */
+class compressed_mesh : public std::enable_shared_from_this<compressed_mesh> {
+    public:
+        /**
+         * Compresses a mesh.
+         * @param positions one per vertex
+         * @param normals one per vertex, or none for flat shading
+         * @param uvs one per vertex, or none to use each face's barycentrics
+         * @param indices three per face
+         */
+        compressed_mesh(const std::vector<point3>& positions, const std::vector<vec3>& normals,
+                        const std::vector<std::pair<Real, Real>>& uvs, const std::vector<uint32_t>& indices,
+                        shared_ptr<material> mat);
+
+        /**
+         * Constructs an empty mesh, to add vertices and faces to one at a
+         * time, e.g. while reading a file.
+         * @param bounds a box around every vertex that will be added, which
+         * sets the quantization
+         */
+        compressed_mesh(const aabb& bounds, shared_ptr<material> mat) : mat_(mat) {
+            set_bounds(bounds.min(), bounds.max());
+        }
+
+        /**
+         * Quantizes and adds a vertex. Vertices outside the bounds are clamped
+         * to them.
+         */
+        void add_vertex(const point3& p) {
+            for (int a = 0; a < 3; a++) {
+                Real q = scale_[a] > 0 ? std::round((p[a] - origin_[a]) / scale_[a]) : 0;
+                positions_.push_back(static_cast<uint16_t>(std::max(Real(0), std::min(Real(65535), q))));
+            }
+        }
+
+        /**
+         * Adds the normal of the next vertex. Either every vertex gets one, in
+         * order, or none does. A zero normal, of a vertex only zero-area faces
+         * touch, is stored as +y.
+         */
+        void add_normal(const vec3& n) {
+            normals_.push_back(encode_octahedral(n.length_squared() > 0 ? unit_vector(n) : vec3(0, 1, 0)));
+        }
+
+        /**
+         * Adds the uv of the next vertex. Either every vertex gets one, in
+         * order, or none does.
+         */
+        void add_uv(Real u, Real v) {
+            uvs_.push_back(float_to_half(static_cast<float>(u)));
+            uvs_.push_back(float_to_half(static_cast<float>(v)));
+        }
+
+        void add_face(uint32_t a, uint32_t b, uint32_t c) {
+            indices_.push_back(a);
+            indices_.push_back(b);
+            indices_.push_back(c);
+        }
+
+        size_t vertex_count() const {
+            return positions_.size() / 3;
+        }
+
+        size_t face_count() const {
+            return indices_.size() / 3;
+        }
+
+        bool has_normals() const {
+            return !normals_.empty();
+        }
+
+        bool has_uvs() const {
+            return !uvs_.empty();
+        }
+
+        /**
+         * @return the three vertex indices of a face
+         */
+        const uint32_t* face(uint32_t index) const {
+            return &indices_[3 * static_cast<size_t>(index)];
+        }
+
+        point3 position(uint32_t vertex) const {
+            const uint16_t* q = &positions_[3 * static_cast<size_t>(vertex)];
+            return point3(origin_[0] + q[0] * scale_[0], origin_[1] + q[1] * scale_[1], origin_[2] + q[2] * scale_[2]);
+        }
+
+        vec3 normal(uint32_t vertex) const {
+            return decode_octahedral(normals_[vertex]);
+        }
+
+        void uv(uint32_t vertex, Real& u, Real& v) const {
+            u = half_to_float(uvs_[2 * static_cast<size_t>(vertex)]);
+            v = half_to_float(uvs_[2 * static_cast<size_t>(vertex) + 1]);
+        }
+
+        shared_ptr<material> mat() const {
+            return mat_;
+        }
+
+        /**
+         * @return the memory taken by the compressed vertices and faces
+         */
+        size_t memory_bytes() const {
+            return positions_.size() * sizeof(uint16_t) + normals_.size() * sizeof(uint32_t)
+                 + uvs_.size() * sizeof(uint16_t) + indices_.size() * sizeof(uint32_t);
+        }
+
+    private:
+        // position = origin + quantized * scale, per axis
+        Real origin_[3];
+        Real scale_[3];
+        std::vector<uint16_t> positions_;
+        std::vector<uint32_t> normals_;
+        std::vector<uint16_t> uvs_;
+        std::vector<uint32_t> indices_;
+        shared_ptr<material> mat_;
+
+        void set_bounds(const point3& lo, const point3& hi) {
+            for (int a = 0; a < 3; a++) {
+                origin_[a] = lo[a];
+                scale_[a] = (hi[a] - lo[a]) / 65535;
+            }
+        }
+};
+
+
+/**
+ * One face of a compressed_mesh. Takes 24 bytes, so a flat_bvh can store
+ * millions of them by value. Intersection decodes the three positions;
+ * normals and uvs are only decoded when the face is the closest hit.
+ *
+ * The face doesn't own its mesh, so copying one is as cheap as copying a
+ * plain struct; see compressed_mesh for who keeps the mesh alive.
+ */
+class mesh_triangle : public hittable {
+    public:
+        mesh_triangle(const compressed_mesh* mesh, uint32_t index) : mesh_(mesh), index_(index) {}
+
+        virtual std::string type() const override {
+            return "mesh triangle";
+        }
+
+        /**
+         * Decodes the face's corners.
+         */
+        void vertices(point3& a, point3& b, point3& c) const {
+            const uint32_t* v = mesh_->face(index_);
+            a = mesh_->position(v[0]);
+            b = mesh_->position(v[1]);
+            c = mesh_->position(v[2]);
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
+
+        virtual vec3 surface_normal(const point3 position) const override {
+            point3 a, b, c;
+            vertices(a, b, c);
+            return unit_vector(cross(b - a, c - a));
+        }
+
+        virtual aabb bounding_box() const override;
+
+        const compressed_mesh* mesh() const {
+            return mesh_;
+        }
+
+    private:
+        const compressed_mesh* mesh_;
+        uint32_t index_;
+};
+
+
+/**
+ * Makes a mesh_triangle for every face of a mesh, to use as hittables.
+ * The faces share one allocation, which also keeps the mesh alive while any
+ * of them is in use.
+ */
+inline std::vector<shared_ptr<hittable>> mesh_faces(const shared_ptr<const compressed_mesh>& mesh) {
+    struct face_block {
+        shared_ptr<const compressed_mesh> mesh;
+        std::vector<mesh_triangle> faces;
+    };
+    auto block = std::make_shared<face_block>();
+    block->mesh = mesh;
+    block->faces.reserve(mesh->face_count());
+    for (size_t i = 0; i < mesh->face_count(); i++) {
+        block->faces.push_back(mesh_triangle(mesh.get(), static_cast<uint32_t>(i)));
+    }
+
+    std::vector<shared_ptr<hittable>> output;
+    output.reserve(block->faces.size());
+    for (mesh_triangle& face : block->faces) {
+        // shares ownership of the block, but points at the face
+        output.push_back(shared_ptr<hittable>(block, &face));
+    }
+    return output;
+}
+
+
+compressed_mesh::compressed_mesh(const std::vector<point3>& positions, const std::vector<vec3>& normals,
+                                 const std::vector<std::pair<Real, Real>>& uvs,
+                                 const std::vector<uint32_t>& indices, shared_ptr<material> mat)
+: indices_(indices), mat_(mat) {
+    point3 lo(0, 0, 0), hi(0, 0, 0);
+    if (!positions.empty()) {
+        lo = hi = positions[0];
+    }
+    for (const point3& p : positions) {
+        lo = vec_min(lo, p);
+        hi = vec_max(hi, p);
+    }
+    set_bounds(lo, hi);
+
+    positions_.reserve(3 * positions.size());
+    for (const point3& p : positions) {
+        add_vertex(p);
+    }
+    normals_.reserve(normals.size());
+    for (const vec3& n : normals) {
+        add_normal(n);
+    }
+    uvs_.reserve(2 * uvs.size());
+    for (const auto& uv : uvs) {
+        add_uv(uv.first, uv.second);
+    }
+}
+
+
+/**
+ * The same Moller-Trumbore test as triangle::hit, on the decoded corners.
+ */
+bool mesh_triangle::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    point3 a, b, c;
+    vertices(a, b, c);
+    vec3 e1 = b - a;
+    vec3 e2 = c - a;
+    vec3 q = cross(r.direction(), e2);
+
+    Real p = dot(e1, q);
+    if (std::fabs(p) < Real(0.000001)) {
+        return false;
+    }
+
+    Real f = 1/p;
+    vec3 s = r.origin() - a;
+    Real u = f * dot(s, q);
+    if (u < 0) {
+        return false;
+    }
+
+    vec3 x = cross(s, e1);
+    Real v = f * dot(r.direction(), x);
+    if (v < 0 || (u + v) > 1) {
+        return false;
+    }
+    Real t = f * dot(e2, x);
+    if (t < tmin || t > tmax) {
+        return false;
+    }
+    rec.t = t;
+    rec.b1 = u;
+    rec.b2 = v;
+    rec.object = this;
+    return true;
+}
+
+
+/**
+ * Fills in the surface details from the barycentrics stored by hit(): the
+ * interpolated vertex normal if the mesh has normals, and the interpolated
+ * uv if it has uvs (otherwise the barycentrics themselves, as triangle does).
+ */
+void mesh_triangle::finalize_interaction(const ray& r, hit_record& rec) const {
+    const uint32_t* v = mesh_->face(index_);
+    point3 a, b, c;
+    vertices(a, b, c);
+    Real w = 1 - rec.b1 - rec.b2;
+
+    rec.point = r.at(rec.t);
+    vec3 geometric = cross(b - a, c - a);
+    if (mesh_->has_normals()) {
+        vec3 n = w * mesh_->normal(v[0]) + rec.b1 * mesh_->normal(v[1]) + rec.b2 * mesh_->normal(v[2]);
+        Real length_squared = n.length_squared();
+        bool usable = real_is_finite(length_squared) && length_squared > 0;
+        rec.set_normal(r, unit_vector(usable ? n : geometric));
+    } else {
+        rec.set_normal(r, unit_vector(geometric));
+    }
+    rec.tangent = unit_vector(b - a);
+
+    Real world_area = Real(0.5) * geometric.length();
+    if (mesh_->has_uvs()) {
+        Real u[3], t[3];
+        for (int i = 0; i < 3; i++) {
+            mesh_->uv(v[i], u[i], t[i]);
+        }
+        rec.u = w * u[0] + rec.b1 * u[1] + rec.b2 * u[2];
+        rec.v = w * t[0] + rec.b1 * t[1] + rec.b2 * t[2];
+        Real uv_area = Real(0.5) * std::fabs((u[1] - u[0]) * (t[2] - t[0]) - (u[2] - u[0]) * (t[1] - t[0]));
+        rec.uv_extent = uv_area > 0 ? std::sqrt(world_area / uv_area) : 0;
+    } else {
+        rec.u = rec.b1;
+        rec.v = rec.b2;
+        // the barycentric uv triangle has area 1/2
+        rec.uv_extent = std::sqrt(2 * world_area);
+    }
+    rec.mat = mesh_->mat();
+}
+
+
+/**
+ * Gets the box around the decoded corners, padded so that it isn't flat when
+ * the face lies in an axis plane. Each axis is padded by a few ulps of its
+ * largest coordinate, as rectangle's box is, since a fixed padding is lost to
+ * rounding once the coordinates are much bigger than it.
+ */
+aabb mesh_triangle::bounding_box() const {
+    point3 a, b, c;
+    vertices(a, b, c);
+    point3 lo = vec_min(vec_min(a, b), c);
+    point3 hi = vec_max(vec_max(a, b), c);
+    vec3 padding(0, 0, 0);
+    for (int i = 0; i < 3; i++) {
+        Real magnitude = std::max(std::fabs(lo[i]), std::fabs(hi[i]));
+        padding[i] = 4 * std::numeric_limits<Real>::epsilon() * magnitude + Real(1e-7);
+    }
+    return aabb(lo - padding, hi + padding);
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef MOTION_INSTANCE_H
+#define MOTION_INSTANCE_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "ray.h"
+#include "transform.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+#include "hittables/instance.h"
+
+/**
+ * Where an object is at a given time.
+ */
+struct keyframe {
+    Real time;
+    affine_transform object_to_world;
+};
+
+/**
+ * A copy of a shared object that moves along keyframed transforms, giving
+ * motion blur to any kind of primitive, not just spheres.
+ *
+ * Each ray sees the object at the ray's time: the transform is interpolated
+ * between the keyframes around it (see interpolate_transform), and held at the
+ * first or last keyframe outside their range. Like instance, the shared object
+ * must not itself contain instances.
+ *
+ * Between keyframes that only translate the object, the inverse transform is
+ * interpolated too, so rays are mapped into object space without inverting
+ * anything. Between keyframes that rotate or scale it, the interpolated
+ * transform is inverted once per ray test.
+ */
+class motion_instance : public hittable {
+    public:
+        /**
+         * @param object the shared geometry, in its own object space
+         * @param keys where to place the object over time; at least one
+         * @param override_mat if set, used instead of the object's own material
+         */
+        motion_instance(shared_ptr<hittable> object, std::vector<keyframe> keys,
+                        shared_ptr<material> override_mat = nullptr)
+        : object_(object), keys_(keys), mat_(override_mat) {
+            std::sort(keys_.begin(), keys_.end(),
+                      [](const keyframe& a, const keyframe& b) { return a.time < b.time; });
+            aabb object_box = object_->bounding_box();
+            for (size_t k = 0; k < keys_.size(); k++) {
+                boxes_.push_back(keys_[k].object_to_world.apply_box(object_box));
+                translates_.push_back(k + 1 < keys_.size()
+                                      && same_linear_part(keys_[k].object_to_world, keys_[k + 1].object_to_world));
+            }
+
+            // Points move in straight lines between keyframes, so the keyframe
+            // boxes together bound the whole motion
+            bbox_ = boxes_[0];
+            for (const aabb& box : boxes_) {
+                bbox_ = surrounding_box(bbox_, box);
+            }
+        }
+
+        virtual std::string type() const override {
+            return "motion instance";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
+        virtual vec3 surface_normal(const point3 position) const override;
+
+        virtual aabb bounding_box() const override {
+            return bbox_;
+        }
+
+        virtual bool motion_bounds(Real time0, Real time1, aabb& box0, aabb& box1) const override;
+
+        /**
+         * @return the object-to-world transform at a given time
+         */
+        affine_transform transform_at(Real time) const {
+            Real u;
+            size_t k = segment(time, u);
+            if (u <= 0) {
+                return keys_[k].object_to_world;
+            }
+            const affine_transform& a = keys_[k].object_to_world;
+            const affine_transform& b = keys_[k + 1].object_to_world;
+            return translates_[k] ? interpolate_translation(a, b, u) : interpolate_transform(a, b, u);
+        }
+
+    private:
+        shared_ptr<hittable> object_;
+        std::vector<keyframe> keys_;
+        std::vector<aabb> boxes_;   // world-space box at each keyframe
+        std::vector<bool> translates_; // whether the object only translates from key k to k + 1
+        shared_ptr<material> mat_;
+        aabb bbox_;
+
+        /**
+         * Finds the keyframes around a time.
+         * @param u set to how far the time is from key k to key k + 1, in [0, 1)
+         * @return the index k of the last keyframe at or before the time
+         */
+        size_t segment(Real time, Real& u) const {
+            u = 0;
+            if (time <= keys_.front().time) {
+                return 0;
+            }
+            if (time >= keys_.back().time) {
+                return keys_.size() - 1;
+            }
+            auto next = std::upper_bound(keys_.begin(), keys_.end(), time,
+                                         [](Real t, const keyframe& key) { return t < key.time; });
+            size_t k = (next - keys_.begin()) - 1;
+            u = (time - keys_[k].time) / (keys_[k + 1].time - keys_[k].time);
+            return k;
+        }
+
+        /**
+         * @return a box around the object at a given time
+         */
+        aabb box_at(Real time) const {
+            Real u;
+            size_t k = segment(time, u);
+            return u > 0 ? interpolate_box(boxes_[k], boxes_[k + 1], u) : boxes_[k];
+        }
+};
+
+
+bool motion_instance::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    // inverse() only swaps the matrices transform_at already holds
+    affine_transform to_object = transform_at(r.time()).inverse();
+    if (!object_->hit(object_space_ray(r, to_object), rec, tmin, tmax)) {
+        return false;
+    }
+    rec.instanced = rec.object;
+    rec.object = this;
+    return true;
+}
+
+
+void motion_instance::finalize_interaction(const ray& r, hit_record& rec) const {
+    affine_transform to_world = transform_at(r.time());
+    finalize_instanced_hit(r, rec, to_world, to_world.inverse(), to_world.scale_factor(), mat_);
+}
+
+
+/**
+ * Starts from the boxes at the ends of the interval, then widens both ends
+ * wherever interpolating between them would miss the box at a keyframe in
+ * between. Widening both ends by the same amount moves the interpolated box by
+ * that amount at every time, so earlier keyframes stay covered.
+ */
+bool motion_instance::motion_bounds(Real time0, Real time1, aabb& box0, aabb& box1) const {
+    box0 = box_at(time0);
+    box1 = box_at(time1);
+    if (time1 <= time0) {
+        return keys_.size() > 1;
+    }
+
+    const vec3 zero(0, 0, 0);
+    for (size_t k = 0; k < keys_.size(); k++) {
+        if (keys_[k].time <= time0 || keys_[k].time >= time1) {
+            continue;
+        }
+        aabb between = interpolate_box(box0, box1, (keys_[k].time - time0) / (time1 - time0));
+        vec3 grow_min = vec_max(between.min() - boxes_[k].min(), zero);
+        vec3 grow_max = vec_max(boxes_[k].max() - between.max(), zero);
+        box0 = aabb(box0.min() - grow_min, box0.max() + grow_max);
+        box1 = aabb(box1.min() - grow_min, box1.max() + grow_max);
+    }
+    return keys_.size() > 1;
+}
+
+
+vec3 motion_instance::surface_normal(const point3 position) const {
+    const affine_transform& to_world = keys_.front().object_to_world;
+    point3 local = to_world.inverse().apply_point(position);
+    return unit_vector(to_world.apply_normal(object_->surface_normal(local)));
+}
+
+#endif
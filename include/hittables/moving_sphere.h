@@ -6,20 +6,22 @@
 #include "vec3.h"
 #include "ray.h"
 #include "aabb.h"
+#include "fast_math.h"
 #include "material.h"
+#include "hittables/sphere.h"
 
 class moving_sphere : public hittable {
 public:
     moving_sphere() {}
     moving_sphere(
-        point3 cen0, point3 cen1, double _time0, double _time1, double radius, shared_ptr<material> mat)
+        point3 cen0, point3 cen1, Real _time0, Real _time1, Real radius, shared_ptr<material> mat)
         : center0(cen0), center1(cen1), time0(_time0), time1(_time1), rad(radius), m(mat) {
             bbox = create_aabb();
         }
 
-    point3 center(double time) const;
+    point3 center(Real time) const;
 
-    double radius() const {
+    Real radius() const {
         return rad;
     }
 
@@ -31,12 +33,24 @@ public:
         return bbox;
     }
 
+    /**
+     * The sphere moves in a straight line, so its boxes at the two ends of the
+     * interval bound it exactly at every time in between.
+     */
+    bool motion_bounds(Real t0, Real t1, aabb& box0, aabb& box1) const override {
+        vec3 r(rad, rad, rad);
+        box0 = aabb(center(t0) - r, center(t0) + r);
+        box1 = aabb(center(t1) - r, center(t1) + r);
+        return true;
+    }
+
     std::string type() const override {
         return "moving sphere";
     }
 
     virtual vec3 surface_normal(const point3 position) const override;
-    virtual bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const override;
+    virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+    virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
     aabb create_aabb() const;
 
 private:
@@ -46,20 +60,20 @@ private:
      * @param u Variable to store the u-coordinate.
      * @param v Variable to store the v-coordinate.
      */
-    static void compute_uv(const point3& p, double& u, double& v) {
-        auto theta = acos(-p.y());
-        auto phi = atan2(-p.z(), p.x()) + M_PI;
+    static void compute_uv(const point3& p, Real& u, Real& v) {
+        auto theta = fast_acos(-p.y());
+        auto phi = fast_atan2(-p.z(), p.x()) + real_pi;
 
-        u = phi / (2*M_PI);
-        v = theta / M_PI;
+        u = phi / (2*real_pi);
+        v = theta / real_pi;
     }
 
 public:
     point3 center0;
     point3 center1;
-    double time0;
-    double time1;
-    double rad;
+    Real time0;
+    Real time1;
+    Real rad;
     aabb bbox;
     shared_ptr<material> m;
 };
@@ -67,11 +81,11 @@ public:
 vec3 moving_sphere::surface_normal(const point3 position) const {
     return unit_vector(position - center0);
 }
-point3 moving_sphere::center(double time) const {
+point3 moving_sphere::center(Real time) const {
     return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
 }
 
-bool moving_sphere::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
+bool moving_sphere::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -79,7 +93,7 @@ bool moving_sphere::hit(const ray& r, hit_record& rec, double tmin, double tmax)
 
     auto discriminant = half_b*half_b - a*c;
     if (discriminant < 0) return false;
-    auto sqrtd = sqrt(discriminant);
+    auto sqrtd = std::sqrt(discriminant);
 
     auto root = (-half_b - sqrtd) / a;
     if (root < tmin || tmax < root) {
@@ -90,13 +104,19 @@ bool moving_sphere::hit(const ray& r, hit_record& rec, double tmin, double tmax)
     }
 
     rec.t = root;
-    rec.point = r.at(root);
+    rec.object = this;
+
+    return true;
+}
+
+void moving_sphere::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.point = r.at(rec.t);
     auto outward_normal = (rec.point - center(r.time())) / rad;
     rec.set_normal(r, outward_normal);
-    this->compute_uv(rec.normal, rec.u, rec.v);
+    this->compute_uv(outward_normal, rec.u, rec.v);
+    rec.tangent = sphere::sphere_tangent(outward_normal);
+    rec.uv_extent = std::sqrt(Real(2)) * real_pi * rad;
     rec.mat = m;
-
-    return true;
 }
 
 aabb moving_sphere::create_aabb() const {
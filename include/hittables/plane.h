@@ -13,11 +13,16 @@ class plane : public hittable {
         /** 
          * Constructor for a Plane
          * @param point any point that appears on the plane
-         * @param normal the surface normal for the plane
+         * @param normal the surface normal for the plane, need not be unit length
          * @param kDiffuse the kDiffuse element for the Phong shading model
          */
         plane(const point3& point, const vec3& normal, shared_ptr<material> mat)
-            : a(point), n(normal), m(mat) {}
+            : a(point), n(unit_vector(normal)), m(mat) {
+            // any unit vector in the plane will do for the uv axes
+            vec3 axis = std::fabs(n.x()) > Real(0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+            tangent = unit_vector(cross(axis, n));
+            bitangent = cross(n, tangent);
+        }
         
         point3 point() const {
             return a;
@@ -32,31 +37,67 @@ class plane : public hittable {
         }
 
         virtual vec3 surface_normal(const point3 position) const;
-        virtual bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const;
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const;
         virtual aabb bounding_box() const;
 
+        /**
+         * Planes are infinite, so they can't go in a bvh_node.
+         */
+        virtual bool is_bounded() const {
+            return false;
+        }
+
     public:
         point3 a;
         vec3 n;
+        // uv axes in the plane
+        vec3 tangent;
+        vec3 bitangent;
         shared_ptr<material> m;
 };
 
 vec3 plane::surface_normal(const point3 position) const {
-    return unit_vector(n);
+    return n;
 }
 
-bool plane::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
-    double t = dot((a - r.origin()), unit_vector(n)) / dot(r.direction(), unit_vector(n));
+bool plane::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    Real denominator = dot(r.direction(), n);
+    // rays parallel to the plane never hit it
+    if (std::fabs(denominator) < Real(1e-8)) {
+        return false;
+    }
 
+    Real t = dot(a - r.origin(), n) / denominator;
+    if (t < tmin || t > tmax) {
+        return false;
+    }
     rec.t = t;
-    rec.point = r.at(t);
-    rec.set_normal(r, unit_vector(n));
+    rec.object = this;
+    return true;
+}
+
+/**
+ * The uv coordinates are distances along the plane's tangent and bitangent
+ * from its point, so one unit of uv is one unit of length.
+ */
+void plane::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.point = r.at(rec.t);
+    rec.set_normal(r, n);
+    rec.tangent = tangent;
+    vec3 offset = rec.point - a;
+    rec.u = dot(offset, tangent);
+    rec.v = dot(offset, bitangent);
+    rec.uv_extent = 1;
     rec.mat = m;
-    return (t >= 0.0);
 }
 
+/**
+ * Planes have no finite bounding box, so this is infinite (see is_bounded).
+ */
 aabb plane::bounding_box() const {
-    return aabb();
+    return aabb(point3(-real_infinity, -real_infinity, -real_infinity),
+                point3(real_infinity, real_infinity, real_infinity));
 }
 
 #endif
\ No newline at end of file
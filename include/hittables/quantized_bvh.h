@@ -0,0 +1,304 @@
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+#include "hittables/hittable_list.h"
+#include "hittables/flat_bvh.h"
+
+/**
+ * A node of a quantized_bvh, in 20 bytes: the boxes of its two children,
+ * quantized to 8 bits per coordinate within the node's own box, and a packed
+ * reference to each child.
+ *
+ * A child reference is either the index of an interior node, or, with its top
+ * bit set, a leaf: 3 bits of primitive type, 2 bits of primitive count less
+ * one, and 26 bits of offset into that type's array.
+ */
+struct quantized_bvh_node {
+    uint8_t lo[2][3];
+    uint8_t hi[2][3];
+    uint32_t child[2];
+};
+
+/**
+ * A flat_bvh whose nodes are compressed for scenes too big for the caches,
+ * where traversal is bound by memory bandwidth.
+ *
+ * Each node only stores its children's boxes, quantized relative to its own
+ * box, which traversal already decoded at the parent (the root's box is kept
+ * at full precision). Quantization rounds outward, so decoded boxes always
+ * contain the real ones, and rays never miss; they just enter a few more
+ * nodes. Nodes take 20 bytes where flat_bvh takes 32 for each of the two
+ * children, about a third of its node memory.
+ *
+ * The tree is built and its primitives stored by flat_bvh. If there are too
+ * many primitives of one type to pack into a leaf reference, it keeps the
+ * flat_bvh's nodes and traces those.
+ */
+class quantized_bvh : public hittable {
+    public:
+        /**
+         * Builds the tree over a list of objects, as flat_bvh does.
+         */
+        quantized_bvh(const vector<shared_ptr<hittable>>& objects, bvh_split split = bvh_split::spatial,
+                      Real max_growth = Real(1.3));
+
+        quantized_bvh(const hittable_list& list, bvh_split split = bvh_split::spatial,
+                      Real max_growth = Real(1.3))
+        : quantized_bvh(list.objects_, split, max_growth) {}
+
+        virtual std::string type() const override {
+            return "quantized bvh";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+
+        /**
+         * Hits are recorded against the primitive that was hit, so this just
+         * forwards to it.
+         */
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override {
+            rec.object->finalize_interaction(r, rec);
+        }
+
+        /**
+         * This function should never be used
+         */
+        virtual vec3 surface_normal(const point3 position) const override {
+            return vec3(0, 0, 0);
+        }
+
+        virtual aabb bounding_box() const override {
+            return tree_.bounding_box();
+        }
+
+        /**
+         * @return the number of nodes in the tree
+         */
+        size_t node_count() const {
+            return quantized_ ? nodes_.size() : tree_.node_count();
+        }
+
+        /**
+         * @return the memory taken by the tree's nodes, not counting primitives
+         */
+        size_t node_bytes() const {
+            return quantized_ ? nodes_.size() * sizeof(quantized_bvh_node)
+                              : tree_.node_count() * sizeof(flat_bvh_node);
+        }
+
+    private:
+        static const uint32_t leaf_bit = 1u << 31;
+        static const int offset_bits = 26;
+
+        flat_bvh tree_;
+        std::vector<quantized_bvh_node> nodes_;
+        uint32_t root_ = 0;
+        Real root_lo_[3], root_hi_[3];
+        bool quantized_ = false;
+
+        static bool fits(const flat_bvh& tree);
+        uint32_t encode(uint32_t index, const Real lo[3], const Real hi[3]);
+
+        static uint32_t leaf_ref(const flat_bvh_node& leaf) {
+            return leaf_bit | static_cast<uint32_t>(leaf.type) << (offset_bits + 2)
+                 | static_cast<uint32_t>(leaf.count - 1) << offset_bits | leaf.offset;
+        }
+
+        static flat_bvh_node leaf_node(uint32_t ref) {
+            flat_bvh_node leaf;
+            leaf.type = static_cast<primitive_type>((ref >> (offset_bits + 2)) & 7);
+            leaf.count = static_cast<uint16_t>(((ref >> offset_bits) & 3) + 1);
+            leaf.offset = ref & ((1u << offset_bits) - 1);
+            return leaf;
+        }
+
+        /**
+         * The width of one quantization step on an axis of a box.
+         */
+        static Real step(Real lo, Real hi) {
+            return (hi - lo) * Real(1.0 / 255);
+        }
+
+        /**
+         * Decodes a child's box within its parent's. Minimums count up from the
+         * parent's minimum and maximums down from its maximum, so 0 and 255
+         * decode to the parent's bounds exactly.
+         */
+        static void decode(const Real frame_lo[3], const Real frame_hi[3], const uint8_t q_lo[3],
+                           const uint8_t q_hi[3], Real lo[3], Real hi[3]) {
+            for (int a = 0; a < 3; a++) {
+                Real s = step(frame_lo[a], frame_hi[a]);
+                lo[a] = frame_lo[a] + q_lo[a] * s;
+                hi[a] = frame_hi[a] - (255 - q_hi[a]) * s;
+            }
+        }
+};
+
+
+quantized_bvh::quantized_bvh(const vector<shared_ptr<hittable>>& objects, bvh_split split, Real max_growth)
+: tree_(objects, split, max_growth) {
+    if (!tree_.node_count() || !fits(tree_)) {
+        return;
+    }
+
+    const flat_bvh_node& root = tree_.nodes()[0];
+    for (int a = 0; a < 3; a++) {
+        root_lo_[a] = root.min[a];
+        root_hi_[a] = root.max[a];
+    }
+    nodes_.reserve(tree_.node_count() / 2);
+    root_ = encode(0, root_lo_, root_hi_);
+    quantized_ = true;
+
+    // The flat nodes are no longer needed; the primitives stay in tree_
+    tree_.release_nodes();
+}
+
+
+/**
+ * @return whether every leaf's primitives can be packed into a reference
+ */
+bool quantized_bvh::fits(const flat_bvh& tree) {
+    size_t limit = size_t(1) << offset_bits;
+    const primitive_type types[] = {primitive_type::sphere, primitive_type::moving_sphere, primitive_type::triangle,
+                                    primitive_type::rectangle, primitive_type::mesh_triangle, primitive_type::custom};
+    for (primitive_type type : types) {
+        if (tree.primitive_count(type) > limit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Quantizes the subtree under a flat_bvh node, depth-first, each node before
+ * its children.
+ * @param lo, hi the node's box, as traversal will decode it
+ * @return the reference to the subtree's root
+ */
+uint32_t quantized_bvh::encode(uint32_t index, const Real lo[3], const Real hi[3]) {
+    const flat_bvh_node node = tree_.nodes()[index];
+    if (node.count) {
+        return leaf_ref(node);
+    }
+
+    uint32_t slot = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(quantized_bvh_node());
+    quantized_bvh_node q;
+    Real child_lo[2][3], child_hi[2][3];
+    for (int c = 0; c < 2; c++) {
+        const flat_bvh_node& child = tree_.nodes()[node.offset + c];
+        for (int a = 0; a < 3; a++) {
+            Real s = step(lo[a], hi[a]);
+            if (s <= 0) {
+                q.lo[c][a] = 0;
+                q.hi[c][a] = 255;
+                continue;
+            }
+            // Round outward, then step further out until decoding covers the child
+            int q_lo = std::max(0, std::min(255, static_cast<int>(std::floor((child.min[a] - lo[a]) / s))));
+            while (q_lo > 0 && lo[a] + q_lo * s > child.min[a]) {
+                q_lo--;
+            }
+            int q_hi = 255 - std::max(0, std::min(255, static_cast<int>(std::floor((hi[a] - child.max[a]) / s))));
+            while (q_hi < 255 && hi[a] - (255 - q_hi) * s < child.max[a]) {
+                q_hi++;
+            }
+            q.lo[c][a] = static_cast<uint8_t>(q_lo);
+            q.hi[c][a] = static_cast<uint8_t>(q_hi);
+        }
+        decode(lo, hi, q.lo[c], q.hi[c], child_lo[c], child_hi[c]);
+    }
+    for (int c = 0; c < 2; c++) {
+        q.child[c] = encode(node.offset + c, child_lo[c], child_hi[c]);
+    }
+    nodes_[slot] = q;
+    return slot;
+}
+
+
+/**
+ * Finds the closest hit, decoding each node's children's boxes from the box
+ * decoded at its parent. If both children are hit, the one the ray enters
+ * first is visited first, and the other is deferred with its box.
+ */
+bool quantized_bvh::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    if (!quantized_) {
+        return tree_.hit(r, rec, tmin, tmax);
+    }
+    Real entry;
+    if (!hit_slabs(root_lo_, root_hi_, r, tmin, tmax, entry)) {
+        return false;
+    }
+
+    struct deferred {
+        uint32_t ref;
+        Real entry;
+        Real lo[3], hi[3];
+    } stack[flat_bvh::max_depth];
+    int top = 0;
+    uint32_t ref = root_;
+    Real lo[3] = {root_lo_[0], root_lo_[1], root_lo_[2]};
+    Real hi[3] = {root_hi_[0], root_hi_[1], root_hi_[2]};
+    Real closest = tmax;
+    bool hit_anything = false;
+
+    while (true) {
+        if (ref & leaf_bit) {
+            hit_anything |= tree_.hit_leaf(leaf_node(ref), r, rec, tmin, closest);
+        } else {
+            const quantized_bvh_node& node = nodes_[ref];
+            Real child_lo[2][3], child_hi[2][3], child_entry[2];
+            bool hit_child[2];
+            for (int c = 0; c < 2; c++) {
+                decode(lo, hi, node.lo[c], node.hi[c], child_lo[c], child_hi[c]);
+                hit_child[c] = hit_slabs(child_lo[c], child_hi[c], r, tmin, closest, child_entry[c]);
+            }
+            if (hit_child[0] || hit_child[1]) {
+                int near = hit_child[0] && hit_child[1] ? child_entry[1] < child_entry[0] : hit_child[1];
+                if (hit_child[0] && hit_child[1]) {
+                    int far = 1 - near;
+                    if (!(node.child[far] & leaf_bit)) {
+                        prefetch(&nodes_[node.child[far]]);
+                    }
+                    deferred& d = stack[top++];
+                    d.ref = node.child[far];
+                    d.entry = child_entry[far];
+                    std::copy(child_lo[far], child_lo[far] + 3, d.lo);
+                    std::copy(child_hi[far], child_hi[far] + 3, d.hi);
+                }
+                ref = node.child[near];
+                std::copy(child_lo[near], child_lo[near] + 3, lo);
+                std::copy(child_hi[near], child_hi[near] + 3, hi);
+                continue;
+            }
+        }
+
+        // Skip deferred nodes that a hit found since has put out of reach
+        while (top > 0 && stack[top - 1].entry > closest) {
+            top--;
+        }
+        if (top == 0) {
+            break;
+        }
+        const deferred& d = stack[--top];
+        ref = d.ref;
+        std::copy(d.lo, d.lo + 3, lo);
+        std::copy(d.hi, d.hi + 3, hi);
+    }
+    return hit_anything;
+}
+
+#endif
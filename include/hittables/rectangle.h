@@ -1,23 +1,48 @@
 #ifndef RECTANGLE_H
 #define RECTANGLE_H
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "aabb.h"
 #include "material.h"
 #include "ray.h"
+#include "utils.h"
 #include "vec3.h"
 #include "hittables/hittable.h"
-#include "hittables/triangle.h"
 
+/**
+ * A parallelogram (usually a rectangle): a corner Q and the two edges u and v
+ * leaving it, so its points are Q + alpha * u + beta * v for alpha and beta
+ * in [0, 1].
+ *
+ * A hit is one ray-plane test followed by two dot products that give alpha
+ * and beta, which are also the uv coordinates. Lights can sample points on it
+ * uniformly by area.
+ */
 class rectangle : public hittable {
-    public: 
-        /** 
-         * Constructor for a Triangle
-         * @param a_t, b_t, c_t: the three edge points of the triangle
-         * @param kDiffuse the kDiffuse element for the Phong shading model
+    public:
+        /**
+         * Constructs a parallelogram from its corners, in order around the edge.
+         * c is implied by the others (c = b + d - a) and is not used.
+         * @param a, b, c, d the four corners
          */
-        rectangle(const vec3& a, const vec3& b, const vec3& c, const vec3& d, shared_ptr<material> mat) : m(mat) {
-            t1 = make_shared<triangle>(a, b, c, mat);
-            t2 = make_shared<triangle>(a, c, d, mat);
+        rectangle(const vec3& a, const vec3& b, const vec3& c, const vec3& d, shared_ptr<material> mat)
+        : rectangle(a, b - a, d - a, mat) {}
+
+        /**
+         * Constructs a parallelogram from a corner and the two edges leaving it.
+         * @param corner the corner Q
+         * @param edge_u, edge_v the edges u and v
+         */
+        rectangle(const point3& corner, const vec3& edge_u, const vec3& edge_v, shared_ptr<material> mat)
+        : Q(corner), u(edge_u), v(edge_v), m(mat) {
+            vec3 n = cross(u, v);
+            normal = unit_vector(n);
+            D = dot(normal, Q);
+            w = n / dot(n, n);
+            surface_area = n.length();
             bbox = create_aabb();
         }
 
@@ -33,34 +58,117 @@ class rectangle : public hittable {
             return "rectangle";
         }
 
-        // virtual color kDiffuse() const;
+        /**
+         * @return the area of the parallelogram
+         */
+        Real area() const {
+            return surface_area;
+        }
+
+        /**
+         * @return a point picked uniformly by area
+         */
+        point3 random_point() const {
+            return Q + Real(random_double()) * u + Real(random_double()) * v;
+        }
+
+        /**
+         * Gets the probability density, per unit solid angle, of reaching a
+         * direction from a point by sampling random_point().
+         * @return the density, or 0 if the direction misses the parallelogram
+         */
+        Real pdf_value(const point3& origin, const vec3& direction) const {
+            hit_record rec;
+            if (!this->hit(ray(origin, direction), rec, Real(0.001), real_infinity)) {
+                return 0;
+            }
+            Real distance_squared = rec.t * rec.t * direction.length_squared();
+            Real cosine = std::fabs(dot(direction, normal)) / direction.length();
+            return distance_squared / (cosine * surface_area);
+        }
+
         vec3 surface_normal(const point3 position) const;
-        bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const;
+        bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const;
+        void finalize_interaction(const ray& r, hit_record& rec) const;
         aabb create_aabb() const;
 
     public:
-        vec3 a, b, c, d;
-        shared_ptr<triangle> t1, t2;
+        point3 Q;
+        vec3 u, v;
+        vec3 normal;
+        // cross(u, v) / |cross(u, v)|^2, which turns a point in the plane into alpha and beta
+        vec3 w;
+        // the plane is dot(normal, p) = D
+        Real D;
+        Real surface_area;
         aabb bbox;
         shared_ptr<material> m;
 };
 
 vec3 rectangle::surface_normal(const point3 position) const {
-    return t1->surface_normal(position);
+    return normal;
+}
+
+bool rectangle::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    Real denominator = dot(normal, r.direction());
+    // rays parallel to the plane never hit it
+    if (std::fabs(denominator) < Real(1e-8)) {
+        return false;
+    }
+
+    Real t = (D - dot(normal, r.origin())) / denominator;
+    if (t < tmin || t > tmax) {
+        return false;
+    }
+
+    vec3 planar = r.at(t) - Q;
+    Real alpha = dot(w, cross(planar, v));
+    Real beta = dot(w, cross(u, planar));
+    if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1) {
+        return false;
+    }
+
+    rec.t = t;
+    rec.b1 = alpha;
+    rec.b2 = beta;
+    rec.object = this;
+    return true;
 }
 
-bool rectangle::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
-    bool t1_intersect = t1->hit(r, rec, tmin, tmax);
-    bool t2_intersect = t2->hit(r, rec, tmin, tmax);
-    return t1_intersect || t2_intersect;
+/**
+ * Fills in the surface details for a hit. The uv coordinates are the alpha
+ * and beta stored by hit(), so they run from 0 to 1 along each edge.
+ */
+void rectangle::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.point = r.at(rec.t);
+    rec.set_normal(r, normal);
+    rec.tangent = unit_vector(u);
+    rec.u = rec.b1;
+    rec.v = rec.b2;
+    // the uv square has area 1
+    rec.uv_extent = std::sqrt(surface_area);
+    rec.mat = m;
 }
 
+/**
+ * Gets the box around the four corners, padded so that it isn't flat when the
+ * parallelogram lies in an axis plane. Each axis is padded by a few ulps of its
+ * largest coordinate, since a fixed padding is lost to rounding once the
+ * coordinates are much bigger than it.
+ */
 aabb rectangle::create_aabb() const {
-    return surrounding_box(t1->bounding_box(), t2->bounding_box());
+    aabb box = surrounding_box(aabb(vec_min(Q, Q + u + v), vec_max(Q, Q + u + v)),
+                               aabb(vec_min(Q + u, Q + v), vec_max(Q + u, Q + v)));
+    vec3 padding(0, 0, 0);
+    for (int a = 0; a < 3; ++a) {
+        Real magnitude = std::max(std::fabs(box.min()[a]), std::fabs(box.max()[a]));
+        padding[a] = 4 * std::numeric_limits<Real>::epsilon() * magnitude + Real(1e-7);
+    }
+    return aabb(box.min() - padding, box.max() + padding);
 }
 
 inline ostream& operator<<(ostream &out, const rectangle& t) {
     return out << t.type();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -5,6 +5,7 @@
 #include "vec3.h"
 #include "ray.h"
 #include "aabb.h"
+#include "fast_math.h"
 #include "material.h"
 
 #include <cmath>
@@ -19,7 +20,7 @@ class sphere : public hittable {
          * @param radius the radius for the sphere
          * @param kDiffuse the kDiffuse element for the Phong shading model
          */
-        sphere(const point3& center, const double radius, shared_ptr<material> mat)
+        sphere(const point3& center, const Real radius, shared_ptr<material> mat)
         : c(center), rad(radius), m(mat) {
             bbox = create_aabb();
         }
@@ -28,7 +29,7 @@ class sphere : public hittable {
             return c;
         }
 
-        double radius() const {
+        Real radius() const {
             return rad;
         }
 
@@ -36,6 +37,15 @@ class sphere : public hittable {
             return m;
         }
 
+        /**
+         * Moves the sphere, e.g. between frames of an animation. A BVH holding
+         * it must be refit before the next render (see bvh_node::refit).
+         */
+        void move_to(const point3& center) {
+            c = center;
+            bbox = create_aabb();
+        }
+
         aabb bounding_box() const {
             return bbox;
         }
@@ -45,7 +55,8 @@ class sphere : public hittable {
         }
 
         virtual vec3 surface_normal(const point3 position) const;
-        virtual bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const;
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const;
         aabb create_aabb() const;
 
     private:
@@ -55,17 +66,31 @@ class sphere : public hittable {
          * @param u Variable to store the u-coordinate.
          * @param v Variable to store the v-coordinate.
          */
-        static void compute_uv(const point3& p, double& u, double& v) {
-            auto theta = acos(-p.y());
-            auto phi = atan2(-p.z(), p.x()) + M_PI;
+        static void compute_uv(const point3& p, Real& u, Real& v) {
+            auto theta = fast_acos(-p.y());
+            auto phi = fast_atan2(-p.z(), p.x()) + real_pi;
+
+            u = phi / (2*real_pi);
+            v = theta / real_pi;
+        }
 
-            u = phi / (2*M_PI);
-            v = theta / M_PI;
+    public:
+        /**
+         * Computes the unit tangent along increasing u at a point on a sphere.
+         * @param n The outward unit normal at the point.
+         * @return The tangent, or the x axis at the poles.
+         */
+        static vec3 sphere_tangent(const vec3& n) {
+            vec3 t(n.z(), 0, -n.x());
+            if (t.near_zero()) {
+                return vec3(1, 0, 0);
+            }
+            return unit_vector(t);
         }
 
     public:
         point3 c;
-        double rad;
+        Real rad;
         aabb bbox;
         shared_ptr<material> m;
 };
@@ -74,35 +99,42 @@ vec3 sphere::surface_normal(const point3 position) const {
     return unit_vector(position - c);
 }
 
-bool sphere::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
+bool sphere::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
     vec3 oc = r.origin() - c;
-    double a = r.direction().length_squared();
-    double half_b = dot(oc, r.direction());
-    double c = oc.length_squared() - rad * rad;
-    double discriminant = half_b * half_b - a * c;
-    double root;
+    Real a = r.direction().length_squared();
+    Real half_b = dot(oc, r.direction());
+    Real c = oc.length_squared() - rad * rad;
+    Real discriminant = half_b * half_b - a * c;
+    Real root;
     if (discriminant < 0) {
         return false; // no intersection
     } 
     
-    root = (-half_b - sqrt(discriminant)) / (a);
+    root = (-half_b - std::sqrt(discriminant)) / (a);
     if (root < tmin || root > tmax) {
-        root = (-half_b + sqrt(discriminant)) / (a);
+        root = (-half_b + std::sqrt(discriminant)) / (a);
         if (root < tmin || root > tmax) {
             return false;
         }
     }
 
     rec.t = root;
-    rec.point = r.at(root);
-    rec.set_normal(r, surface_normal(rec.point));
-    this->compute_uv(rec.normal, rec.u, rec.v);
-    // rec.kD = kD;
-    rec.mat = m;
+    rec.object = this;
 
     return true;
 }
 
+void sphere::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.point = r.at(rec.t);
+    vec3 outward_normal = (rec.point - c) / rad;
+    rec.set_normal(r, outward_normal);
+    this->compute_uv(outward_normal, rec.u, rec.v);
+    rec.tangent = sphere_tangent(outward_normal);
+    // u spans the circumference and v half of it
+    rec.uv_extent = std::sqrt(Real(2)) * real_pi * rad;
+    rec.mat = m;
+}
+
 aabb sphere::create_aabb() const {
     return aabb(
         c - vec3(rad, rad, rad),
@@ -0,0 +1,337 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "fast_math.h"
+#include "material.h"
+#include "ray.h"
+#include "vec3.h"
+#include "vec4.h"
+#include "hittables/hittable.h"
+#include "hittables/sphere.h"
+
+/**
+ * Four spheres in SIMD-friendly layout, one per vec4 lane.
+ */
+struct alignas(16) sphere_block {
+    Real x[4];
+    Real y[4];
+    Real z[4];
+    Real r[4];
+};
+
+/**
+ * A node of a sphere_set's BVH, in 32 bytes. The first child of an interior
+ * node is the next node in the array.
+ */
+struct sphere_set_node {
+    Real min[3];
+    uint32_t offset;   // leaf: first block; interior: index of the second child
+    Real max[3];
+    uint16_t blocks;   // leaf: number of blocks; 0 for interior nodes
+    uint16_t axis;     // interior: axis the children were split on
+};
+
+/**
+ * A large batch of spheres stored as one hittable, for particle and point
+ * cloud scenes.
+ *
+ * Spheres are kept in blocks of four (see sphere_block) under a BVH of their
+ * own, and each leaf's blocks are tested four spheres at a time in vec4
+ * lanes. A sphere costs about 30 bytes here, including its share of the BVH,
+ * instead of a heap-allocated sphere plus a bvh_node for it.
+ *
+ * Materials are given by index into a small table. Hits set
+ * hit_record::prim_index to the index of the sphere that was hit, in the
+ * order the spheres were given.
+ */
+class sphere_set : public hittable {
+    public:
+        /**
+         * Builds a set of spheres and its BVH.
+         * @param centers, radii one entry per sphere
+         * @param material_ids index into materials for each sphere
+         * @param materials the materials the spheres use
+         */
+        sphere_set(const std::vector<point3>& centers, const std::vector<Real>& radii,
+                   const std::vector<uint32_t>& material_ids, std::vector<shared_ptr<material>> materials);
+
+        virtual std::string type() const override {
+            return "sphere set";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override;
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override;
+        virtual vec3 surface_normal(const point3 position) const override;
+
+        virtual aabb bounding_box() const override {
+            return bbox_;
+        }
+
+        /**
+         * @return how many spheres are in the set
+         */
+        size_t size() const {
+            return count_;
+        }
+
+        /**
+         * @return the memory used by the spheres and their BVH, in bytes
+         */
+        size_t memory_bytes() const {
+            return blocks_.size() * sizeof(sphere_block) + nodes_.size() * sizeof(sphere_set_node)
+                 + slot_material_.size() * sizeof(uint32_t) + slot_index_.size() * sizeof(uint32_t);
+        }
+
+    private:
+        // Leaves hold up to this many spheres (two blocks)
+        static const int leaf_size = 8;
+        // Size of the traversal stack. Median splits keep the tree about
+        // log2(count / 4) deep, far below this; build() asserts it.
+        static const int max_depth = 64;
+
+        size_t count_;
+        std::vector<sphere_block> blocks_;
+        std::vector<sphere_set_node> nodes_;
+        // material and input index of the sphere in each block lane
+        std::vector<uint32_t> slot_material_;
+        std::vector<uint32_t> slot_index_;
+        std::vector<shared_ptr<material>> materials_;
+        aabb bbox_;
+
+        uint32_t build(std::vector<uint32_t>& order, size_t begin, size_t end, int depth,
+                       const std::vector<point3>& centers, const std::vector<Real>& radii,
+                       const std::vector<uint32_t>& material_ids);
+        bool hit_block(const ray& r, uint32_t block, Real tmin, Real& closest, uint32_t& slot) const;
+
+        point3 center(uint32_t slot) const {
+            const sphere_block& b = blocks_[slot / 4];
+            return point3(b.x[slot % 4], b.y[slot % 4], b.z[slot % 4]);
+        }
+
+        Real radius(uint32_t slot) const {
+            return blocks_[slot / 4].r[slot % 4];
+        }
+};
+
+
+sphere_set::sphere_set(const std::vector<point3>& centers, const std::vector<Real>& radii,
+                       const std::vector<uint32_t>& material_ids, std::vector<shared_ptr<material>> materials)
+: count_(centers.size()), materials_(materials) {
+    if (count_ == 0) {
+        bbox_ = aabb(point3(0, 0, 0), point3(0, 0, 0));
+        return;
+    }
+
+    // about one block per four spheres and one node per four spheres
+    blocks_.reserve(count_ / 4 + count_ / 16 + 1);
+    nodes_.reserve(count_ / 2 + 1);
+    std::vector<uint32_t> order(count_);
+    for (size_t i = 0; i < count_; i++) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    build(order, 0, count_, 0, centers, radii, material_ids);
+    blocks_.shrink_to_fit();
+    nodes_.shrink_to_fit();
+
+    const sphere_set_node& root = nodes_[0];
+    bbox_ = aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+}
+
+
+/**
+ * Builds the subtree over order[begin, end), splitting at the median centroid
+ * on the axis where the centroids spread the most.
+ * @param depth how many interior nodes are above this one, which is how many
+ *              entries hit() may have on its stack when it gets here
+ * @return the index of the subtree's root node
+ */
+uint32_t sphere_set::build(std::vector<uint32_t>& order, size_t begin, size_t end, int depth,
+                           const std::vector<point3>& centers, const std::vector<Real>& radii,
+                           const std::vector<uint32_t>& material_ids) {
+    assert(depth <= max_depth);
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(sphere_set_node());
+
+    point3 lo(real_infinity, real_infinity, real_infinity), hi = -lo;
+    point3 centroid_lo = lo, centroid_hi = hi;
+    for (size_t i = begin; i < end; i++) {
+        const point3& c = centers[order[i]];
+        vec3 r(radii[order[i]], radii[order[i]], radii[order[i]]);
+        lo = vec_min(lo, c - r);
+        hi = vec_max(hi, c + r);
+        centroid_lo = vec_min(centroid_lo, c);
+        centroid_hi = vec_max(centroid_hi, c);
+    }
+    sphere_set_node node;
+    for (int a = 0; a < 3; a++) {
+        node.min[a] = lo[a];
+        node.max[a] = hi[a];
+    }
+
+    size_t count = end - begin;
+    if (count <= static_cast<size_t>(leaf_size)) {
+        // Fill whole blocks; spare lanes repeat the leaf's last sphere, so they
+        // can only ever report a hit that sphere reports anyway
+        node.offset = static_cast<uint32_t>(blocks_.size());
+        node.blocks = static_cast<uint16_t>((count + 3) / 4);
+        node.axis = 0;
+        for (size_t i = 0; i < 4u * node.blocks; i++) {
+            if (i % 4 == 0) {
+                blocks_.push_back(sphere_block());
+            }
+            uint32_t sphere = order[begin + std::min(i, count - 1)];
+            sphere_block& b = blocks_.back();
+            b.x[i % 4] = centers[sphere].x();
+            b.y[i % 4] = centers[sphere].y();
+            b.z[i % 4] = centers[sphere].z();
+            b.r[i % 4] = radii[sphere];
+            slot_material_.push_back(material_ids[sphere]);
+            slot_index_.push_back(sphere);
+        }
+        nodes_[index] = node;
+        return index;
+    }
+
+    vec3 spread = centroid_hi - centroid_lo;
+    int axis = 0;
+    if (spread.y() > spread[axis]) {
+        axis = 1;
+    }
+    if (spread.z() > spread[axis]) {
+        axis = 2;
+    }
+
+    // Split on a multiple of four, so leaves fill whole blocks
+    size_t mid = begin + std::max<size_t>(4, (count / 2) & ~size_t(3));
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+    build(order, begin, mid, depth + 1, centers, radii, material_ids);
+    node.offset = build(order, mid, end, depth + 1, centers, radii, material_ids);
+    node.blocks = 0;
+    node.axis = static_cast<uint16_t>(axis);
+    nodes_[index] = node;
+    return index;
+}
+
+
+bool sphere_set::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
+    if (nodes_.empty()) {
+        return false;
+    }
+
+    uint32_t stack[max_depth];
+    int top = 0;
+    uint32_t current = 0;
+    Real closest = tmax;
+    uint32_t slot = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const sphere_set_node& node = nodes_[current];
+        if (hit_slabs(node.min, node.max, r, tmin, closest)) {
+            if (node.blocks) {
+                for (uint32_t b = node.offset; b < node.offset + node.blocks; b++) {
+                    hit_anything |= hit_block(r, b, tmin, closest, slot);
+                }
+            } else {
+                // Visit the child nearer the ray first, so closest shrinks sooner
+                uint32_t first = current + 1, second = node.offset;
+                if (r.sign[node.axis]) {
+                    std::swap(first, second);
+                }
+                stack[top++] = second;
+                current = first;
+                continue;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        current = stack[--top];
+    }
+
+    if (hit_anything) {
+        rec.t = closest;
+        rec.object = this;
+        rec.prim_index = slot;
+    }
+    return hit_anything;
+}
+
+
+/**
+ * Tests the ray against the four spheres of a block at once.
+ * @param closest the nearest hit so far, updated if one of these is nearer
+ * @param slot set to the slot of the nearer sphere, if there is one
+ */
+bool sphere_set::hit_block(const ray& r, uint32_t block, Real tmin, Real& closest, uint32_t& slot) const {
+    const sphere_block& b = blocks_[block];
+    vec4 ocx = vec4(r.orig.x()) - vec4(simd_load(b.x));
+    vec4 ocy = vec4(r.orig.y()) - vec4(simd_load(b.y));
+    vec4 ocz = vec4(r.orig.z()) - vec4(simd_load(b.z));
+    vec4 radius(simd_load(b.r));
+
+    Real a = r.dir.length_squared();
+    Real inv_a = 1 / a;
+    vec4 dx(r.dir.x()), dy(r.dir.y()), dz(r.dir.z());
+    vec4 half_b = ocx * dx + ocy * dy + ocz * dz;
+
+    // The discriminant as r^2 minus the squared distance from the center to
+    // the line, which keeps its precision for small, distant spheres where
+    // b^2 - ac would cancel
+    vec4 s = half_b * inv_a;
+    vec4 lx = ocx - s * dx, ly = ocy - s * dy, lz = ocz - s * dz;
+    vec4 discriminant = radius * radius - (lx * lx + ly * ly + lz * lz);
+    vec4 root = vec_sqrt(vec_max(a * discriminant, vec4(0)));
+    vec4 near = (-half_b - root) * inv_a;
+    vec4 far = (-half_b + root) * inv_a;
+
+    bool found = false;
+    for (int lane = 0; lane < 4; lane++) {
+        if (discriminant[lane] < 0) {
+            continue;
+        }
+        Real t = near[lane] >= tmin ? near[lane] : far[lane];
+        if (t >= tmin && t < closest) {
+            closest = t;
+            slot = block * 4 + lane;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+void sphere_set::finalize_interaction(const ray& r, hit_record& rec) const {
+    uint32_t slot = rec.prim_index;
+    Real rad = radius(slot);
+    rec.point = r.at(rec.t);
+    vec3 outward_normal = (rec.point - center(slot)) / rad;
+    rec.set_normal(r, outward_normal);
+    rec.u = (fast_atan2(-outward_normal.z(), outward_normal.x()) + real_pi) / (2 * real_pi);
+    rec.v = fast_acos(-outward_normal.y()) / real_pi;
+    rec.tangent = sphere::sphere_tangent(outward_normal);
+    rec.uv_extent = std::sqrt(Real(2)) * real_pi * rad;
+    rec.mat = materials_[slot_material_[slot]];
+    rec.prim_index = slot_index_[slot];
+}
+
+
+/**
+ * This function should never be used: the position doesn't say which sphere.
+ */
+vec3 sphere_set::surface_normal(const point3 position) const {
+    return vec3(0, 0, 0);
+}
+
+#endif
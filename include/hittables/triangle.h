@@ -45,8 +45,9 @@ class triangle : public hittable {
 
         // virtual color kDiffuse() const;
         vec3 surface_normal(const point3 position) const;
-        vec3 interpolated_normal(const point3 position) const;
-        bool hit(const ray& r, hit_record& rec, double tmin, double tmax) const;
+        vec3 interpolated_normal(Real b1, Real b2) const;
+        bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const;
+        void finalize_interaction(const ray& r, hit_record& rec) const;
         aabb create_aabb() const;
         void set_vertex_normals(const vec3& a, const vec3& b, const vec3& c);
         vec3 barycentric_coordinates(const point3 position) const;
@@ -56,6 +57,7 @@ class triangle : public hittable {
         point3 b;
         point3 c;
         aabb bbox;
+        // per vertex normals for smooth shading; zero (flat shading) until set
         vec3 normal_a;
         vec3 normal_b;
         vec3 normal_c;
@@ -64,12 +66,12 @@ class triangle : public hittable {
 
 /**
  * Calculates the area of the triangle given three points
- * @return the area as a double
+ * @return the area as a Real
  */
-inline double area(const point3 x, const point3 y, const point3 z) {
+inline Real area(const point3 x, const point3 y, const point3 z) {
     vec3 e1 = y - x;
     vec3 e2 = z - x;
-    return 0.5 * cross(e1, e2).length();
+    return Real(0.5) * cross(e1, e2).length();
 }
 
 /** the position is not used, only there to match the function structure **/
@@ -80,60 +82,81 @@ vec3 triangle::surface_normal(const point3 position) const {
 }
 
 /**
- * Calculates the interpolated normal based on the barycentric coordinates of the point
- * @param position: the point to calculate barycentric coordinates for
- * @return a vec3 containing the interpolated normal
+ * Interpolates the vertex normals at a point given by the barycentrics that
+ * hit() stores, so no areas need computing
+ * @param b1, b2: the weights of vertices b and c (a gets the rest)
+ * @return the interpolated normal, not normalized
  */
-vec3 triangle::interpolated_normal(const point3 position) const {
-    vec3 bc = barycentric_coordinates(position);
-    return normal_a * bc[0] + normal_b * bc[1] + normal_c * bc[2];
+vec3 triangle::interpolated_normal(Real b1, Real b2) const {
+    return normal_a * (1 - b1 - b2) + normal_b * b1 + normal_c * b2;
 }
 
-bool triangle::hit(const ray& r, hit_record& rec, double tmin, double tmax) const {
+bool triangle::hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const {
     vec3 e1 = b - a;
     vec3 e2 = c - a;
     vec3 q = cross(r.direction(), e2);
 
-    double p = dot(e1, q);
-    if (abs(p) < 0.000001) {
+    Real p = dot(e1, q);
+    if (std::fabs(p) < Real(0.000001)) {
         return false;
     }
 
-    double f = 1/p;
+    Real f = 1/p;
     vec3 s = r.origin() - a;
-    double u = f * dot(s, q);
+    Real u = f * dot(s, q);
 
-    if (u < 0.0) {
+    if (u < 0) {
         return false;
     }
 
     vec3 x = cross(s, e1);
-    double v = f * dot(r.direction(), x);
-    if (v < 0.0 || (u + v) > 1.0) {
+    Real v = f * dot(r.direction(), x);
+    if (v < 0 || (u + v) > 1) {
         return false;
     }
-    double t = f * dot(e2, x);
+    Real t = f * dot(e2, x);
     if (t < tmin || t > tmax) {
         return false;
     }
     rec.t = t;
-    rec.point = r.at(t);
-    // rec.set_normal(r, interpolated_normal(rec.p));
-    rec.set_normal(r, surface_normal(rec.point));
-    // rec.kD = kD;
-    rec.mat = m;
+    rec.b1 = u;
+    rec.b2 = v;
+    rec.object = this;
     return true;
 }
 
+/**
+ * Fills in the surface details for a hit, using the barycentrics stored by hit()
+ * as the uv coordinates, and to interpolate the vertex normals if they are set.
+ */
+void triangle::finalize_interaction(const ray& r, hit_record& rec) const {
+    rec.point = r.at(rec.t);
+    // Fall back to the face normal if the vertex normals are unset, or
+    // cancel out or aren't finite where they are interpolated
+    vec3 n = normal_a.length_squared() > 0 ? interpolated_normal(rec.b1, rec.b2) : vec3(0, 0, 0);
+    Real length_squared = n.length_squared();
+    if (real_is_finite(length_squared) && length_squared > 0) {
+        rec.set_normal(r, unit_vector(n));
+    } else {
+        rec.set_normal(r, surface_normal(rec.point));
+    }
+    rec.tangent = unit_vector(b - a);
+    rec.u = rec.b1;
+    rec.v = rec.b2;
+    // the barycentric uv triangle has area 1/2
+    rec.uv_extent = std::sqrt(2 * area(a, b, c));
+    rec.mat = m;
+}
+
 aabb triangle::create_aabb() const {
-    double minx = fmin(fmin(a[0], b[0]), c[0]);
-    double maxx = fmax(fmax(a[0], b[0]), c[0]);
-    double miny = fmin(fmin(a[1], b[1]), c[1]);
-    double maxy = fmax(fmax(a[1], b[1]), c[1]);
-    double minz = fmin(fmin(a[2], b[2]), c[2]);
-    double maxz = fmax(fmax(a[2], b[2]), c[2]);
-
-    double epsilon = 0.0000001;
+    Real minx = std::min(std::min(a[0], b[0]), c[0]);
+    Real maxx = std::max(std::max(a[0], b[0]), c[0]);
+    Real miny = std::min(std::min(a[1], b[1]), c[1]);
+    Real maxy = std::max(std::max(a[1], b[1]), c[1]);
+    Real minz = std::min(std::min(a[2], b[2]), c[2]);
+    Real maxz = std::max(std::max(a[2], b[2]), c[2]);
+
+    Real epsilon = Real(0.0000001);
     if (minx == maxx) {
         minx -= epsilon;
         maxx += epsilon;
@@ -165,10 +188,10 @@ void triangle::set_vertex_normals(const vec3& x, const vec3& y, const vec3& z) {
  * @param position: the point to find barycentric coordinates for
  */
 vec3 triangle::barycentric_coordinates(const point3 position) const {
-    double T = area(a, b, c);
-    double b1 = area(position, b, c) / T;
-    double b2 = area(a, position, c) / T;
-    double b3 = area(a, b, position) / T;
+    Real T = area(a, b, c);
+    Real b1 = area(position, b, c) / T;
+    Real b2 = area(a, position, c) / T;
+    Real b3 = area(a, b, position) / T;
     return vec3(b1, b2, b3);
 }
 
@@ -55,6 +55,18 @@ inline bool** get_multi_jitter_mask(int fine_grid) {
     return sample;
 }
 
+/**
+ * Frees a mask made by get_multi_jitter_mask.
+ * @param sample the mask to free
+ * @param fine_grid the size it was made with
+ **/
+inline void free_multi_jitter_mask(bool** sample, int fine_grid) {
+    for (int i = 0; i < fine_grid; i++) {
+        delete[] sample[i];
+    }
+    delete[] sample;
+}
+
 /**
  * Print a ppm file to display the multi-jitter sample grid, where black pixels represent the points to take a sample at. 
  * This is purely for visualization and testing purposes.
@@ -74,6 +86,7 @@ inline void display_jitter_mask(int fine_grid) {
             }
         }
     }
+    free_multi_jitter_mask(sample, fine_grid);
 }
 
 #endif
\ No newline at end of file
@@ -3,8 +3,10 @@
 
 #include <memory>
 
+#include "fast_math.h"
 #include "ray.h"
 #include "texture.h"
+#include "texture_registry.h"
 #include "utils.h"
 #include "vec3.h"
 #include "hittables/hittable.h"
@@ -12,6 +14,13 @@
 using std::shared_ptr;
 using std::make_shared;
 
+/**
+ * Extra ray cone spread (radians) added by a diffuse bounce. A diffuse lobe has no
+ * single footprint, so this is a heuristic that lets indirect texture lookups use
+ * coarser mip levels.
+ */
+const Real diffuse_cone_spread = Real(0.2);
+
 /**
  * Abstract class for materials.
  */
@@ -44,8 +53,12 @@ class material {
  */
 class lambertian : public material {
     public:
+        /**
+         * Constructs a lambertian material of a single color. Materials of the
+         * same color share one texture from the default texture registry.
+         */
         lambertian(const color& c)
-        : texture_(make_shared<solid_color_texture>(c)) {}
+        : texture_(default_texture_registry().solid(c)) {}
 
         lambertian(shared_ptr<texture> t)
         : texture_(t) {}
@@ -56,7 +69,8 @@ class lambertian : public material {
                 scatter_direction = rec.normal;
             }
             scattered = ray(rec.point, scatter_direction, r.time());
-            attenuation = this->texture_->value(rec.u, rec.v, rec.point);
+            scattered.set_cone(rec.cone_width, r.cone_spread + diffuse_cone_spread);
+            attenuation = this->texture_->filtered_value(rec.u, rec.v, rec.point, rec.footprint);
             return true;
         }
 
@@ -69,22 +83,23 @@ class lambertian : public material {
  */
 class mirror : public material {
     public:
-        mirror(const color& c, double f)
-        : texture_(make_shared<solid_color_texture>(c)), fuzz_(f<1 ? f : 1) {}
+        mirror(const color& c, Real f)
+        : texture_(default_texture_registry().solid(c)), fuzz_(f<1 ? f : 1) {}
 
-        mirror(shared_ptr<texture> t, double f)
+        mirror(shared_ptr<texture> t, Real f)
         : texture_(t), fuzz_(f<1 ? f : 1) {}
 
         virtual bool scatter(const ray& r, const hit_record& rec, ray& scattered, color& attenuation) const override{
             vec3 reflected = reflect(r.direction(), rec.normal);
             scattered = ray(rec.point, reflected + fuzz_ * random_in_unit_sphere(), r.time());
-            attenuation = this->texture_->value(rec.u, rec.v, rec.point);
+            scattered.set_cone(rec.cone_width, r.cone_spread + fuzz_);
+            attenuation = this->texture_->filtered_value(rec.u, rec.v, rec.point, rec.footprint);
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
     public:
         shared_ptr<texture> texture_;
-        double fuzz_;
+        Real fuzz_;
 };
 
 /**
@@ -92,22 +107,22 @@ class mirror : public material {
  */
 class dielectric : public material {
     public: 
-        dielectric(const color& mat_color, double index) : c(mat_color), ior(index) {}
+        dielectric(const color& mat_color, Real index) : c(mat_color), ior(index) {}
 
         virtual bool scatter(const ray& r, const hit_record& rec, ray& scattered, color& attenuation) const override{
-            double refraction_ratio;
+            Real refraction_ratio;
             vec3 n = rec.normal;
             if (dot(r.direction(), rec.normal) < 0) {
-                refraction_ratio = 1.0 / ior;
+                refraction_ratio = 1 / ior;
             } else {
                 refraction_ratio = ior;
             }
 
             vec3 unit_direction = r.direction();
-            double cos_theta = fmin(dot(-unit_direction, n), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+            Real cos_theta = std::min(dot(-unit_direction, n), Real(1));
+            Real sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
-            bool cant_refract = refraction_ratio * sin_theta > 1.0;
+            bool cant_refract = refraction_ratio * sin_theta > 1;
             vec3 direction;
             if (cant_refract || reflectance(cos_theta, refraction_ratio) > random_double()) {
                 direction = reflect(unit_direction, n);
@@ -115,22 +130,23 @@ class dielectric : public material {
                 direction = refract(unit_direction, n, refraction_ratio);
             }
             scattered = ray(rec.point, direction, r.time());
+            scattered.set_cone(rec.cone_width, r.cone_spread);
             attenuation = this->c;
             return true;
         }
 
     public:
         color c;
-        double ior;
+        Real ior;
 
     private:
         /**
          * Schlick's approximation for reflectance
          */
-        static double reflectance(double cosine, double ref_idx) {
+        static Real reflectance(Real cosine, Real ref_idx) {
             auto r0 = (1 - ref_idx) / (1 + ref_idx);
             r0 = r0 * r0;
-            return r0 + (1 - r0) * pow((1 - cosine), 5);
+            return r0 + (1 - r0) * pow5(1 - cosine);
         }
 };
 
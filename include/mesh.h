@@ -9,6 +9,7 @@
 #include <memory>
 
 #include "vec3.h"
+#include "hittables/mesh_triangle.h"
 #include "hittables/triangle.h"
 
 using namespace std;
@@ -30,19 +31,29 @@ class mesh {
             return output;
         }
 
+        /**
+         * Packs the vertices, vertex normals and faces into a compressed_mesh,
+         * a fraction of the memory of the triangles. To avoid making the
+         * triangles in the first place, use load_compressed_mesh().
+         * @return one mesh_triangle per face, to use in place of get_faces()
+         */
+        vector<shared_ptr<hittable>> get_compressed_faces() const;
+
         void calculate_normals();
 
     public:
         vector<vec3> vertices;
+        vector<vec3> normals;
         vector<shared_ptr<triangle>> faces;
         vector<vec3> indices;
+        shared_ptr<material> mat;
 };
 
 /**
  * Constructor for mesh
  * @param filename: the obj file to load the mesh from
  */
-mesh::mesh(const string filename, shared_ptr<material> m) {
+mesh::mesh(const string filename, shared_ptr<material> m) : mat(m) {
     ifstream file(filename);
     string str;
     char a;
@@ -67,14 +78,19 @@ mesh::mesh(const string filename, shared_ptr<material> m) {
 }
 
 /**
- * Compute the per vertex normals using area weighted averaging of the surrounding triangle faces
+ * Compute the per vertex normals using area weighted averaging of the surrounding triangle faces.
+ * Zero-area faces have no normal and are skipped, so a vertex only they touch keeps a zero normal.
  */
 void mesh::calculate_normals() {
-    vector<vec3> normals(vertices.size());
-    
+    normals.assign(vertices.size(), vec3(0, 0, 0));
+
     for (unsigned i = 0; i < faces.size(); i++) {
-        vec3 normal = 0.5 * faces[i]->surface_normal(point3(0.0,0.0,0.0));
         vec3 index = indices[i];
+        const point3& a = vertices[index.x()];
+        if (cross(vertices[index.y()] - a, vertices[index.z()] - a).length_squared() == 0) {
+            continue;
+        }
+        vec3 normal = 0.5 * faces[i]->surface_normal(point3(0.0,0.0,0.0));
 
         normals[index.x()] = (normal) + normals[index.x()];
         normals[index.y()] = (normal) + normals[index.y()];
@@ -82,7 +98,9 @@ void mesh::calculate_normals() {
     }
 
     for (unsigned i = 0; i < normals.size(); i++) {
-        normals[i] = unit_vector(normals[i]);
+        if (normals[i].length_squared() > 0) {
+            normals[i] = unit_vector(normals[i]);
+        }
     }
 
     // store the per vertex normal in the triangle
@@ -95,4 +113,76 @@ void mesh::calculate_normals() {
     }
 }
 
-#endif
\ No newline at end of file
+vector<shared_ptr<hittable>> mesh::get_compressed_faces() const {
+    vector<uint32_t> face_indices;
+    face_indices.reserve(3 * indices.size());
+    for (const vec3& index : indices) {
+        for (int i = 0; i < 3; i++) {
+            face_indices.push_back(static_cast<uint32_t>(index[i]));
+        }
+    }
+    auto packed = make_shared<const compressed_mesh>(vertices, normals, vector<pair<Real, Real>>(), face_indices, mat);
+    return mesh_faces(packed);
+}
+
+/**
+ * Loads an obj file straight into a compressed_mesh, without keeping the
+ * vertices at full precision or making a triangle per face. The file is read
+ * twice: once for the box around its vertices, which sets the quantization,
+ * and once to quantize the vertices and read the faces. Vertex normals are
+ * averaged from the faces' normals, as mesh does.
+ * @param filename: the obj file to load the mesh from
+ * @return the mesh, or null if the file has no faces
+ */
+shared_ptr<compressed_mesh> load_compressed_mesh(const string& filename, shared_ptr<material> m) {
+    char a;
+    float x, y, z;
+    size_t vertex_count = 0;
+    point3 lo(0, 0, 0), hi(0, 0, 0);
+    {
+        ifstream file(filename);
+        while (file >> a >> x >> y >> z) {
+            if (a == 'v') {
+                point3 p(x, y, z);
+                lo = vertex_count ? vec_min(lo, p) : p;
+                hi = vertex_count ? vec_max(hi, p) : p;
+                vertex_count++;
+            }
+        }
+    }
+
+    auto packed = make_shared<compressed_mesh>(aabb(lo, hi), m);
+    vector<vec3> normal_sums(vertex_count, vec3(0, 0, 0));
+    size_t vertices_read = 0;
+    ifstream file(filename);
+    while (file >> a >> x >> y >> z) {
+        if (a == 'v' && vertices_read < vertex_count) {
+            packed->add_vertex(point3(x, y, z));
+            vertices_read++;
+        }
+        if (a == 'f' && x >= 1 && y >= 1 && z >= 1 && x <= vertices_read && y <= vertices_read && z <= vertices_read) {
+            uint32_t i0 = static_cast<uint32_t>(x - 1);
+            uint32_t i1 = static_cast<uint32_t>(y - 1);
+            uint32_t i2 = static_cast<uint32_t>(z - 1);
+            packed->add_face(i0, i1, i2);
+            point3 p0 = packed->position(i0);
+            vec3 n = cross(packed->position(i1) - p0, packed->position(i2) - p0);
+            if (n.length_squared() > 0) {
+                n = unit_vector(n);
+                normal_sums[i0] += n;
+                normal_sums[i1] += n;
+                normal_sums[i2] += n;
+            }
+        }
+    }
+    if (packed->face_count() == 0) {
+        return nullptr;
+    }
+
+    for (const vec3& n : normal_sums) {
+        packed->add_normal(n);
+    }
+    return packed;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file packing.h
+ * Compact encodings for geometry attributes: octahedral unit vectors in
+ * 32 bits and half-precision floats.
+ */
+#ifndef PACKING_H
+#define PACKING_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "real.h"
+#include "vec3.h"
+
+/**
+ * Encodes a unit vector in 32 bits: folds the octahedron |x|+|y|+|z| = 1 onto
+ * a square and stores the square's coordinates as 16-bit signed normalized
+ * values. The worst-case angular error is about 0.005 degrees.
+ * @param n a unit vector
+ **/
+inline uint32_t encode_octahedral(const vec3& n) {
+    Real inv = 1 / (std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z()));
+    Real x = n.x() * inv, y = n.y() * inv;
+    if (n.z() < 0) {
+        // fold the lower half over the diagonals
+        Real fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        Real fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = fx;
+        y = fy;
+    }
+    int16_t qx = static_cast<int16_t>(std::lround(std::fmax(-1, std::fmin(1, x)) * 32767));
+    int16_t qy = static_cast<int16_t>(std::lround(std::fmax(-1, std::fmin(1, y)) * 32767));
+    return static_cast<uint32_t>(static_cast<uint16_t>(qx)) | static_cast<uint32_t>(static_cast<uint16_t>(qy)) << 16;
+}
+
+/**
+ * Decodes a unit vector packed by encode_octahedral.
+ **/
+inline vec3 decode_octahedral(uint32_t packed) {
+    Real x = static_cast<int16_t>(packed & 0xffff) * Real(1.0 / 32767);
+    Real y = static_cast<int16_t>(packed >> 16) * Real(1.0 / 32767);
+    Real z = 1 - std::fabs(x) - std::fabs(y);
+    if (z < 0) {
+        Real fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        Real fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = fx;
+        y = fy;
+    }
+    return unit_vector(vec3(x, y, z));
+}
+
+/**
+ * Converts a float to IEEE half precision, rounding to nearest. Values too
+ * big for a half become infinity; values too small become zero.
+ **/
+inline uint16_t float_to_half(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31) {
+        // overflow, infinity or NaN
+        bool nan = ((bits >> 23) & 0xff) == 0xff && mantissa;
+        return static_cast<uint16_t>(sign | 0x7c00 | (nan ? 0x200 : 0));
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+        // subnormal half: shift the mantissa, with its implicit bit, into place
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = static_cast<uint32_t>(exponent) << 10 | mantissa >> 13;
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        // may carry into the exponent, which rounds up to the next power of two or infinity
+        half++;
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+/**
+ * Converts an IEEE half precision value to a float.
+ **/
+inline float half_to_float(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | mantissa << 13;
+    } else if (exponent) {
+        bits = sign | (exponent - 15 + 127) << 23 | mantissa << 13;
+    } else if (mantissa) {
+        // subnormal half: normalize it for the float
+        int shift = 0;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            shift++;
+        }
+        bits = sign | static_cast<uint32_t>(127 - 15 + 1 - shift) << 23 | (mantissa & 0x3ff) << 13;
+    } else {
+        bits = sign;
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+#endif
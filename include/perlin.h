@@ -7,143 +7,244 @@
 #define PERLIN_H
 
 #include <cmath>
+#include <cstdint>
+#include <random>
 
 #include "utils.h"
 #include "vec3.h"
+#include "vec4.h"
 
 
+/**
+ * Gradient noise over a 256^3 lattice that repeats in every direction.
+ *
+ * Permutations are stored as bytes and gradients as separate x, y and z
+ * arrays, so all tables fit in 4 KB inside the object and the eight lattice
+ * corners of a lookup are evaluated four at a time in vec4 lanes.
+ * The tables are generated from a seed, so the same seed always gives the
+ * same pattern.
+ */
 class perlin {
 public:
 	/**
 	 * Constructs a randomized Perlin noise pattern.
 	 */
-	perlin() {
-		this->rand_vecs_ = new vec3[num_points_];
+	perlin() : perlin(static_cast<uint32_t>(rand())) {}
+
+	/**
+	 * Constructs the Perlin noise pattern for a given seed.
+	 */
+	explicit perlin(uint32_t seed) : seed_(seed) {
+		std::mt19937 rng(seed);
 		for (int i = 0; i < num_points_; ++i) {
-			this->rand_vecs_[i] = random_unit_vector();
+			vec3 g = random_gradient(rng);
+			this->grad_x_[i] = g.x();
+			this->grad_y_[i] = g.y();
+			this->grad_z_[i] = g.z();
 		}
 
-		this->perm_x_ = perlin_generate_perm();
-		this->perm_y_ = perlin_generate_perm();
-		this->perm_z_ = perlin_generate_perm();
+		perlin_generate_perm(this->perm_x_, rng);
+		perlin_generate_perm(this->perm_y_, rng);
+		perlin_generate_perm(this->perm_z_, rng);
+	}
+
+	uint32_t seed() const {
+		return this->seed_;
 	}
 
 	/**
-	 * Frees the arrays used in the Perlin object.
+	 * Gets Perlin noise for a given point in space.
 	 */
-	~perlin() {
-		delete[] this->rand_vecs_;
-		delete[] this->perm_x_;
-		delete[] this->perm_y_;
-		delete[] this->perm_z_;
+	Real noise(const point3& p) const {
+		int i = floor_int(p.x());
+		int j = floor_int(p.y());
+		int k = floor_int(p.z());
+		Real u = p.x() - i;
+		Real v = p.y() - j;
+		Real w = p.z() - k;
+
+		// Lanes hold the corners (dj, dk) = (0, 0), (0, 1), (1, 0), (1, 1);
+		// the two halves of the cube (di = 0 and 1) are done one after the other
+		Real uu = hermite(u);
+		Real vv = hermite(v);
+		Real ww = hermite(w);
+		vec4 weight_yz = vec4(1 - vv, 1 - vv, vv, vv) * vec4(1 - ww, ww, 1 - ww, ww);
+		vec4 offset_y(v, v, v - 1, v - 1);
+		vec4 offset_z(w, w - 1, w, w - 1);
+
+		int y0 = this->perm_y_[j & 255], y1 = this->perm_y_[(j + 1) & 255];
+		int z0 = this->perm_z_[k & 255], z1 = this->perm_z_[(k + 1) & 255];
+
+		vec4 accum;
+		for (int di = 0; di < 2; ++di) {
+			int x = this->perm_x_[(i + di) & 255];
+			int h0 = x ^ y0 ^ z0, h1 = x ^ y0 ^ z1, h2 = x ^ y1 ^ z0, h3 = x ^ y1 ^ z1;
+			vec4 dots = gradients_x(h0, h1, h2, h3) * vec4(u - di)
+					  + gradients_y(h0, h1, h2, h3) * offset_y
+					  + gradients_z(h0, h1, h2, h3) * offset_z;
+			accum += (di ? uu : 1 - uu) * (weight_yz * dots);
+		}
+		return accum.sum();
 	}
 
 	/**
-	 * Gets Perlin noise for a given point in space.
+	 * Gets Perlin noise with turbulence.
+	 * Four octaves are evaluated at once, one per vec4 lane.
 	 */
-	double noise(const point3& p) const {
-		auto u = p.x() - floor(p.x());
-		auto v = p.y() - floor(p.y());
-		auto w = p.z() - floor(p.z());
+	Real turbulence(const point3& p, int depth = 7) const {
+		vec4 accum;
+		Real scale = 1;
+		Real weight = 1;
+
+		for (int first = 0; first < depth; first += 4) {
+			vec4 lane_weight;
+			for (int lane = 0; lane < 4; ++lane) {
+				// lanes past the last octave keep a weight of zero
+				lane_weight[lane] = first + lane < depth ? weight / Real(1 << lane) : Real(0);
+			}
+			accum += lane_weight * noise4(p, vec4(scale, 2 * scale, 4 * scale, 8 * scale));
+			scale *= 16;
+			weight /= 16;
+		}
+
+		return std::fabs(accum.sum());
+	}
+
+private:
+	static const int num_points_ = 256;
+	uint32_t seed_;
+	Real grad_x_[num_points_];
+	Real grad_y_[num_points_];
+	Real grad_z_[num_points_];
+	uint8_t perm_x_[num_points_];
+	uint8_t perm_y_[num_points_];
+	uint8_t perm_z_[num_points_];
+
+	vec4 gradients_x(int h0, int h1, int h2, int h3) const {
+		return vec4(this->grad_x_[h0], this->grad_x_[h1], this->grad_x_[h2], this->grad_x_[h3]);
+	}
+
+	vec4 gradients_y(int h0, int h1, int h2, int h3) const {
+		return vec4(this->grad_y_[h0], this->grad_y_[h1], this->grad_y_[h2], this->grad_y_[h3]);
+	}
 
-		auto i = static_cast<int>(floor(p.x()));
-		auto j = static_cast<int>(floor(p.y()));
-		auto k = static_cast<int>(floor(p.z()));
-		vec3 c[2][2][2];
+	vec4 gradients_z(int h0, int h1, int h2, int h3) const {
+		return vec4(this->grad_z_[h0], this->grad_z_[h1], this->grad_z_[h2], this->grad_z_[h3]);
+	}
 
+	/**
+	 * Gets Perlin noise at four scalings of the same point, one per lane.
+	 * @param scales what p is multiplied by in each lane
+	 */
+	vec4 noise4(const point3& p, const vec4& scales) const {
+		// Permutation entries for both lattice planes on each axis, per lane
+		vec4 u, v, w;
+		int hx[2][4], hy[2][4], hz[2][4];
+		for (int lane = 0; lane < 4; ++lane) {
+			Real x = p.x() * scales[lane];
+			Real y = p.y() * scales[lane];
+			Real z = p.z() * scales[lane];
+			int i = floor_int(x);
+			int j = floor_int(y);
+			int k = floor_int(z);
+			u[lane] = x - i;
+			v[lane] = y - j;
+			w[lane] = z - k;
+			for (int d = 0; d < 2; ++d) {
+				hx[d][lane] = this->perm_x_[(i + d) & 255];
+				hy[d][lane] = this->perm_y_[(j + d) & 255];
+				hz[d][lane] = this->perm_z_[(k + d) & 255];
+			}
+		}
+
+		const vec4 one(1);
+		vec4 uu = hermite(u), vv = hermite(v), ww = hermite(w);
+		vec4 accum;
 		for (int di = 0; di < 2; ++di) {
+			vec4 weight_x = di ? uu : one - uu;
+			vec4 offset_x = di ? u - one : u;
 			for (int dj = 0; dj < 2; ++dj) {
+				vec4 weight_xy = weight_x * (dj ? vv : one - vv);
+				vec4 offset_y = dj ? v - one : v;
 				for (int dk = 0; dk < 2; ++dk) {
-					c[di][dj][dk] = this->rand_vecs_[
-						this->perm_x_[(i+di) & 255] ^
-						this->perm_y_[(j+dj) & 255] ^
-						this->perm_z_[(k+dk) & 255]
-					];
+					int h[4];
+					for (int lane = 0; lane < 4; ++lane) {
+						h[lane] = hx[di][lane] ^ hy[dj][lane] ^ hz[dk][lane];
+					}
+					vec4 dots = gradients_x(h[0], h[1], h[2], h[3]) * offset_x
+							  + gradients_y(h[0], h[1], h[2], h[3]) * offset_y
+							  + gradients_z(h[0], h[1], h[2], h[3]) * (dk ? w - one : w);
+					accum += weight_xy * (dk ? ww : one - ww) * dots;
 				}
 			}
 		}
-
-		return perlin_interp(c, u, v, w);
+		return accum;
 	}
 
 	/**
-	 * Gets Perlin noise with turbulence.
+	 * Picks a random unit vector, by rejection sampling the unit ball.
+	 * Uses the raw generator output rather than a std distribution, whose
+	 * results differ between standard libraries.
 	 */
-	double turbulence(const point3& p, int depth = 7) const {
-		auto accum = 0.0;
-		auto temp_p = p;
-		auto weight = 1.0;
-
-		for (int i = 0; i < depth; ++i) {
-			accum += weight * noise(temp_p);
-			weight *= 0.5;
-			temp_p *= 2;
+	static vec3 random_gradient(std::mt19937& rng) {
+		while (true) {
+			vec3 g(uniform(rng), uniform(rng), uniform(rng));
+			Real length_squared = g.length_squared();
+			if (length_squared > Real(1e-4) && length_squared < 1) {
+				return g / std::sqrt(length_squared);
+			}
 		}
-
-		return fabs(accum);
 	}
 
-private:
-	static const int num_points_ = 256;
-	vec3* rand_vecs_;
-	int* perm_x_;
-	int* perm_y_;
-	int* perm_z_;
+	/**
+	 * @return a random number in [-1, 1)
+	 */
+	static Real uniform(std::mt19937& rng) {
+		return static_cast<Real>(rng() / 4294967296.0 * 2 - 1);
+	}
 
 	/**
 	 * Generates a Perlin noise pattern for one dimension.
 	 */
-	static int* perlin_generate_perm() {
-		auto p = new int[perlin::num_points_];
-
+	static void perlin_generate_perm(uint8_t* p, std::mt19937& rng) {
 		for (int i = 0; i < perlin::num_points_; ++i) {
-			p[i] = i;
+			p[i] = static_cast<uint8_t>(i);
 		}
 
-		permute(p, perlin::num_points_);
-		return p;
+		permute(p, perlin::num_points_, rng);
 	}
 
 	/**
 	 * Swaps each element in the array p with a random one, creating the base
 	 * noise pattern.
 	 */
-	static void permute(int* p, int n) {
+	static void permute(uint8_t* p, int n, std::mt19937& rng) {
 		for (int i = n-1; i > 0; i--) {
-			int target = random_int(0, i);
-			int tmp = p[i];
+			int target = static_cast<int>(rng() % (i + 1));
+			uint8_t tmp = p[i];
 			p[i] = p[target];
 			p[target] = tmp;
 		}
 	}
 
 	/**
-	 * Linearly interpolates using trilinear interplation.
-	 * @param c The data to interpolate.
-	 * @param u The amount to interpolate in the first dimension.
-	 * @param v The amount to interpolate in the second dimension.
-	 * @param w The amount to interpolate in the third dimension.
+	 * Rounds down to an integer. Cheaper than std::floor on targets without a
+	 * rounding instruction (SSE2).
 	 */
-	static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-		// Use a Hermite cubic to round off the interpolation
-		auto uu = u*u*(3-2*u);
-		auto vv = v*v*(3-2*v);
-		auto ww = w*w*(3-2*w);
-		auto accum =  0.0;
-
-		for (int i = 0; i < 2; ++i) {
-			for (int j = 0; j < 2; ++j) {
-				for (int k = 0; k < 2; ++k) {
-					vec3 weight_v(u-i, v-j, w-k);
-
-					accum += (i*uu + (1-i) * (1-uu)) *
-							 (j*vv + (1-j) * (1-vv)) *
-							 (k*ww + (1-k) * (1-ww)) *
-							 dot(c[i][j][k], weight_v);
-				}
-			}
-		}
-		return accum;
+	static int floor_int(Real x) {
+		int i = static_cast<int>(x);
+		return i - (x < i);
+	}
+
+	/**
+	 * Rounds off the interpolation weights with a Hermite cubic.
+	 */
+	static Real hermite(Real t) {
+		return t*t*(3-2*t);
+	}
+
+	static vec4 hermite(const vec4& t) {
+		return t * t * (vec4(3) - vec4(2) * t);
 	}
 };
 
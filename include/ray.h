@@ -2,14 +2,17 @@
 #define RAY_H
 
 #include "vec3.h"
+#include <cmath>
 #include <iostream>
 using std::ostream;
 
 class ray {
     public:
         ray() {}
-        ray(const point3& origin, const vec3& direction, double time = 0.0)
-            : orig(origin), dir(direction), tm(time) {}
+        ray(const point3& origin, const vec3& direction, Real time = 0.0)
+            : orig(origin), dir(direction), tm(time) {
+            set_inverse_direction();
+        }
 
         point3 origin() const {
             return orig;
@@ -19,18 +22,58 @@ class ray {
             return dir;
         }
 
-        double time() const {
+        Real time() const {
             return tm;
         }
 
-        point3 at (double t) const {
+        point3 at (Real t) const {
             return orig + t * dir;
         }
 
+        /**
+         * Sets the ray cone used to pick texture detail levels.
+         * @param width the cone width at the ray origin, in world units
+         * @param spread how much the width grows per unit of distance travelled
+         */
+        void set_cone(Real width, Real spread) {
+            cone_width = width;
+            cone_spread = spread;
+        }
+
+        /**
+         * @return the width of the ray cone at parameter t
+         */
+        Real cone_width_at(Real t) const {
+            return cone_width + cone_spread * t * dir.length();
+        }
+
+    private:
+        /**
+         * Caches 1/direction and the direction sign bits for the slab test in aabb::hit.
+         * Zero components are nudged to a tiny value of the same sign first, so the
+         * reciprocal stays finite and the slab test never computes 0 * inf = NaN
+         * for axis-parallel rays (this also holds under -ffast-math).
+         */
+        void set_inverse_direction() {
+            const Real tiny = Real(1e-20);
+            for (int i = 0; i < 3; i++) {
+                Real d = dir[i];
+                if (std::fabs(d) < tiny) {
+                    d = std::signbit(d) ? -tiny : tiny;
+                }
+                inv_dir[i] = 1 / d;
+                sign[i] = inv_dir[i] < 0;
+            }
+        }
+
     public:
         point3 orig;
         vec3 dir;
-        double tm;
+        Real tm;
+        vec3 inv_dir;
+        int sign[3];
+        Real cone_width = 0;
+        Real cone_spread = 0;
 };
 
 inline ostream& operator<<(ostream &out, const ray &r) {
@@ -0,0 +1,49 @@
+/**
+ * @file real.h
+ * The floating point type used throughout the renderer.
+ *
+ * Everything (vectors, rays, hit records, bounding boxes) uses Real so values
+ * don't get converted between float and double on every operation.
+ * Build with -DRT_DOUBLE_PRECISION to render in double precision; this also
+ * turns off the SIMD vector math (see simd.h).
+ */
+#ifndef REAL_H
+#define REAL_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#ifdef RT_DOUBLE_PRECISION
+typedef double Real;
+#else
+typedef float Real;
+#endif
+
+/**
+ * Positive infinity for the Real type, used as the default tmax for rays.
+ */
+const Real real_infinity = std::numeric_limits<Real>::infinity();
+
+/**
+ * Pi as a Real, so angle math doesn't promote to double.
+ */
+const Real real_pi = Real(3.14159265358979323846);
+
+/**
+ * @return whether x is neither infinite nor NaN. Tests the exponent bits
+ * because -Ofast assumes every value is finite and folds std::isfinite to true.
+ */
+inline bool real_is_finite(Real x) {
+#ifdef RT_DOUBLE_PRECISION
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7FF0000000000000ull) != 0x7FF0000000000000ull;
+#else
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7F800000u) != 0x7F800000u;
+#endif
+}
+
+#endif
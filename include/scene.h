@@ -0,0 +1,165 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+#include "hittables/hittable_list.h"
+#include "hittables/bvh_node.h"
+#include "hittables/flat_bvh.h"
+#include "hittables/quantized_bvh.h"
+
+/**
+ * Which BVH a scene builds over its bounded objects.
+ */
+enum class scene_bvh {
+    automatic,  // refittable if anything moves during the shutter, flat otherwise
+    flat,       // flat_bvh: fastest to trace, for static scenes
+    refittable, // bvh_node: can be refit or rebuilt in place after objects move
+    compressed  // quantized_bvh: a third of flat_bvh's node memory, for huge static scenes
+};
+
+/**
+ * Everything a camera can see: a BVH over the bounded objects, plus a short
+ * list of unbounded ones (such as planes) that have no box to put in a BVH.
+ *
+ * Each ray traverses the BVH, then tests the unbounded objects directly, so an
+ * infinite ground costs one plane test per ray.
+ */
+class scene : public hittable {
+    public:
+        /**
+         * Constructs an empty scene.
+         */
+        scene() {}
+
+        /**
+         * Constructs a scene from a list of objects, sorting them into the BVH
+         * or the unbounded list. Lists among the objects are opened, so a plane
+         * inside one still stays out of the BVH.
+         * @param time0, time1 the camera's shutter interval, for motion bounds
+         * @param kind which BVH to build
+         */
+        scene(const std::vector<shared_ptr<hittable>>& objects, Real time0 = 0, Real time1 = 1,
+              scene_bvh kind = scene_bvh::automatic) {
+            std::vector<shared_ptr<hittable>> bounded;
+            sort_objects(objects, bounded);
+            if (bounded.empty()) {
+                return;
+            }
+            if (kind == scene_bvh::automatic) {
+                // flat_bvh bounds moving objects over the whole shutter, so it
+                // would give up bvh_node's motion bounds
+                kind = moves(bounded, time0, time1) ? scene_bvh::refittable : scene_bvh::flat;
+            }
+            if (kind == scene_bvh::refittable) {
+                bvh_ = make_shared<bvh_node>(bounded, time0, time1);
+                accel_ = bvh_;
+            } else if (kind == scene_bvh::compressed) {
+                accel_ = make_shared<quantized_bvh>(bounded);
+            } else {
+                accel_ = make_shared<flat_bvh>(bounded);
+            }
+        }
+
+        scene(const hittable_list& list, Real time0 = 0, Real time1 = 1, scene_bvh kind = scene_bvh::automatic)
+        : scene(list.objects_, time0, time1, kind) {}
+
+        virtual std::string type() const override {
+            return "scene";
+        }
+
+        virtual bool hit(const ray& r, hit_record& rec, Real tmin, Real tmax) const override {
+            bool hit_anything = accel_ && accel_->hit(r, rec, tmin, tmax);
+            for (const auto& object : unbounded_) {
+                if (object->hit(r, rec, tmin, hit_anything ? rec.t : tmax)) {
+                    hit_anything = true;
+                }
+            }
+            return hit_anything;
+        }
+
+        /**
+         * Hits are recorded against the object that was hit, so this just forwards
+         * to it.
+         */
+        virtual void finalize_interaction(const ray& r, hit_record& rec) const override {
+            rec.object->finalize_interaction(r, rec);
+        }
+
+        /**
+         * This function should never be used
+         */
+        virtual vec3 surface_normal(const point3 position) const override {
+            return vec3(0, 0, 0);
+        }
+
+        /**
+         * @return the box around the bounded objects; unbounded ones are left out
+         */
+        virtual aabb bounding_box() const override {
+            return accel_ ? accel_->bounding_box() : aabb(point3(0, 0, 0), point3(0, 0, 0));
+        }
+
+        virtual bool is_bounded() const override {
+            return unbounded_.empty();
+        }
+
+        /**
+         * @return the refittable BVH over the bounded objects, or null if the
+         * scene was built with a flat BVH or has no bounded objects
+         */
+        shared_ptr<bvh_node> bvh() const {
+            return bvh_;
+        }
+
+        const std::vector<shared_ptr<hittable>>& unbounded() const {
+            return unbounded_;
+        }
+
+    private:
+        /**
+         * Adds each object to bounded or to the unbounded list, and the objects
+         * of a list that holds anything unbounded one by one.
+         */
+        void sort_objects(const std::vector<shared_ptr<hittable>>& objects,
+                          std::vector<shared_ptr<hittable>>& bounded) {
+            for (const auto& object : objects) {
+                const hittable_list* list = dynamic_cast<const hittable_list*>(object.get());
+                if (object->is_bounded()) {
+                    bounded.push_back(object);
+                } else if (list) {
+                    sort_objects(list->objects_, bounded);
+                } else {
+                    unbounded_.push_back(object);
+                }
+            }
+        }
+
+        /**
+         * @return whether any of the objects, or any object in a list among
+         * them, moves between time0 and time1
+         */
+        static bool moves(const std::vector<shared_ptr<hittable>>& objects, Real time0, Real time1) {
+            for (const auto& object : objects) {
+                aabb box0, box1;
+                const hittable_list* list = dynamic_cast<const hittable_list*>(object.get());
+                if (list ? moves(list->objects_, time0, time1) : object->motion_bounds(time0, time1, box0, box1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // the BVH over the bounded objects, and the same BVH if it is refittable
+        shared_ptr<hittable> accel_;
+        shared_ptr<bvh_node> bvh_;
+        std::vector<shared_ptr<hittable>> unbounded_;
+};
+
+#endif
@@ -14,7 +14,10 @@
 
 #include "material.h"
 #include "mesh.h"
+#include "scene.h"
 #include "texture.h"
+#include "texture_registry.h"
+#include "transform.h"
 #include "utils.h"
 #include "vec3.h"
 
@@ -26,6 +29,7 @@
 #include "hittables/sphere.h"
 #include "hittables/triangle.h"
 #include "hittables/moving_sphere.h"
+#include "hittables/instance.h"
 
 using std::shared_ptr;
 using std::make_shared;
@@ -35,19 +39,22 @@ using std::make_shared;
 /**
  * Creates a simple scene with three spheres for texture testing.
  */
-bvh_node three_spheres() {
+scene three_spheres() {
 	hittable_list world;
 
-	auto perlin_texture = make_shared<noise_texture>(10);
+	texture_registry& textures = default_texture_registry();
+	// Bake the noise over the two spheres that use it when baking is on
+	aabb noise_bounds(point3(-1.35, -0.55, -3.35), point3(0.95, 0.15, -1.65));
+	auto perlin_texture = textures.baked(textures.noise(10), noise_bounds, Real(0.004));
 
-	auto floor_texture = make_shared<checker_texture>(color(0.3, 0.4, 0.5), color(0.9, 0.9, 0.9));
+	auto floor_texture = textures.checker(color(0.3, 0.4, 0.5), color(0.9, 0.9, 0.9));
 	auto floor_material = make_shared<lambertian>(floor_texture);
 	world.add(make_shared<rectangle>(point3(-10, -0.5, -10), 
 									 point3(-10, -0.5,  10),
 									 point3( 10, -0.5,  10),
 									 point3( 10, -0.5, -10), floor_material));
 
-	auto wall_texture = make_shared<solid_color_texture>(color(0.5, 0.4, 0.3));
+	auto wall_texture = textures.solid(color(0.5, 0.4, 0.3));
 	auto wall_material = make_shared<lambertian>(wall_texture);
 	world.add(make_shared<rectangle>(point3(-1.5, -0.5, -4),
 									 point3(-1.5,  2.0, -4),
@@ -71,7 +78,7 @@ bvh_node three_spheres() {
 
 	// Middle sphere
 	//auto texture1 = make_shared<solid_color_texture>(color(1, 0.2, 0.8));
-	auto earth_texture = make_shared<image_texture>("data/earthmap.jpg");
+	auto earth_texture = textures.cached_image("data/earthmap.jpg");
 	auto material1 = make_shared<lambertian>(earth_texture);
 	world.add(make_shared<sphere>(point3(0, 0, -2.5), 0.4, material1));
 
@@ -99,7 +106,7 @@ bvh_node three_spheres() {
 									 point3( 1.5, 2.0, 1),
 									 point3( 1.5, 2.0, -4), light_material2));
 
-	return bvh_node(world);
+	return scene(world);
 }
 
 
@@ -107,7 +114,7 @@ bvh_node three_spheres() {
 /**
  * Creates the default scene created by Fiza.
  */
-bvh_node default_scene() {
+scene default_scene() {
 	hittable_list objects;
 
 	// Color pallete
@@ -193,7 +200,7 @@ bvh_node default_scene() {
 	objects.add(make_shared<sphere>(s_light_center, s_light_radius, light_mat));
 
 	// Create a BVH tree of all the objects.
-	return bvh_node(objects);
+	return scene(objects);
 }
 
 
@@ -201,12 +208,50 @@ bvh_node default_scene() {
 /**
  * Creates a scene of just the cow mesh.
  */
-bvh_node cow_mesh() {
+scene cow_mesh() {
     color cow_color = color(1,0,0);
 	auto cow_mat = make_shared<lambertian>(cow_color);
     mesh cow_mesh = mesh("objs/cow.obj", cow_mat);
     vector<shared_ptr<hittable>> cow_triangles = cow_mesh.get_faces();
-    return bvh_node(cow_triangles);
+    return scene(cow_triangles);
+}
+
+
+//-----------------------------------------------------------------------------
+/**
+ * Creates a herd of cows on a grid, facing random directions.
+ * The cow mesh and its BVH are built once; every cow is an instance of it,
+ * and the scene BVH is built over the instances.
+ * @param rows, columns size of the grid of cows
+ */
+scene cow_herd(const std::string& filename = "objs/cow.obj", int rows = 32, int columns = 32) {
+	auto cow_mat = make_shared<lambertian>(color(1, 0, 0));
+	mesh cow_mesh = mesh(filename, cow_mat);
+	if (cow_mesh.faces.empty()) {
+		std::cerr << "Error loading mesh file '" << filename << "'.\n";
+	}
+	auto cow = make_shared<bvh_node>(cow_mesh.get_faces());
+
+	// Scale each cow to a fixed size, standing on y = -0.5
+	aabb box = cow->bounding_box();
+	vec3 extent = box.max() - box.min();
+	Real size = std::max(std::max(extent.x(), extent.y()), extent.z());
+	point3 feet((box.min().x() + box.max().x()) / 2, box.min().y(), (box.min().z() + box.max().z()) / 2);
+	affine_transform normalize = affine_transform::scale(Real(0.3) / size) * affine_transform::translate(-feet);
+
+	color palette[4] = {color(0.55, 0.35, 0.2), color(0.9, 0.9, 0.85), color(0.15, 0.12, 0.1), color(0.7, 0.5, 0.3)};
+	vector<shared_ptr<hittable>> herd;
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < columns; ++j) {
+			point3 position(Real(0.4) * (j - columns / 2), -0.5, -1.5 - Real(0.4) * i);
+			affine_transform place = affine_transform::translate(position)
+							* affine_transform::rotate(vec3(0, 1, 0), Real(360 * random_double()))
+							* normalize;
+			auto coat = make_shared<lambertian>(palette[(i + j) % 4]);
+			herd.push_back(make_shared<instance>(cow, place, coat));
+		}
+	}
+	return scene(herd);
 }
 
 #endif
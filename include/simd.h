@@ -0,0 +1,129 @@
+/**
+ * @file simd.h
+ * A thin layer over 4-wide SIMD registers, used by vec3 and vec4.
+ *
+ * Uses SSE2 on x86 and NEON on 64-bit ARM when Real is float. Double precision
+ * builds, other targets, and builds with -DRT_NO_SIMD get a plain scalar
+ * fallback with the same interface.
+ * Pointers passed to simd_load/simd_store must be 16-byte aligned.
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+
+#include "real.h"
+
+#if !defined(RT_DOUBLE_PRECISION) && !defined(RT_NO_SIMD) && defined(__SSE2__)
+#define RT_SIMD_SSE 1
+#include <emmintrin.h>
+#elif !defined(RT_DOUBLE_PRECISION) && !defined(RT_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define RT_SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define RT_SIMD_SCALAR 1
+#endif
+
+
+#if defined(RT_SIMD_SSE)
+
+typedef __m128 simd4;
+
+inline simd4 simd_load(const Real* p) { return _mm_load_ps(p); }
+inline void simd_store(Real* p, simd4 a) { _mm_store_ps(p, a); }
+inline simd4 simd_set1(Real x) { return _mm_set1_ps(x); }
+inline simd4 simd_set(Real x, Real y, Real z, Real w) { return _mm_setr_ps(x, y, z, w); }
+inline simd4 simd_add(simd4 a, simd4 b) { return _mm_add_ps(a, b); }
+inline simd4 simd_sub(simd4 a, simd4 b) { return _mm_sub_ps(a, b); }
+inline simd4 simd_mul(simd4 a, simd4 b) { return _mm_mul_ps(a, b); }
+inline simd4 simd_div(simd4 a, simd4 b) { return _mm_div_ps(a, b); }
+inline simd4 simd_min(simd4 a, simd4 b) { return _mm_min_ps(a, b); }
+inline simd4 simd_max(simd4 a, simd4 b) { return _mm_max_ps(a, b); }
+inline simd4 simd_sqrt(simd4 a) { return _mm_sqrt_ps(a); }
+
+/**
+ * Rotates lanes (x, y, z, w) to (y, z, x, w), used for cross products.
+ */
+inline simd4 simd_yzx(simd4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+#elif defined(RT_SIMD_NEON)
+
+typedef float32x4_t simd4;
+
+inline simd4 simd_load(const Real* p) { return vld1q_f32(p); }
+inline void simd_store(Real* p, simd4 a) { vst1q_f32(p, a); }
+inline simd4 simd_set1(Real x) { return vdupq_n_f32(x); }
+inline simd4 simd_set(Real x, Real y, Real z, Real w) {
+    const float v[4] = {x, y, z, w};
+    return vld1q_f32(v);
+}
+inline simd4 simd_add(simd4 a, simd4 b) { return vaddq_f32(a, b); }
+inline simd4 simd_sub(simd4 a, simd4 b) { return vsubq_f32(a, b); }
+inline simd4 simd_mul(simd4 a, simd4 b) { return vmulq_f32(a, b); }
+inline simd4 simd_div(simd4 a, simd4 b) { return vdivq_f32(a, b); }
+inline simd4 simd_min(simd4 a, simd4 b) { return vminq_f32(a, b); }
+inline simd4 simd_max(simd4 a, simd4 b) { return vmaxq_f32(a, b); }
+inline simd4 simd_sqrt(simd4 a) { return vsqrtq_f32(a); }
+inline simd4 simd_yzx(simd4 a) {
+    // (x, y, z, w) -> (y, z, w, x) -> (y, z, x, w)
+    simd4 r = vextq_f32(a, a, 1);
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3), vsetq_lane_f32(vgetq_lane_f32(a, 0), r, 2), 3);
+}
+
+#else
+
+struct simd4 {
+    Real v[4];
+};
+
+inline simd4 simd_load(const Real* p) {
+    simd4 r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+}
+inline void simd_store(Real* p, simd4 a) {
+    for (int i = 0; i < 4; i++) p[i] = a.v[i];
+}
+inline simd4 simd_set1(Real x) {
+    simd4 r = {{x, x, x, x}};
+    return r;
+}
+inline simd4 simd_set(Real x, Real y, Real z, Real w) {
+    simd4 r = {{x, y, z, w}};
+    return r;
+}
+inline simd4 simd_add(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] += b.v[i];
+    return a;
+}
+inline simd4 simd_sub(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] -= b.v[i];
+    return a;
+}
+inline simd4 simd_mul(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] *= b.v[i];
+    return a;
+}
+inline simd4 simd_div(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] /= b.v[i];
+    return a;
+}
+inline simd4 simd_min(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    return a;
+}
+inline simd4 simd_max(simd4 a, simd4 b) {
+    for (int i = 0; i < 4; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    return a;
+}
+inline simd4 simd_sqrt(simd4 a) {
+    for (int i = 0; i < 4; i++) a.v[i] = std::sqrt(a.v[i]);
+    return a;
+}
+inline simd4 simd_yzx(simd4 a) {
+    simd4 r = {{a.v[1], a.v[2], a.v[0], a.v[3]}};
+    return r;
+}
+
+#endif
+
+#endif
@@ -14,7 +14,7 @@
 #pragma GCC diagnostic push
 
 #pragma GCC diagnostic ignored "-Wsign-compare"
-// #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image/stb_image.h"
@@ -6,11 +6,19 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <initializer_list>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "fast_math.h"
 #include "perlin.h"
+#include "tiled_image.h"
+#include "utils.h"
 #include "vec3.h"
 #include "stb_image/stb_image_include.h"
 
@@ -24,7 +32,43 @@ using std::make_shared;
  */
 class texture {
 public:
-	virtual color value(double u, double v, const point3& p) const = 0;
+	virtual color value(Real u, Real v, const point3& p) const = 0;
+
+	/**
+	 * Gets the texture color averaged over a footprint around (u, v).
+	 * Textures without a filtered lookup just return value().
+	 * @param footprint width of the lookup in uv units, 0 for a point sample
+	 */
+	virtual color filtered_value(Real u, Real v, const point3& p, Real footprint) const {
+		return value(u, v, p);
+	}
+
+	/**
+	 * Describes what the texture computes, for caching baked copies of it.
+	 * Two textures with the same key must return the same value at every point.
+	 * @return the key, or an empty string if the texture can't be baked because
+	 *         it depends on more than position or isn't reproducible
+	 */
+	virtual std::string bake_key() const {
+		return "";
+	}
+
+protected:
+	/**
+	 * Formats texture parameters for a bake key, with enough digits to
+	 * tell any two floats apart.
+	 */
+	static std::string key_string(const std::string& name, std::initializer_list<Real> params) {
+		std::ostringstream key;
+		key << name << "(" << std::setprecision(9);
+		const char* separator = "";
+		for (Real x : params) {
+			key << separator << x;
+			separator = ",";
+		}
+		key << ")";
+		return key.str();
+	}
 };
 
 
@@ -61,10 +105,14 @@ public:
 	 * Gets the color value of the texture at a specific point.
 	 * @return The color value of the texture.
 	 */
-	virtual color value(double u, double v, const vec3& p) const override {
+	virtual color value(Real u, Real v, const vec3& p) const override {
 		return this->color_value_;
 	}
 
+	virtual std::string bake_key() const override {
+		return key_string("solid", {this->color_value_.x(), this->color_value_.y(), this->color_value_.z()});
+	}
+
 private:
 	color color_value_;
 };
@@ -86,8 +134,8 @@ public:
 		: even_(make_shared<solid_color_texture>(even)),
 		  odd_(make_shared<solid_color_texture>(odd)) {}
 
-	virtual color value(double u, double v, const point3& p) const override {
-		auto sin_pattern = sin(10*p.x()) * sin(10*p.y()) * sin(10*p.z());
+	virtual color value(Real u, Real v, const point3& p) const override {
+		auto sin_pattern = fast_sin(10*p.x()) * fast_sin(10*p.y()) * fast_sin(10*p.z());
 		if (sin_pattern < 0) {
 			return this->odd_->value(u, v, p);
 		}
@@ -96,6 +144,25 @@ public:
 		}
 	}
 
+	virtual color filtered_value(Real u, Real v, const point3& p, Real footprint) const override {
+		auto sin_pattern = fast_sin(10*p.x()) * fast_sin(10*p.y()) * fast_sin(10*p.z());
+		if (sin_pattern < 0) {
+			return this->odd_->filtered_value(u, v, p, footprint);
+		}
+		else {
+			return this->even_->filtered_value(u, v, p, footprint);
+		}
+	}
+
+	virtual std::string bake_key() const override {
+		std::string even = this->even_->bake_key();
+		std::string odd = this->odd_->bake_key();
+		if (even.empty() || odd.empty()) {
+			return "";
+		}
+		return "checker(" + even + "," + odd + ")";
+	}
+
 private:
 	shared_ptr<texture> even_, odd_;
 };
@@ -105,25 +172,66 @@ private:
 class noise_texture : public texture {
 public:
 	virtual ~noise_texture() = default;
-	noise_texture() {}
-	noise_texture(double sc) : scale_(sc) {}
+	noise_texture() : noise_(make_shared<perlin>()) {}
+	noise_texture(Real sc) : noise_(make_shared<perlin>()), scale_(sc) {}
+
+	/**
+	 * Constructs a noise texture that shares its Perlin tables with others.
+	 */
+	noise_texture(Real sc, shared_ptr<const perlin> noise) : noise_(noise), scale_(sc) {}
 
-	virtual color value(double u, double v, const point3& p) const override {
+	virtual color value(Real u, Real v, const point3& p) const override {
 		// Cast the Perlin values between 0 and 1
-		// return color(1, 1, 1) * 0.5 * (1.0 + this->noise_.noise(this->scale_ * p));
+		// return color(1, 1, 1) * 0.5 * (1.0 + this->noise_->noise(this->scale_ * p));
 
-		// return color(1, 1, 1) * this->noise_.turbulence(this->scale_ * p);
+		// return color(1, 1, 1) * this->noise_->turbulence(this->scale_ * p);
 
-		return color(1, 1, 1) * 0.5 * (1 + sin(this->scale_*p.z() + 50*this->noise_.turbulence(p)));
+		return color(1, 1, 1) * Real(0.5) * (1 + fast_sin(this->scale_*p.z() + 50*this->noise_->turbulence(p)));
+	}
+
+	virtual std::string bake_key() const override {
+		return key_string("marble", {this->scale_}) + "/seed" + std::to_string(this->noise_->seed());
 	}
 
 public:
-	perlin noise_;
-	double scale_;
+	shared_ptr<const perlin> noise_;
+	Real scale_;
 };
 
 
 //-----------------------------------------------------------------------------
+/**
+ * Picks the mip level for a lookup. The image is assumed to have square
+ * texels in uv space.
+ * @param footprint width of the lookup in uv units
+ * @param width, height size of the base level in texels
+ * @return the fractional level, 0 for the full resolution image
+ */
+inline Real mip_lod(Real footprint, int width, int height) {
+	Real texels = footprint * std::sqrt(Real(width) * Real(height));
+	return texels > 1 ? fast_log2(texels) : Real(0);
+}
+
+/**
+ * Blends a 2x2 block of packed texels.
+ * @param quad texels (i, j), (i+1, j), (i, j+1), (i+1, j+1)
+ * @param fx, fy position inside the block, in [0, 1]
+ */
+inline color bilinear_blend(const uint32_t quad[4], Real fx, Real fy) {
+	color top = (1 - fx) * tiled_image::unpack(quad[0]) + fx * tiled_image::unpack(quad[1]);
+	color bottom = (1 - fx) * tiled_image::unpack(quad[2]) + fx * tiled_image::unpack(quad[3]);
+	return (1 - fy) * top + fy * bottom;
+}
+
+
+//-----------------------------------------------------------------------------
+/**
+ * Class for textures loaded from image files.
+ * A mip pyramid is built at load time, and filtered lookups pick a level from the
+ * ray cone footprint and blend the two nearest levels (trilinear filtering).
+ * Every level is stored as a tiled_image, so nearby lookups share cache lines.
+ * The pyramid is immutable once built, so textures can share one.
+ */
 class image_texture : public texture {
 public:
 	const static int bytes_per_pixel_ = 3;
@@ -131,63 +239,135 @@ public:
 	/**
 	 * Constructs an empty image texture object.
 	 */
-	image_texture()
-		: data_(nullptr), width_(0), height_(0), bytes_per_scanline_(0) {}
+	image_texture() {}
 
 	/**
 	 * Constructs an image texture from a given image file.
 	 */
-	image_texture(const std::string& filename) {
+	image_texture(const std::string& filename) : levels_(load(filename)) {}
+
+	/**
+	 * Constructs an image texture over an already decoded mip pyramid.
+	 */
+	image_texture(shared_ptr<const mip_pyramid> levels) : levels_(levels) {}
+
+	/**
+	 * Decodes an image file and builds its mip pyramid.
+	 * @return the pyramid, or null if the file can't be loaded
+	 */
+	static shared_ptr<const mip_pyramid> load(const std::string& filename) {
 		auto channels = bytes_per_pixel_;
+		int width, height;
 
-		this->data_ =
-			stbi_load(filename.c_str(), &this->width_, &this->height_, &channels, 0);
+		unsigned char* data =
+			stbi_load(filename.c_str(), &width, &height, &channels, bytes_per_pixel_);
 
-		if (!this->data_) {
+		if (!data) {
 			std::cerr << "Error loading texture image file '" << filename << "'.\n";
-			this->width_ = this->height_ = 0;
+			return nullptr;
 		}
 
-		this->bytes_per_scanline_ = bytes_per_pixel_ * this->width_;
-	}
+		auto levels = make_shared<mip_pyramid>();
+		levels->push_back(tiled_image(data, width, height, bytes_per_pixel_));
+		stbi_image_free(data);
 
-	/**
-	 * Frees the image data array.
-	 */
-	virtual ~image_texture() {
-		stbi_image_free(this->data_);
+		build_mip_pyramid(*levels);
+		return levels;
 	}
 
 	/**
-	 * Gets the color value at a certain point in the image texture.
+	 * Gets the color value at a certain point in the image texture, using the
+	 * nearest texel of the full resolution image.
 	 */
-	virtual color value(double u, double v, const point3& p) const override {
+	virtual color value(Real u, Real v, const point3& p) const override {
 		// If the texture data is empty/broken, return cyan to help debug
-		if (this->data_ == nullptr) {
+		if (!this->levels_) {
 			return color(0, 1, 1);
 		}
 
+		const tiled_image& level = (*this->levels_)[0];
+
 		// Clamp input texcoords to [0, 1]
-		u = clamp(u, 0.0, 1.0);
-		v = 1.0 - clamp(v, 0.0, 1.0); // flip v, because image files are upside down
+		u = clamp(u, 0, 1);
+		v = 1 - clamp(v, 0, 1); // flip v, because image files are upside down
 
-		auto i = static_cast<int>(u * this->width_);
-		auto j = static_cast<int>(v * this->height_);
+		auto i = static_cast<int>(u * level.width());
+		auto j = static_cast<int>(v * level.height());
 
 		// Clamp integer mapping, since actual coordinates should be less than 1.0
-		if (i >= this->width_) i = this->width_ - 1;
-		if (j >= this->height_) j = this->height_ - 1;
+		if (i >= level.width()) i = level.width() - 1;
+		if (j >= level.height()) j = level.height() - 1;
 
-		const auto color_scale = 1.0/255.0;
-		auto pixel = this->data_ + j*this->bytes_per_scanline_ + i*this->bytes_per_pixel_;
+		return level.texel_color(i, j);
+	}
 
-		return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+	/**
+	 * Gets the color value at a certain point, filtered over the footprint.
+	 * @param footprint width of the lookup in uv units
+	 */
+	virtual color filtered_value(Real u, Real v, const point3& p, Real footprint) const override {
+		if (!this->levels_) {
+			return color(0, 1, 1);
+		}
+
+		u = clamp(u, 0, 1);
+		v = 1 - clamp(v, 0, 1);
+
+		const mip_pyramid& levels = *this->levels_;
+		Real lod = mip_lod(footprint, levels[0].width(), levels[0].height());
+		int max_level = static_cast<int>(levels.size()) - 1;
+		if (lod >= max_level) {
+			return bilinear(levels[max_level], u, v);
+		}
+
+		int l = static_cast<int>(lod);
+		Real t = lod - l;
+		color fine = bilinear(levels[l], u, v);
+		if (t <= 0) {
+			return fine;
+		}
+		return (1 - t) * fine + t * bilinear(levels[l + 1], u, v);
+	}
+
+	/**
+	 * @return the number of levels in the mip pyramid
+	 */
+	int mip_levels() const {
+		return this->levels_ ? static_cast<int>(this->levels_->size()) : 0;
 	}
 
 private:
-	unsigned char* data_;
-	int width_, height_;
-	int bytes_per_scanline_;
+	shared_ptr<const mip_pyramid> levels_;
+
+	/**
+	 * Bilinearly interpolates the four texels around (u, v) in one level,
+	 * clamping at the edges. v is already flipped to image row order.
+	 */
+	static color bilinear(const tiled_image& level, Real u, Real v) {
+		Real x = u * level.width() - Real(0.5);
+		Real y = v * level.height() - Real(0.5);
+		int i = static_cast<int>(std::floor(x));
+		int j = static_cast<int>(std::floor(y));
+		Real fx = x - i;
+		Real fy = y - j;
+
+		uint32_t quad[4];
+		if (i >= 0 && j >= 0 && i + 1 < level.width() && j + 1 < level.height()) {
+			level.texel_quad(i, j, quad);
+		}
+		else {
+			int i0 = std::min(std::max(i, 0), level.width() - 1);
+			int j0 = std::min(std::max(j, 0), level.height() - 1);
+			int i1 = std::min(i + 1, level.width() - 1);
+			int j1 = std::min(j + 1, level.height() - 1);
+			quad[0] = level.texel(i0, j0);
+			quad[1] = level.texel(i1, j0);
+			quad[2] = level.texel(i0, j1);
+			quad[3] = level.texel(i1, j1);
+		}
+
+		return bilinear_blend(quad, fx, fy);
+	}
 };
 
 
@@ -0,0 +1,304 @@
+/**
+ * @file texture_bake.h
+ * Bakes procedural textures into a sparse 3D grid of color samples, cached on
+ * disk, so that rendering them costs a grid lookup instead of the procedure.
+ *
+ * Only position-dependent procedurals are baked (see texture::bake_key()):
+ * every procedural texture here is a function of the hit point, not of (u, v),
+ * so a 2D UV bake would need a per-object parameterization they don't have.
+ *
+ * A baked texture file (.rtb) holds the bricks baked so far:
+ *  - header: the bytes "RTBK", version, key length, then the key itself
+ *  - bricks: brick index, then brick_samples packed RGBA8 samples
+ * Every number is a uint32 in host byte order.
+ */
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "aabb.h"
+#include "texture.h"
+#include "tiled_image.h"
+#include "vec3.h"
+
+using std::shared_ptr;
+
+const char baked_texture_magic[4] = {'R', 'T', 'B', 'K'};
+const uint32_t baked_texture_version = 1;
+
+// A brick covers 8^3 grid cells and stores the 9^3 samples at their corners,
+// so trilinear lookups never need a neighbouring brick
+const int brick_cells = 8;
+const int brick_side = brick_cells + 1;
+const int brick_samples = brick_side * brick_side * brick_side;
+
+
+//-----------------------------------------------------------------------------
+/**
+ * A procedural texture sampled on a regular grid over a bounding box.
+ *
+ * The grid is split into bricks that are baked the first time a lookup lands
+ * in them, so only bricks near surfaces that rays hit are ever computed or
+ * stored. Lookups interpolate the eight surrounding samples; points outside
+ * the box fall back to the source texture.
+ *
+ * Baked bricks are saved to a file named after the texture's bake key, grid
+ * bounds and spacing when the texture is destroyed, and loaded again by any
+ * later baked_texture with the same parameters.
+ */
+class baked_texture : public texture {
+public:
+	/**
+	 * Constructs a baked copy of a procedural texture, loading any bricks
+	 * already cached on disk.
+	 * @param bounds region to bake; should enclose the surfaces using the texture
+	 * @param spacing distance between grid samples
+	 * @param cache_dir directory for the cache file
+	 */
+	baked_texture(shared_ptr<texture> source, const aabb& bounds, Real spacing,
+				  const std::string& cache_dir = "data")
+		: source_(source), origin_(bounds.min()), spacing_(spacing), dirty_(false) {
+		vec3 extent = bounds.max() - bounds.min();
+		for (int a = 0; a < 3; ++a) {
+			this->bricks_per_axis_[a] =
+				std::max(1, static_cast<int>(std::ceil(extent[a] / (spacing * brick_cells))));
+			this->cells_per_axis_[a] = this->bricks_per_axis_[a] * brick_cells;
+		}
+		this->brick_count_ = static_cast<size_t>(this->bricks_per_axis_[0])
+						   * this->bricks_per_axis_[1] * this->bricks_per_axis_[2];
+		this->bricks_.reset(new std::atomic<uint32_t*>[this->brick_count_]());
+
+		std::string source_key = source->bake_key();
+		if (!source_key.empty()) {
+			std::ostringstream key;
+			key << source_key << "@" << std::setprecision(9)
+				<< origin_.x() << "," << origin_.y() << "," << origin_.z() << "/"
+				<< spacing << "/" << bricks_per_axis_[0] << "x" << bricks_per_axis_[1] << "x" << bricks_per_axis_[2];
+			this->key_ = key.str();
+			this->path_ = cache_dir + "/baked_" + hex_hash(this->key_) + ".rtb";
+			load();
+		}
+	}
+
+	baked_texture(const baked_texture&) = delete;
+	baked_texture& operator=(const baked_texture&) = delete;
+
+	/**
+	 * Saves newly baked bricks, then frees the grid.
+	 */
+	virtual ~baked_texture() {
+		if (this->dirty_) {
+			save();
+		}
+		for (size_t b = 0; b < this->brick_count_; ++b) {
+			delete[] this->bricks_[b].load();
+		}
+	}
+
+	virtual color value(Real u, Real v, const point3& p) const override {
+		vec3 g = (p - this->origin_) / this->spacing_;
+		int cell[3];
+		Real f[3];
+		for (int a = 0; a < 3; ++a) {
+			Real x = g[a];
+			cell[a] = static_cast<int>(x);
+			cell[a] -= (x < cell[a]);
+			if (cell[a] < 0 || cell[a] >= this->cells_per_axis_[a]) {
+				return this->source_->value(u, v, p);
+			}
+			f[a] = x - cell[a];
+		}
+
+		int bx = cell[0] / brick_cells, by = cell[1] / brick_cells, bz = cell[2] / brick_cells;
+		const uint32_t* samples = brick(bx, by, bz);
+		int base = sample_index(cell[0] - bx * brick_cells, cell[1] - by * brick_cells,
+								cell[2] - bz * brick_cells);
+
+		// Trilinear interpolation of the cell's corners
+		const int dy = brick_side, dz = brick_side * brick_side;
+		color c00 = lerp(samples[base], samples[base + 1], f[0]);
+		color c10 = lerp(samples[base + dy], samples[base + dy + 1], f[0]);
+		color c01 = lerp(samples[base + dz], samples[base + dz + 1], f[0]);
+		color c11 = lerp(samples[base + dy + dz], samples[base + dy + dz + 1], f[0]);
+		color c0 = (1 - f[1]) * c00 + f[1] * c10;
+		color c1 = (1 - f[1]) * c01 + f[1] * c11;
+		return (1 - f[2]) * c0 + f[2] * c1;
+	}
+
+	/**
+	 * Baked textures are already band-limited by their grid, so the footprint
+	 * doesn't change the lookup.
+	 */
+	virtual color filtered_value(Real u, Real v, const point3& p, Real footprint) const override {
+		return value(u, v, p);
+	}
+
+	virtual std::string bake_key() const override {
+		return this->source_->bake_key();
+	}
+
+	/**
+	 * @return how many bricks have been baked or loaded so far
+	 */
+	size_t resident_bricks() const {
+		size_t count = 0;
+		for (size_t b = 0; b < this->brick_count_; ++b) {
+			count += this->bricks_[b].load() != nullptr;
+		}
+		return count;
+	}
+
+	/**
+	 * Writes every resident brick to the cache file.
+	 * @return true if the file was written
+	 */
+	bool save() const {
+		if (this->path_.empty()) {
+			return false;
+		}
+
+		std::ofstream out(this->path_, std::ios::binary);
+		uint32_t header[2] = {baked_texture_version, static_cast<uint32_t>(this->key_.size())};
+		out.write(baked_texture_magic, sizeof(baked_texture_magic));
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(this->key_.data(), this->key_.size());
+		for (size_t b = 0; b < this->brick_count_; ++b) {
+			const uint32_t* samples = this->bricks_[b].load();
+			if (samples) {
+				uint32_t index = static_cast<uint32_t>(b);
+				out.write(reinterpret_cast<const char*>(&index), sizeof(index));
+				out.write(reinterpret_cast<const char*>(samples), brick_samples * sizeof(uint32_t));
+			}
+		}
+
+		if (!out) {
+			std::cerr << "Error writing baked texture file '" << this->path_ << "'.\n";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	shared_ptr<texture> source_;
+	point3 origin_;
+	Real spacing_;
+	int bricks_per_axis_[3];
+	int cells_per_axis_[3];
+	size_t brick_count_;
+	std::unique_ptr<std::atomic<uint32_t*>[]> bricks_;
+	std::string key_;
+	std::string path_;
+
+	// Serializes baking, so each brick is only baked once
+	mutable std::mutex bake_mutex_;
+	mutable bool dirty_;
+
+	static int sample_index(int x, int y, int z) {
+		return (z * brick_side + y) * brick_side + x;
+	}
+
+	/**
+	 * Gets a brick's samples, baking the brick if it isn't resident.
+	 */
+	const uint32_t* brick(int bx, int by, int bz) const {
+		size_t b = (static_cast<size_t>(bz) * this->bricks_per_axis_[1] + by) * this->bricks_per_axis_[0] + bx;
+		const uint32_t* samples = this->bricks_[b].load(std::memory_order_acquire);
+		if (samples) {
+			return samples;
+		}
+
+		std::lock_guard<std::mutex> lock(this->bake_mutex_);
+		uint32_t* baked = this->bricks_[b].load(std::memory_order_acquire);
+		if (baked) {
+			return baked;
+		}
+
+		baked = new uint32_t[brick_samples];
+		for (int z = 0; z < brick_side; ++z) {
+			for (int y = 0; y < brick_side; ++y) {
+				for (int x = 0; x < brick_side; ++x) {
+					point3 p = this->origin_ + this->spacing_ * vec3(Real(bx * brick_cells + x),
+																	 Real(by * brick_cells + y),
+																	 Real(bz * brick_cells + z));
+					baked[sample_index(x, y, z)] = pack(this->source_->value(0, 0, p));
+				}
+			}
+		}
+		this->bricks_[b].store(baked, std::memory_order_release);
+		this->dirty_ = true;
+		return baked;
+	}
+
+	/**
+	 * Reads the bricks in the cache file, if there is one for this key.
+	 */
+	void load() {
+		std::ifstream in(this->path_, std::ios::binary);
+		if (!in) {
+			return;
+		}
+
+		char magic[4] = {0, 0, 0, 0};
+		uint32_t header[2] = {0, 0};
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(header), sizeof(header));
+		std::string key(header[1] <= 4096 ? header[1] : 0, '\0');
+		in.read(&key[0], key.size());
+		if (!in || !std::equal(magic, magic + 4, baked_texture_magic)
+			|| header[0] != baked_texture_version || key != this->key_) {
+			std::cerr << "Ignoring stale baked texture file '" << this->path_ << "'.\n";
+			return;
+		}
+
+		uint32_t index;
+		while (in.read(reinterpret_cast<char*>(&index), sizeof(index)) && index < this->brick_count_) {
+			uint32_t* samples = new uint32_t[brick_samples];
+			if (!in.read(reinterpret_cast<char*>(samples), brick_samples * sizeof(uint32_t))) {
+				delete[] samples;
+				break;
+			}
+			delete[] this->bricks_[index].exchange(samples);
+		}
+	}
+
+	static uint32_t pack(const color& c) {
+		uint32_t texel = 0xFF000000;
+		for (int i = 0; i < 3; ++i) {
+			Real x = clamp(c[i], 0, 1);
+			texel |= static_cast<uint32_t>(x * 255 + Real(0.5)) << (8 * i);
+		}
+		return texel;
+	}
+
+	static color lerp(uint32_t a, uint32_t b, Real t) {
+		return (1 - t) * tiled_image::unpack(a) + t * tiled_image::unpack(b);
+	}
+
+	/**
+	 * Names a cache file after a key (64-bit FNV-1a, in hex).
+	 */
+	static std::string hex_hash(const std::string& key) {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (unsigned char c : key) {
+			hash = (hash ^ c) * 0x100000001B3ull;
+		}
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+		return name;
+	}
+};
+
+
+#endif
@@ -0,0 +1,688 @@
+/**
+ * @file texture_cache.h
+ * Out-of-core image textures: a tiled texture file format, a page cache with a
+ * memory budget, and a texture that pages its texels in on demand.
+ *
+ * A tiled texture file (.rtt) holds a whole mip pyramid cut into pages:
+ *  - header: the bytes "RTTX", then version, page size, number of levels, and
+ *            the size and modification time of the source image (each the low
+ *            32 bits, then the high 32 bits), to tell when it has changed
+ *  - levels: width and height of each level
+ *  - pages:  each level's pages row by row, each one a page_size x page_size
+ *            tiled_image (4x4 tiles of RGBA8), padded with black past the edges
+ * Every number is a uint32 in host byte order.
+ */
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+#include "texture.h"
+#include "tiled_image.h"
+#include "utils.h"
+#include "vec3.h"
+#include "stb_image/stb_image_include.h"
+
+using std::shared_ptr;
+using std::make_shared;
+
+const char tiled_texture_magic[4] = {'R', 'T', 'T', 'X'};
+const uint32_t tiled_texture_version = 2;
+const int tiled_texture_header_words = 7;
+
+// Texels per side of a page: 32x32 RGBA8 is 4 KB, one OS page
+const int texture_page_size = 32;
+const size_t texture_page_bytes = texture_page_size * texture_page_size * sizeof(uint32_t);
+
+
+/**
+ * Gets the size and modification time of a source image, as stored in the
+ * header of the tiled texture file made from it.
+ * @param stamp set to the size's low and high words, then the time's
+ * @return false if the image can't be found
+ */
+inline bool source_image_stamp(const std::string& image_path, uint32_t stamp[4]) {
+	struct stat info;
+	if (stat(image_path.c_str(), &info) != 0) {
+		return false;
+	}
+	uint64_t size = static_cast<uint64_t>(info.st_size);
+	uint64_t time = static_cast<uint64_t>(info.st_mtime);
+	stamp[0] = static_cast<uint32_t>(size);
+	stamp[1] = static_cast<uint32_t>(size >> 32);
+	stamp[2] = static_cast<uint32_t>(time);
+	stamp[3] = static_cast<uint32_t>(time >> 32);
+	return true;
+}
+
+/**
+ * Checks whether a tiled texture file was made from the current version of
+ * its source image. If the image can't be found, any readable file of this
+ * version will do.
+ */
+inline bool tiled_texture_is_current(const std::string& image_path, const std::string& tiled_path) {
+	std::ifstream in(tiled_path, std::ios::binary);
+	char magic[4] = {0, 0, 0, 0};
+	uint32_t header[tiled_texture_header_words] = {};
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!in || !std::equal(magic, magic + 4, tiled_texture_magic) || header[0] != tiled_texture_version) {
+		return false;
+	}
+	uint32_t stamp[4];
+	return !source_image_stamp(image_path, stamp) || std::equal(stamp, stamp + 4, header + 3);
+}
+
+/**
+ * Converts an image file into a tiled texture file, building its mip pyramid.
+ * A file that can't be written completely is removed.
+ * @return true if the file was written
+ */
+inline bool write_tiled_texture(const std::string& image_path, const std::string& tiled_path) {
+	uint32_t stamp[4];
+	if (!source_image_stamp(image_path, stamp)) {
+		std::cerr << "Error finding texture image file '" << image_path << "'.\n";
+		return false;
+	}
+	int width, height, channels;
+	unsigned char* data = stbi_load(image_path.c_str(), &width, &height, &channels, 3);
+	if (!data) {
+		std::cerr << "Error loading texture image file '" << image_path << "'.\n";
+		return false;
+	}
+
+	mip_pyramid levels;
+	levels.push_back(tiled_image(data, width, height, 3));
+	stbi_image_free(data);
+	build_mip_pyramid(levels);
+
+	std::ofstream out(tiled_path, std::ios::binary);
+	if (!out) {
+		std::cerr << "Error creating tiled texture file '" << tiled_path << "'.\n";
+		return false;
+	}
+	uint32_t header[tiled_texture_header_words] = {tiled_texture_version, texture_page_size,
+												   static_cast<uint32_t>(levels.size()),
+												   stamp[0], stamp[1], stamp[2], stamp[3]};
+	out.write(tiled_texture_magic, sizeof(tiled_texture_magic));
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (const tiled_image& level : levels) {
+		uint32_t size[2] = {static_cast<uint32_t>(level.width()), static_cast<uint32_t>(level.height())};
+		out.write(reinterpret_cast<const char*>(size), sizeof(size));
+	}
+
+	for (const tiled_image& level : levels) {
+		for (int py = 0; py * texture_page_size < level.height(); ++py) {
+			for (int px = 0; px * texture_page_size < level.width(); ++px) {
+				tiled_image page(texture_page_size, texture_page_size);
+				int i_end = std::min(texture_page_size, level.width() - px * texture_page_size);
+				int j_end = std::min(texture_page_size, level.height() - py * texture_page_size);
+				for (int j = 0; j < j_end; ++j) {
+					for (int i = 0; i < i_end; ++i) {
+						page.data()[page.address(i, j)] =
+							level.texel(px * texture_page_size + i, py * texture_page_size + j);
+					}
+				}
+				out.write(reinterpret_cast<const char*>(page.data()), texture_page_bytes);
+			}
+		}
+	}
+
+	out.close();
+	if (!out) {
+		std::cerr << "Error writing tiled texture file '" << tiled_path << "'.\n";
+		std::remove(tiled_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+/**
+ * Counters reported by texture_cache::stats().
+ */
+struct texture_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t resident_bytes;
+	size_t budget_bytes;
+
+	/**
+	 * @return the fraction of page lookups served from memory
+	 */
+	double hit_rate() const {
+		uint64_t lookups = hits + misses;
+		return lookups > 0 ? static_cast<double>(hits) / lookups : 0.0;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+/**
+ * Keeps the recently used pages of any number of tiled texture files in memory.
+ *
+ * Pages are loaded on first use. Once the resident pages exceed the memory
+ * budget they are evicted in clock order, with a second chance for pages
+ * used since the clock hand last passed them. The cache is split into shards
+ * by page, each with its own lock and clock, and a shard's lock is never held
+ * while reading from disk.
+ *
+ * Most lookups never reach a shard: each thread keeps handles to the last
+ * few pages it used, and a lookup that finds its page there only marks the
+ * page used and counts a hit, without locks or writes to shared counters.
+ * A handle keeps its page alive even if it is evicted meanwhile, so a thread
+ * may go on reading an evicted page until its handle is reused; pages never
+ * change, so what it reads is still right.
+ *
+ * Files may be opened while other threads look pages up. A file is opened
+ * once per path: opening it again gives the same id, unless the file has been
+ * rewritten from a changed image, when it gets a new id and the old one's
+ * pages can no longer be read.
+ */
+class texture_cache {
+public:
+	/**
+	 * Creates an empty cache.
+	 * @param budget_bytes most memory that resident pages may use
+	 */
+	explicit texture_cache(size_t budget_bytes)
+		: id_(next_id()), files_(max_files), file_count_(0), budget_bytes_(budget_bytes), misses_(0), evictions_(0),
+		  resident_bytes_(0) {}
+
+	/**
+	 * Opens a tiled texture file and reads its header. No pages are loaded.
+	 * @return an id for the file, or -1 if it can't be read
+	 */
+	int open(const std::string& tiled_path) {
+		std::lock_guard<std::mutex> lock(files_mutex_);
+		std::unique_ptr<tiled_file> file(new tiled_file());
+		file->stream.open(tiled_path, std::ios::binary);
+
+		char magic[4] = {0, 0, 0, 0};
+		uint32_t header[tiled_texture_header_words] = {};
+		file->stream.read(magic, sizeof(magic));
+		file->stream.read(reinterpret_cast<char*>(header), sizeof(header));
+		if (!file->stream || !std::equal(magic, magic + 4, tiled_texture_magic)
+			|| header[0] != tiled_texture_version || header[1] != texture_page_size) {
+			std::cerr << "Error opening tiled texture file '" << tiled_path << "'.\n";
+			return -1;
+		}
+
+		std::copy(header + 3, header + 7, file->stamp);
+
+		auto opened = paths_.find(tiled_path);
+		if (opened != paths_.end()
+			&& std::equal(file->stamp, file->stamp + 4, files_[opened->second]->stamp)) {
+			return opened->second;
+		}
+		if (file_count_ == max_files) {
+			std::cerr << "Error opening tiled texture file '" << tiled_path << "': too many files.\n";
+			return -1;
+		}
+
+		std::streamoff offset = sizeof(magic) + sizeof(header) + header[2] * 2 * sizeof(uint32_t);
+		for (uint32_t l = 0; l < header[2]; ++l) {
+			uint32_t size[2];
+			file->stream.read(reinterpret_cast<char*>(size), sizeof(size));
+			level_info level;
+			level.width = static_cast<int>(size[0]);
+			level.height = static_cast<int>(size[1]);
+			level.pages_x = (level.width + texture_page_size - 1) / texture_page_size;
+			level.pages_y = (level.height + texture_page_size - 1) / texture_page_size;
+			level.offset = offset;
+			offset += static_cast<std::streamoff>(level.pages_x) * level.pages_y * texture_page_bytes;
+			file->levels.push_back(level);
+		}
+		if (!file->stream || file->levels.empty()) {
+			std::cerr << "Error opening tiled texture file '" << tiled_path << "'.\n";
+			return -1;
+		}
+
+		if (opened != paths_.end()) {
+			// Its pages were overwritten by the new file, so stop reading them
+			tiled_file& stale = *files_[opened->second];
+			std::lock_guard<std::mutex> stale_lock(stale.mutex);
+			stale.stream.close();
+		}
+		int id = file_count_++;
+		files_[id] = std::move(file);
+		paths_[tiled_path] = id;
+		return id;
+	}
+
+	int levels(int file) const {
+		return static_cast<int>(files_[file]->levels.size());
+	}
+
+	int level_width(int file, int level) const {
+		return files_[file]->levels[level].width;
+	}
+
+	int level_height(int file, int level) const {
+		return files_[file]->levels[level].height;
+	}
+
+	/**
+	 * Gets a page, loading it from disk if it isn't resident.
+	 * @param px, py which page of the level, in pages
+	 * @return the page's texels, or null if it couldn't be read. They stay
+	 *         valid until the calling thread's next lookup in this cache.
+	 */
+	const tiled_image* page(int file, int level, int px, int py) {
+		uint64_t key = page_key(file, level, px, py);
+		thread_state& local = this->local();
+		page_handle& handle = local.handles[handle_index(key)];
+		bool resident = true;
+		if (handle.key != key) {
+			handle.entry = shared_page(key, file, level, px, py, resident);
+			handle.key = handle.entry ? key : no_page;
+			if (!handle.entry) {
+				return nullptr;
+			}
+		} else if (!handle.entry->referenced.load(std::memory_order_relaxed)) {
+			// Only write the flag when it changes, so hot pages' lines stay shared
+			handle.entry->referenced.store(true, std::memory_order_relaxed);
+		}
+		if (resident) {
+			// Only this thread writes its count, so it needs no atomic increment
+			local.hits.store(local.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		return &handle.entry->texels;
+	}
+
+	texture_cache_stats stats() const {
+		texture_cache_stats s;
+		s.hits = 0;
+		{
+			std::lock_guard<std::mutex> lock(threads_mutex_);
+			for (const auto& state : threads_) {
+				s.hits += state->hits.load(std::memory_order_relaxed);
+			}
+		}
+		s.misses = misses_;
+		s.evictions = evictions_;
+		s.resident_bytes = resident_bytes_;
+		s.budget_bytes = budget_bytes_;
+		return s;
+	}
+
+private:
+	static const int num_shards = 16;
+	static const int num_handles = 8;
+	static const int max_files = 4096;
+	static const uint64_t no_page = ~0ull;
+
+	struct level_info {
+		int width, height;
+		int pages_x, pages_y;
+		std::streamoff offset;
+	};
+
+	struct tiled_file {
+		std::ifstream stream;
+		std::mutex mutex;
+		std::vector<level_info> levels;
+		// The source image's size and time, from the header
+		uint32_t stamp[4];
+	};
+
+	/**
+	 * A resident page, with the flag that gives it a second chance.
+	 */
+	struct cached_page {
+		tiled_image texels;
+		std::atomic<bool> referenced;
+
+		cached_page() : texels(texture_page_size, texture_page_size), referenced(true) {}
+	};
+
+	struct cache_shard {
+		std::mutex mutex;
+		// The clock: pages in the order they were loaded, and the next to consider evicting
+		std::vector<std::pair<uint64_t, shared_ptr<cached_page>>> ring;
+		size_t hand = 0;
+		std::unordered_map<uint64_t, size_t> index;
+		size_t resident_bytes = 0;
+	};
+
+	struct page_handle {
+		uint64_t key;
+		shared_ptr<cached_page> entry;
+	};
+
+	/**
+	 * A thread's handles into one cache, and its count of hits. The cache
+	 * owns them, so stats() can add up the hits of every thread.
+	 */
+	struct thread_state {
+		page_handle handles[num_handles];
+		std::atomic<uint64_t> hits;
+
+		thread_state() : hits(0) {
+			for (page_handle& handle : handles) {
+				handle.key = no_page;
+			}
+		}
+	};
+
+	// Tells caches apart in threads' handles, even one made where another was freed
+	uint64_t id_;
+	// Slots are filled once and never move, so lookups read them without the lock
+	std::vector<std::unique_ptr<tiled_file>> files_;
+	int file_count_;
+	std::unordered_map<std::string, int> paths_;
+	std::mutex files_mutex_;
+	cache_shard shards_[num_shards];
+	size_t budget_bytes_;
+	std::atomic<uint64_t> misses_, evictions_;
+	std::atomic<size_t> resident_bytes_;
+	mutable std::mutex threads_mutex_;
+	std::vector<shared_ptr<thread_state>> threads_;
+
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> count(0);
+		return count++;
+	}
+
+	static uint64_t page_key(int file, int level, int px, int py) {
+		return (static_cast<uint64_t>(file) << 48) | (static_cast<uint64_t>(level) << 40)
+			 | (static_cast<uint64_t>(py) << 20) | static_cast<uint64_t>(px);
+	}
+
+	/**
+	 * Spreads neighbouring pages over different shards.
+	 */
+	static int shard_index(uint64_t key) {
+		return static_cast<int>((key * 0x9E3779B97F4A7C15ull) >> 60) % num_shards;
+	}
+
+	/**
+	 * Spreads neighbouring pages over different handles.
+	 */
+	static int handle_index(uint64_t key) {
+		return static_cast<int>((key * 0x9E3779B97F4A7C15ull) >> 61) % num_handles;
+	}
+
+	/**
+	 * A thread's link to its state in one cache. Only the cache owns the
+	 * state, so a cache's pages are freed with it rather than pinned by the
+	 * handles of every thread that used it.
+	 */
+	struct local_state {
+		uint64_t id;
+		// Valid while the cache is, and so for any lookup in it
+		thread_state* state;
+		std::weak_ptr<thread_state> owner;
+	};
+
+	/**
+	 * @return the calling thread's state for this cache, made on its first
+	 *         lookup, when the links to destroyed caches' states are dropped
+	 */
+	thread_state& local() {
+		thread_local std::vector<local_state> states;
+		for (const local_state& state : states) {
+			if (state.id == id_) {
+				return *state.state;
+			}
+		}
+		states.erase(std::remove_if(states.begin(), states.end(),
+									[](const local_state& state) { return state.owner.expired(); }),
+					 states.end());
+		auto state = make_shared<thread_state>();
+		{
+			std::lock_guard<std::mutex> lock(threads_mutex_);
+			threads_.push_back(state);
+		}
+		states.push_back(local_state{id_, state.get(), state});
+		return *state;
+	}
+
+	/**
+	 * Finds a page in its shard, loading it if it isn't resident.
+	 * @param resident set to whether the page was resident
+	 */
+	shared_ptr<cached_page> shared_page(uint64_t key, int file, int level, int px, int py, bool& resident) {
+		cache_shard& shard = shards_[shard_index(key)];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto found = shard.index.find(key);
+			if (found != shard.index.end()) {
+				shared_ptr<cached_page>& entry = shard.ring[found->second].second;
+				entry->referenced.store(true, std::memory_order_relaxed);
+				return entry;
+			}
+		}
+
+		resident = false;
+		++misses_;
+		shared_ptr<cached_page> loaded = read_page(file, level, px, py);
+		if (!loaded) {
+			return loaded;
+		}
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto found = shard.index.find(key);
+		if (found != shard.index.end()) {
+			// Another thread loaded the same page while this one was reading it
+			return shard.ring[found->second].second;
+		}
+
+		// Each shard gets an equal part of the budget, but always room for one page
+		size_t shard_budget = std::max(budget_bytes_ / num_shards, texture_page_bytes);
+		if (shard.resident_bytes + texture_page_bytes <= shard_budget) {
+			shard.index[key] = shard.ring.size();
+			shard.ring.emplace_back(key, loaded);
+			shard.resident_bytes += texture_page_bytes;
+			resident_bytes_ += texture_page_bytes;
+			return loaded;
+		}
+
+		// Sweep the hand past pages used since it last came by, clearing
+		// their flags, and replace the first one that wasn't
+		while (true) {
+			auto& slot = shard.ring[shard.hand];
+			if (!slot.second->referenced.exchange(false, std::memory_order_relaxed)) {
+				break;
+			}
+			shard.hand = (shard.hand + 1) % shard.ring.size();
+		}
+		auto& slot = shard.ring[shard.hand];
+		shard.index.erase(slot.first);
+		slot = std::make_pair(key, loaded);
+		shard.index[key] = shard.hand;
+		shard.hand = (shard.hand + 1) % shard.ring.size();
+		++evictions_;
+		return loaded;
+	}
+
+	/**
+	 * Reads one page from its file. Reads from the same file are serialized.
+	 */
+	shared_ptr<cached_page> read_page(int file, int level, int px, int py) {
+		tiled_file& f = *files_[file];
+		const level_info& info = f.levels[level];
+		auto page = make_shared<cached_page>();
+		std::streamoff offset = info.offset
+			+ (static_cast<std::streamoff>(py) * info.pages_x + px) * texture_page_bytes;
+
+		std::lock_guard<std::mutex> lock(f.mutex);
+		if (!f.stream.is_open()) {
+			return nullptr;
+		}
+		f.stream.seekg(offset);
+		f.stream.read(reinterpret_cast<char*>(page->texels.data()), texture_page_bytes);
+		if (!f.stream) {
+			std::cerr << "Error reading texture page " << px << ", " << py
+					  << " of level " << level << ".\n";
+			f.stream.clear();
+			return nullptr;
+		}
+		return page;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+/**
+ * Class for image textures paged in from a tiled texture file through a
+ * texture_cache. Looks like an image_texture, but only the pages that rays
+ * actually touch are ever read into memory.
+ */
+class cached_texture : public texture {
+public:
+	/**
+	 * Opens a tiled texture file in the given cache.
+	 */
+	cached_texture(shared_ptr<texture_cache> cache, const std::string& tiled_path)
+		: cache_(cache), file_(cache->open(tiled_path)) {}
+
+	/**
+	 * Gets the color value at a certain point in the image texture, using the
+	 * nearest texel of the full resolution image.
+	 */
+	virtual color value(Real u, Real v, const point3& p) const override {
+		// If the texture data is missing, return cyan to help debug
+		if (this->file_ < 0) {
+			return color(0, 1, 1);
+		}
+
+		int width = this->cache_->level_width(this->file_, 0);
+		int height = this->cache_->level_height(this->file_, 0);
+		u = clamp(u, 0, 1);
+		v = 1 - clamp(v, 0, 1); // flip v, because image files are upside down
+		int i = std::min(static_cast<int>(u * width), width - 1);
+		int j = std::min(static_cast<int>(v * height), height - 1);
+		return tiled_image::unpack(texel(0, i, j));
+	}
+
+	/**
+	 * Gets the color value at a certain point, filtered over the footprint.
+	 * @param footprint width of the lookup in uv units
+	 */
+	virtual color filtered_value(Real u, Real v, const point3& p, Real footprint) const override {
+		if (this->file_ < 0) {
+			return color(0, 1, 1);
+		}
+
+		u = clamp(u, 0, 1);
+		v = 1 - clamp(v, 0, 1);
+
+		Real lod = mip_lod(footprint, this->cache_->level_width(this->file_, 0),
+						   this->cache_->level_height(this->file_, 0));
+		int max_level = this->cache_->levels(this->file_) - 1;
+		if (lod >= max_level) {
+			return bilinear(max_level, u, v);
+		}
+
+		int l = static_cast<int>(lod);
+		Real t = lod - l;
+		color fine = bilinear(l, u, v);
+		if (t <= 0) {
+			return fine;
+		}
+		return (1 - t) * fine + t * bilinear(l + 1, u, v);
+	}
+
+private:
+	shared_ptr<texture_cache> cache_;
+	int file_;
+
+	// Shown for texels whose page couldn't be read: cyan, like a missing texture
+	static const uint32_t missing_texel = 0xFFFFFF00;
+
+	uint32_t texel(int level, int i, int j) const {
+		const tiled_image* page = this->cache_->page(this->file_, level, i / texture_page_size, j / texture_page_size);
+		return page ? page->texel(i % texture_page_size, j % texture_page_size) : missing_texel;
+	}
+
+	/**
+	 * Bilinearly interpolates the four texels around (u, v) in one level,
+	 * clamping at the edges. Looks the page up once when all four texels are
+	 * on it, which is the common case.
+	 */
+	color bilinear(int level, Real u, Real v) const {
+		int width = this->cache_->level_width(this->file_, level);
+		int height = this->cache_->level_height(this->file_, level);
+		Real x = u * width - Real(0.5);
+		Real y = v * height - Real(0.5);
+		int i = static_cast<int>(std::floor(x));
+		int j = static_cast<int>(std::floor(y));
+		Real fx = x - i;
+		Real fy = y - j;
+
+		uint32_t quad[4];
+		int pi = i % texture_page_size;
+		int pj = j % texture_page_size;
+		if (i >= 0 && j >= 0 && i + 1 < width && j + 1 < height
+			&& pi + 1 < texture_page_size && pj + 1 < texture_page_size) {
+			const tiled_image* page = this->cache_->page(this->file_, level, i / texture_page_size,
+														 j / texture_page_size);
+			if (page) {
+				page->texel_quad(pi, pj, quad);
+			}
+			else {
+				quad[0] = quad[1] = quad[2] = quad[3] = missing_texel;
+			}
+		}
+		else {
+			int i0 = std::min(std::max(i, 0), width - 1);
+			int j0 = std::min(std::max(j, 0), height - 1);
+			int i1 = std::min(i + 1, width - 1);
+			int j1 = std::min(j + 1, height - 1);
+			quad[0] = texel(level, i0, j0);
+			quad[1] = texel(level, i1, j0);
+			quad[2] = texel(level, i0, j1);
+			quad[3] = texel(level, i1, j1);
+		}
+
+		return bilinear_blend(quad, fx, fy);
+	}
+};
+
+
+/**
+ * The cache shared by the textures of the preset scenes.
+ */
+inline shared_ptr<texture_cache> default_texture_cache() {
+	const size_t default_budget_bytes = 64 * 1024 * 1024;
+	static shared_ptr<texture_cache> cache = make_shared<texture_cache>(default_budget_bytes);
+	return cache;
+}
+
+/**
+ * Makes a paged texture for an image file, converting the image to a tiled
+ * texture file next to it (image path + ".rtt") the first time, and again
+ * whenever the image changes.
+ */
+inline shared_ptr<texture> load_cached_texture(const std::string& image_path,
+											   shared_ptr<texture_cache> cache = default_texture_cache()) {
+	std::string tiled_path = image_path + ".rtt";
+	if (!tiled_texture_is_current(image_path, tiled_path)) {
+		if (std::ifstream(tiled_path)) {
+			std::cerr << "Replacing stale tiled texture file '" << tiled_path << "'.\n";
+		}
+		if (!write_tiled_texture(image_path, tiled_path)) {
+			std::cerr << "Error converting texture image file '" << image_path
+					  << "'; it will render cyan.\n";
+		}
+	}
+	return make_shared<cached_texture>(cache, tiled_path);
+}
+
+
+#endif
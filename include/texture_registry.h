@@ -0,0 +1,162 @@
+/**
+ * @file texture_registry.h
+ * Interns textures so that materials asking for the same texture share one.
+ */
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+#include "aabb.h"
+#include "perlin.h"
+#include "texture.h"
+#include "texture_bake.h"
+#include "texture_cache.h"
+#include "vec3.h"
+
+using std::shared_ptr;
+using std::weak_ptr;
+using std::make_shared;
+
+// Seed for the Perlin tables shared by the registry's noise textures
+const uint32_t default_noise_seed = 419;
+
+/**
+ * A scene-level registry of textures, keyed by file path or by parameters.
+ *
+ * Asking twice for the same image, noise scale or solid color returns the same
+ * texture, so an image is decoded once, every noise texture shares one set of
+ * Perlin tables, and identical solid colors are folded into one object.
+ * The registry only holds weak references: a texture is freed once no
+ * material uses it, and is rebuilt if asked for again after that.
+ *
+ * Noise textures use a fixed seed, so scenes look the same on every run and
+ * their baked copies can be reused from the disk cache.
+ */
+class texture_registry {
+public:
+	texture_registry() : baking_(false) {}
+
+	/**
+	 * Turns baking of procedural textures on or off for later calls to baked().
+	 */
+	void set_baking(bool enabled) {
+		this->baking_ = enabled;
+	}
+
+	/**
+	 * Gets a texture of a single color.
+	 */
+	shared_ptr<texture> solid(const color& c) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		color_key key(c.x(), c.y(), c.z());
+		return intern(this->solids_, key, [&] { return make_shared<solid_color_texture>(c); });
+	}
+
+	/**
+	 * Gets a texture that alternates between two solid colors.
+	 */
+	shared_ptr<texture> checker(const color& even, const color& odd) {
+		auto even_texture = solid(even);
+		auto odd_texture = solid(odd);
+
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		std::pair<const texture*, const texture*> key(even_texture.get(), odd_texture.get());
+		return intern(this->checkers_, key, [&] {
+			return make_shared<checker_texture>(even_texture, odd_texture);
+		});
+	}
+
+	/**
+	 * Gets an image texture, decoding the file the first time it is asked for.
+	 */
+	shared_ptr<texture> image(const std::string& path) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		return intern(this->images_, path, [&] { return make_shared<image_texture>(path); });
+	}
+
+	/**
+	 * Gets an image texture paged in through the default texture cache.
+	 */
+	shared_ptr<texture> cached_image(const std::string& path) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		return intern(this->cached_images_, path, [&] { return load_cached_texture(path); });
+	}
+
+	/**
+	 * Gets a marble-like noise texture with the given scale.
+	 */
+	shared_ptr<texture> noise(Real scale) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		auto noise = this->perlin_.lock();
+		if (!noise) {
+			noise = make_shared<perlin>(default_noise_seed);
+			this->perlin_ = noise;
+		}
+		return intern(this->noises_, scale, [&] { return make_shared<noise_texture>(scale, noise); });
+	}
+
+	/**
+	 * Gets a baked copy of a procedural texture (see baked_texture), or the
+	 * texture itself if baking is off or the texture can't be baked.
+	 * @param bounds region to bake; should enclose the surfaces using the texture
+	 * @param spacing distance between grid samples
+	 */
+	shared_ptr<texture> baked(shared_ptr<texture> source, const aabb& bounds, Real spacing) {
+		if (!this->baking_ || source->bake_key().empty()) {
+			return source;
+		}
+
+		std::ostringstream key;
+		key << source.get() << std::setprecision(9) << "@" << bounds.min() << "/" << bounds.max() << "/" << spacing;
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		return intern(this->baked_, key.str(), [&] {
+			return make_shared<baked_texture>(source, bounds, spacing);
+		});
+	}
+
+private:
+	typedef std::tuple<Real, Real, Real> color_key;
+
+	std::mutex mutex_;
+	std::map<color_key, weak_ptr<texture>> solids_;
+	std::map<std::pair<const texture*, const texture*>, weak_ptr<texture>> checkers_;
+	std::map<std::string, weak_ptr<texture>> images_;
+	std::map<std::string, weak_ptr<texture>> cached_images_;
+	std::map<Real, weak_ptr<texture>> noises_;
+	std::map<std::string, weak_ptr<texture>> baked_;
+	weak_ptr<const perlin> perlin_;
+	bool baking_;
+
+	/**
+	 * Returns the live texture stored under key, or makes and stores a new one.
+	 * @param make called to build the texture when there is none
+	 */
+	template <typename Key, typename Make>
+	static shared_ptr<texture> intern(std::map<Key, weak_ptr<texture>>& table, const Key& key, Make make) {
+		shared_ptr<texture> found = table[key].lock();
+		if (!found) {
+			found = make();
+			table[key] = found;
+		}
+		return found;
+	}
+};
+
+
+/**
+ * The registry shared by the materials of the preset scenes.
+ */
+inline texture_registry& default_texture_registry() {
+	static texture_registry registry;
+	return registry;
+}
+
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * @file tiled_image.h
+ * RGBA8 image storage laid out in 4x4 tiles for cache-friendly texture lookups.
+ */
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "vec3.h"
+
+/**
+ * An image stored as 4x4 tiles of RGBA8 texels.
+ * Each tile is 64 bytes and starts on a 64-byte boundary, so it fills exactly one
+ * cache line. A bilinear footprint or a small cluster of nearby (u, v) lookups
+ * then touches one or two cache lines instead of one per scanline. Tiles are
+ * stored row by row, and so are the texels inside a tile: since a tile is a
+ * single cache line, Z-ordering inside it would only make addressing slower.
+ */
+class tiled_image {
+public:
+	static const int tile_size = 4;
+	static const int texels_per_tile = tile_size * tile_size;
+
+	tiled_image() : data_(nullptr), width_(0), height_(0), tiles_per_row_(0) {}
+
+	/**
+	 * Re-lays out a row-major image into tiles, padding each texel to RGBA8.
+	 * @param pixels row-major texels with the given number of channels (1 to 4)
+	 */
+	tiled_image(const unsigned char* pixels, int width, int height, int channels)
+		: tiled_image() {
+		allocate(width, height);
+		for (int j = 0; j < height; ++j) {
+			for (int i = 0; i < width; ++i) {
+				const unsigned char* p = pixels + (j * width + i) * channels;
+				unsigned char rgba[4] = {p[0], p[0], p[0], 255};
+				for (int c = 1; c < channels && c < 4; ++c) {
+					rgba[c] = p[c];
+				}
+				set_texel(i, j, rgba[0], rgba[1], rgba[2], rgba[3]);
+			}
+		}
+	}
+
+	/**
+	 * Creates an empty (black) image of the given size.
+	 */
+	tiled_image(int width, int height) : tiled_image() {
+		allocate(width, height);
+	}
+
+	// The aligned data pointer points into storage_, so copying would leave it
+	// pointing at the source image. Moving keeps the buffer and stays valid.
+	tiled_image(const tiled_image&) = delete;
+	tiled_image& operator=(const tiled_image&) = delete;
+	tiled_image(tiled_image&&) = default;
+	tiled_image& operator=(tiled_image&&) = default;
+
+	int width() const {
+		return width_;
+	}
+
+	int height() const {
+		return height_;
+	}
+
+	/**
+	 * @return the bytes used by the texel storage, including tile padding
+	 */
+	size_t size_in_bytes() const {
+		return storage_.size() * sizeof(uint32_t);
+	}
+
+	/**
+	 * @return the packed RGBA8 texel at column i, row j (R in the low byte)
+	 */
+	uint32_t texel(int i, int j) const {
+		return data_[address(i, j)];
+	}
+
+	/**
+	 * @return the tiled texel buffer, for reading or writing a whole image at once
+	 */
+	const uint32_t* data() const {
+		return data_;
+	}
+
+	uint32_t* data() {
+		return data_;
+	}
+
+	/**
+	 * @return the texel at column i, row j as a color in [0, 1]
+	 */
+	color texel_color(int i, int j) const {
+		return unpack(texel(i, j));
+	}
+
+	void set_texel(int i, int j, unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255) {
+		data_[address(i, j)] = static_cast<uint32_t>(r)
+							 | (static_cast<uint32_t>(g) << 8)
+							 | (static_cast<uint32_t>(b) << 16)
+							 | (static_cast<uint32_t>(a) << 24);
+	}
+
+	/**
+	 * Fetches the 2x2 block of texels with (i, j) at its top-left, for bilinear
+	 * filtering. (i + 1, j + 1) must be inside the image.
+	 * @param out receives texels (i, j), (i+1, j), (i, j+1), (i+1, j+1)
+	 */
+	void texel_quad(int i, int j, uint32_t out[4]) const {
+		// Step right/down from (i, j): within the tile, or into the next tile over
+		// when (i, j) is on the tile's last column/row. Masks, not branches, since
+		// which case applies is effectively random per lookup.
+		size_t last_column = 0 - static_cast<size_t>((i & 3) == 3);
+		size_t last_row = 0 - static_cast<size_t>((j & 3) == 3);
+		size_t right = 1 + (last_column & (texels_per_tile - tile_size));
+		size_t down = tile_size + (last_row & (static_cast<size_t>(tiles_per_row_) * texels_per_tile - texels_per_tile));
+		const uint32_t* p = data_ + address(i, j);
+		out[0] = p[0];
+		out[1] = p[right];
+		out[2] = p[down];
+		out[3] = p[right + down];
+	}
+
+	/**
+	 * Converts a packed RGBA8 texel to a color in [0, 1].
+	 */
+	static color unpack(uint32_t t) {
+		const Real color_scale = Real(1.0/255.0);
+		return color(color_scale * (t & 0xFF),
+					 color_scale * ((t >> 8) & 0xFF),
+					 color_scale * ((t >> 16) & 0xFF));
+	}
+
+	/**
+	 * Computes where a texel lives in the tiled buffer.
+	 * @return the index of texel (i, j), in units of texels
+	 */
+	size_t address(int i, int j) const {
+		size_t tile = static_cast<size_t>(j >> 2) * tiles_per_row_ + (i >> 2);
+		return (tile << 4) | ((j & 3) << 2) | (i & 3);
+	}
+
+private:
+	std::vector<uint32_t> storage_;
+	uint32_t* data_;
+	int width_, height_;
+	int tiles_per_row_;
+
+	void allocate(int width, int height) {
+		width_ = width;
+		height_ = height;
+		tiles_per_row_ = (width + tile_size - 1) / tile_size;
+		int tile_rows = (height + tile_size - 1) / tile_size;
+		size_t texels = static_cast<size_t>(tiles_per_row_) * tile_rows * texels_per_tile;
+
+		// over-allocate by one tile so the data can start on a cache line
+		storage_.assign(texels + texels_per_tile, 0);
+		uintptr_t base = reinterpret_cast<uintptr_t>(storage_.data());
+		uintptr_t aligned = (base + 63) & ~static_cast<uintptr_t>(63);
+		data_ = storage_.data() + (aligned - base) / sizeof(uint32_t);
+	}
+};
+
+
+/**
+ * A mip pyramid, full resolution image first, halving down to 1x1.
+ */
+typedef std::vector<tiled_image> mip_pyramid;
+
+/**
+ * The source texels a texel of the next mip level averages on one axis: two,
+ * or on an odd-sized axis the last texel takes the last three, so every
+ * source texel lands in exactly one box.
+ * @param i the texel of the next level
+ * @param src_size, dst_size the size of the axis in each level
+ * @param first, last set to the range of source texels, inclusive
+ */
+inline void mip_footprint(int i, int src_size, int dst_size, int& first, int& last) {
+	first = std::min(2 * i, src_size - 1);
+	last = std::min(2 * i + 1, src_size - 1);
+	if (i == dst_size - 1) {
+		last = src_size - 1;
+	}
+}
+
+/**
+ * Appends mip levels to a pyramid holding only its base level, averaging 2x2
+ * blocks of each level down to 1x1. Odd sizes round down, and the last
+ * row/column of blocks box filters three texels instead of two.
+ */
+inline void build_mip_pyramid(mip_pyramid& levels) {
+	while (levels.back().width() > 1 || levels.back().height() > 1) {
+		const tiled_image& src = levels.back();
+		tiled_image dst(std::max(1, src.width() / 2), std::max(1, src.height() / 2));
+
+		for (int j = 0; j < dst.height(); ++j) {
+			int j0, j1;
+			mip_footprint(j, src.height(), dst.height(), j0, j1);
+			for (int i = 0; i < dst.width(); ++i) {
+				int i0, i1;
+				mip_footprint(i, src.width(), dst.width(), i0, i1);
+				int sum[4] = {0, 0, 0, 0};
+				for (int y = j0; y <= j1; ++y) {
+					for (int x = i0; x <= i1; ++x) {
+						uint32_t texel = src.texel(x, y);
+						for (int c = 0; c < 4; ++c) {
+							sum[c] += (texel >> (8 * c)) & 0xFF;
+						}
+					}
+				}
+				int count = (i1 - i0 + 1) * (j1 - j0 + 1);
+				unsigned char avg[4];
+				for (int c = 0; c < 4; ++c) {
+					avg[c] = static_cast<unsigned char>((sum[c] + count / 2) / count);
+				}
+				dst.set_texel(i, j, avg[0], avg[1], avg[2], avg[3]);
+			}
+		}
+		levels.push_back(std::move(dst));
+	}
+}
+
+#endif
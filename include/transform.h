@@ -0,0 +1,226 @@
+/**
+ * @file transform.h
+ * Affine transforms for placing objects in the scene.
+ */
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+
+#include "aabb.h"
+#include "real.h"
+#include "vec3.h"
+
+/**
+ * An affine transform: a 3x3 linear part followed by a translation.
+ * The inverse is computed once on construction, since instances map every ray
+ * through it.
+ */
+class affine_transform {
+    public:
+        /**
+         * Constructs the identity transform.
+         */
+        affine_transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}, inv{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+        /**
+         * Constructs a transform from the rows of its 3x4 matrix.
+         * The linear part must be invertible.
+         */
+        affine_transform(const Real rows[3][4]) {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    m[i][j] = rows[i][j];
+                }
+            }
+            invert();
+        }
+
+        static affine_transform translate(const vec3& offset) {
+            const Real rows[3][4] = {{1, 0, 0, offset.x()}, {0, 1, 0, offset.y()}, {0, 0, 1, offset.z()}};
+            return affine_transform(rows);
+        }
+
+        static affine_transform scale(const vec3& factors) {
+            const Real rows[3][4] = {{factors.x(), 0, 0, 0}, {0, factors.y(), 0, 0}, {0, 0, factors.z(), 0}};
+            return affine_transform(rows);
+        }
+
+        static affine_transform scale(Real factor) {
+            return scale(vec3(factor, factor, factor));
+        }
+
+        /**
+         * Rotation about an axis through the origin.
+         * @param axis the rotation axis, need not be unit length
+         * @param degrees angle, counterclockwise looking down the axis
+         */
+        static affine_transform rotate(const vec3& axis, Real degrees) {
+            vec3 a = unit_vector(axis);
+            Real theta = degrees * real_pi / 180;
+            Real c = std::cos(theta);
+            Real s = std::sin(theta);
+            Real t = 1 - c;
+            const Real rows[3][4] = {
+                {t*a.x()*a.x() + c,       t*a.x()*a.y() - s*a.z(), t*a.x()*a.z() + s*a.y(), 0},
+                {t*a.x()*a.y() + s*a.z(), t*a.y()*a.y() + c,       t*a.y()*a.z() - s*a.x(), 0},
+                {t*a.x()*a.z() - s*a.y(), t*a.y()*a.z() + s*a.x(), t*a.z()*a.z() + c,       0}};
+            return affine_transform(rows);
+        }
+
+        /**
+         * @return the transform that undoes this one
+         */
+        affine_transform inverse() const {
+            affine_transform result;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    result.m[i][j] = inv[i][j];
+                    result.inv[i][j] = m[i][j];
+                }
+            }
+            return result;
+        }
+
+        point3 apply_point(const point3& p) const {
+            return point3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                          m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                          m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+        }
+
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                        m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                        m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+        }
+
+        /**
+         * Transforms a surface normal, with the inverse transpose so it stays
+         * perpendicular to the surface under non-uniform scaling. Not normalized.
+         */
+        vec3 apply_normal(const vec3& n) const {
+            return vec3(inv[0][0]*n.x() + inv[1][0]*n.y() + inv[2][0]*n.z(),
+                        inv[0][1]*n.x() + inv[1][1]*n.y() + inv[2][1]*n.z(),
+                        inv[0][2]*n.x() + inv[1][2]*n.y() + inv[2][2]*n.z());
+        }
+
+        /**
+         * @return a box around the transformed corners of the given box
+         */
+        aabb apply_box(const aabb& box) const {
+            point3 lo(real_infinity, real_infinity, real_infinity);
+            point3 hi(-real_infinity, -real_infinity, -real_infinity);
+            for (int corner = 0; corner < 8; corner++) {
+                point3 p(box.bounds[corner & 1].x(), box.bounds[(corner >> 1) & 1].y(), box.bounds[corner >> 2].z());
+                point3 q = apply_point(p);
+                lo = vec_min(lo, q);
+                hi = vec_max(hi, q);
+            }
+            return aabb(lo, hi);
+        }
+
+        /**
+         * @return the average factor lengths are scaled by (cube root of the determinant)
+         */
+        Real scale_factor() const {
+            return std::cbrt(std::fabs(determinant()));
+        }
+
+        friend affine_transform operator*(const affine_transform& a, const affine_transform& b);
+
+    public:
+        // rows of the 3x4 matrix and of its inverse
+        Real m[3][4];
+        Real inv[3][4];
+
+    private:
+        Real determinant() const {
+            return m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        }
+
+        /**
+         * Fills in inv from m: the inverse of the linear part by cofactors, then
+         * the translation mapped back through it.
+         */
+        void invert() {
+            Real inv_det = 1 / determinant();
+            inv[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+            inv[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+            inv[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+            inv[1][0] = (m[1][2]*m[2][0] - m[1][0]*m[2][2]) * inv_det;
+            inv[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+            inv[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+            inv[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+            inv[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+            inv[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+            for (int i = 0; i < 3; i++) {
+                inv[i][3] = -(inv[i][0]*m[0][3] + inv[i][1]*m[1][3] + inv[i][2]*m[2][3]);
+            }
+        }
+};
+
+/**
+ * Composes two transforms.
+ * @return the transform that applies b first, then a
+ */
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+    Real rows[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            rows[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+        }
+        rows[i][3] += a.m[i][3];
+    }
+    return affine_transform(rows);
+}
+
+/**
+ * Blends two transforms entry by entry, so every point they map moves in a
+ * straight line as t goes from 0 to 1. Rotations are not kept rigid; keep
+ * keyframes close enough together that this doesn't show.
+ * @return a at t = 0 and b at t = 1
+ */
+inline affine_transform interpolate_transform(const affine_transform& a, const affine_transform& b, Real t) {
+    Real rows[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            rows[i][j] = a.m[i][j] + t * (b.m[i][j] - a.m[i][j]);
+        }
+    }
+    return affine_transform(rows);
+}
+
+/**
+ * Blends two transforms that share their linear part, so that only the
+ * translation moves. Their inverses then share a linear part too, and
+ * blending them gives the exact inverse, so nothing needs inverting.
+ * @return a at t = 0 and b at t = 1
+ */
+inline affine_transform interpolate_translation(const affine_transform& a, const affine_transform& b, Real t) {
+    affine_transform result;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m[i][j] = a.m[i][j] + t * (b.m[i][j] - a.m[i][j]);
+            result.inv[i][j] = a.inv[i][j] + t * (b.inv[i][j] - a.inv[i][j]);
+        }
+    }
+    return result;
+}
+
+/**
+ * @return whether two transforms have the same linear part
+ */
+inline bool same_linear_part(const affine_transform& a, const affine_transform& b) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (a.m[i][j] != b.m[i][j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#endif
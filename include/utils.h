@@ -69,7 +69,7 @@ inline vec3 random_unit_vector() {
  * @param min The minimum value to allow x to be.
  * @param max The maximum value to allow x to be.
  */
-inline double clamp(double x, double min, double max) {
+inline Real clamp(Real x, Real min, Real max) {
     if (x < min) return min;
     if (x > max) return max;
     return x;
@@ -1,28 +1,43 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+
+#include "real.h"
+#include "simd.h"
 // #include "utils.h"
 
 
 using std::sqrt;
 using std::ostream;
 
-class vec3 {
+/**
+ * 3D vector backed by a 16-byte aligned, 4-wide SIMD register.
+ * The fourth lane is padding and is kept at zero.
+ */
+class alignas(16) vec3 {
     public: 
-        vec3() : e{0, 0, 0} {}
-        vec3(float e0, float e1, float e2) : e {e0, e1, e2} {}
+        vec3() : e{0, 0, 0, 0} {}
+        vec3(Real e0, Real e1, Real e2) : e {e0, e1, e2, 0} {}
+        explicit vec3(simd4 s) {
+            simd_store(e, s);
+        }
+
+        simd4 simd() const {
+            return simd_load(e);
+        }
 
-        float x() const {
+        Real x() const {
             return e[0];
         }
 
-        float y() const {
+        Real y() const {
             return e[1];
         }
 
-        float z() const {
+        Real z() const {
             return e[2];
         }
 
@@ -30,47 +45,43 @@ class vec3 {
             return vec3(-e[0], -e[1], -e[2]);
         }
 
-        float operator[](int i) const {
+        Real operator[](int i) const {
             return e[i];
         }
 
-        float& operator[](int i) {
+        Real& operator[](int i) {
             return e[i];
         }
 
         vec3& operator+=(const vec3 &v) {
-            e[0] += v.e[0];
-            e[1] += v.e[1];
-            e[2] += v.e[2];
+            simd_store(e, simd_add(simd(), v.simd()));
             return *this;
         }
 
-        vec3& operator*=(const float t) {
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
+        vec3& operator*=(const Real t) {
+            simd_store(e, simd_mul(simd(), simd_set1(t)));
             return *this;
         }
 
-        vec3& operator/=(const float t) {
+        vec3& operator/=(const Real t) {
             return *this *= 1/t;
         }
 
-        float length() const {
-            return sqrt(length_squared());
+        Real length() const {
+            return std::sqrt(length_squared());
         }
 
-        float length_squared() const {
+        Real length_squared() const {
             return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
         }
 
         bool near_zero() const {
-            const auto s = 1e-8;
-            return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+            const Real s = Real(1e-8);
+            return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
         }
 
     public:
-        float e[3];
+        alignas(16) Real e[4];
 
 };
 
@@ -86,39 +97,42 @@ inline ostream& operator<<(ostream &out, const vec3 &v) {
 }
 
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+    return vec3(simd_add(u.simd(), v.simd()));
 }
 
 inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+    return vec3(simd_sub(u.simd(), v.simd()));
 }
 
 inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+    return vec3(simd_mul(u.simd(), v.simd()));
 }
 
-inline vec3 operator*(float t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+inline vec3 operator*(Real t, const vec3 &v) {
+    return vec3(simd_mul(simd_set1(t), v.simd()));
 }
 
-inline vec3 operator*(const vec3 &v, float t) {
+inline vec3 operator*(const vec3 &v, Real t) {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, float t) {
+inline vec3 operator/(vec3 v, Real t) {
     return (1/t) * v;
 }
 
-inline float dot(const vec3 &u, const vec3 &v) {
+inline Real dot(const vec3 &u, const vec3 &v) {
     return u.e[0] * v.e[0]
         + u.e[1] * v.e[1]
         + u.e[2] * v.e[2];
 }
 
 inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    // (u * v.yzx - u.yzx * v).yzx is the usual u.yzx * v.zxy - u.zxy * v.yzx
+    // with one fewer shuffle
+    simd4 a = u.simd();
+    simd4 b = v.simd();
+    simd4 c = simd_sub(simd_mul(a, simd_yzx(b)), simd_mul(simd_yzx(a), b));
+    return vec3(simd_yzx(c));
 }
 
 inline vec3 unit_vector(vec3 v) {
@@ -129,35 +143,39 @@ inline vec3 reflect(vec3 V, vec3 N) {
     return V - 2 * dot(V, N) * N;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
+inline vec3 refract(const vec3& uv, const vec3& n, Real etai_over_etat) {
+    Real cos_theta = std::min(dot(-uv, n), Real(1));
     vec3 r_out_perp =  etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    vec3 r_out_parallel = -std::sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
-inline double clip(double n, double lower, double upper) {
+inline Real clip(Real n, Real lower, Real upper) {
     return std::max(lower, std::min(n, upper));
 }
 
-inline double clip_min(double n, double lower) {
+inline Real clip_min(Real n, Real lower) {
     return std::max(lower, n);
 }
 
-inline vec3 vec_clamp(vec3 v, double min, double max) {
-    return vec3(clip(v.e[0], min, max),
-                clip(v.e[1], min, max),
-                clip(v.e[2], min, max));
+inline vec3 vec_clamp(vec3 v, Real min, Real max) {
+    return vec3(simd_max(simd_set1(min), simd_min(v.simd(), simd_set1(max))));
 }
 
-inline vec3 vec_clamp_min(vec3 v, double min) {
-    return vec3(clip_min(v.e[0], min),
-                clip_min(v.e[1], min),
-                clip_min(v.e[2], min));
+inline vec3 vec_clamp_min(vec3 v, Real min) {
+    return vec3(simd_max(simd_set1(min), v.simd()));
 }
 
 inline vec3 vec_sqrt(vec3 v) {
-    return vec3(sqrt(v.e[0]), sqrt(v.e[1]), sqrt(v.e[2]));
+    return vec3(simd_sqrt(v.simd()));
+}
+
+inline vec3 vec_min(const vec3& u, const vec3& v) {
+    return vec3(simd_min(u.simd(), v.simd()));
+}
+
+inline vec3 vec_max(const vec3& u, const vec3& v) {
+    return vec3(simd_max(u.simd(), v.simd()));
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#ifndef VEC4_H
+#define VEC4_H
+
+#include <cmath>
+#include <iostream>
+
+#include "real.h"
+#include "simd.h"
+#include "vec3.h"
+
+using std::ostream;
+
+/**
+ * 4-wide vector backed by a 16-byte aligned SIMD register.
+ * Used both as a homogeneous 4D vector and as four independent lanes when
+ * evaluating several values at once.
+ */
+class alignas(16) vec4 {
+    public:
+        vec4() : e{0, 0, 0, 0} {}
+        vec4(Real e0, Real e1, Real e2, Real e3) : e{e0, e1, e2, e3} {}
+        explicit vec4(Real t) : e{t, t, t, t} {}
+        explicit vec4(simd4 s) {
+            simd_store(e, s);
+        }
+
+        /**
+         * Constructs a vec4 from a vec3 and a w component.
+         */
+        vec4(const vec3& v, Real w) : e{v.e[0], v.e[1], v.e[2], w} {}
+
+        simd4 simd() const {
+            return simd_load(e);
+        }
+
+        Real x() const {
+            return e[0];
+        }
+
+        Real y() const {
+            return e[1];
+        }
+
+        Real z() const {
+            return e[2];
+        }
+
+        Real w() const {
+            return e[3];
+        }
+
+        vec3 xyz() const {
+            return vec3(e[0], e[1], e[2]);
+        }
+
+        vec4 operator-() const {
+            return vec4(simd_sub(simd_set1(0), simd()));
+        }
+
+        Real operator[](int i) const {
+            return e[i];
+        }
+
+        Real& operator[](int i) {
+            return e[i];
+        }
+
+        vec4& operator+=(const vec4 &v) {
+            simd_store(e, simd_add(simd(), v.simd()));
+            return *this;
+        }
+
+        vec4& operator*=(const Real t) {
+            simd_store(e, simd_mul(simd(), simd_set1(t)));
+            return *this;
+        }
+
+        /**
+         * @return the sum of all four lanes
+         */
+        Real sum() const {
+            return (e[0] + e[1]) + (e[2] + e[3]);
+        }
+
+    public:
+        alignas(16) Real e[4];
+};
+
+
+// vec4 Utility Functions
+
+inline ostream& operator<<(ostream &out, const vec4 &v) {
+    return out << v.e[0] << " " << v.e[1] << " " << v.e[2] << " " << v.e[3];
+}
+
+inline vec4 operator+(const vec4 &u, const vec4 &v) {
+    return vec4(simd_add(u.simd(), v.simd()));
+}
+
+inline vec4 operator-(const vec4 &u, const vec4 &v) {
+    return vec4(simd_sub(u.simd(), v.simd()));
+}
+
+inline vec4 operator*(const vec4 &u, const vec4 &v) {
+    return vec4(simd_mul(u.simd(), v.simd()));
+}
+
+inline vec4 operator/(const vec4 &u, const vec4 &v) {
+    return vec4(simd_div(u.simd(), v.simd()));
+}
+
+inline vec4 operator*(Real t, const vec4 &v) {
+    return vec4(simd_mul(simd_set1(t), v.simd()));
+}
+
+inline vec4 operator*(const vec4 &v, Real t) {
+    return t * v;
+}
+
+inline Real dot(const vec4 &u, const vec4 &v) {
+    return (u * v).sum();
+}
+
+inline vec4 vec_min(const vec4 &u, const vec4 &v) {
+    return vec4(simd_min(u.simd(), v.simd()));
+}
+
+inline vec4 vec_max(const vec4 &u, const vec4 &v) {
+    return vec4(simd_max(u.simd(), v.simd()));
+}
+
+inline vec4 vec_sqrt(const vec4 &v) {
+    return vec4(simd_sqrt(v.simd()));
+}
+
+#endif
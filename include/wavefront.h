@@ -0,0 +1,400 @@
+/**
+ * @file wavefront.h
+ * Wavefront path tracing: instead of following each sample to the end of its
+ * path before starting the next, paths are traced in large batches, one
+ * bounce of every path at a time, in stages:
+ *  - generate:   camera rays are queued with the pixel they belong to
+ *  - sort:       after the first bounce, rays are sorted by the Morton code
+ *                of their origin and their direction octant
+ *  - extend:     every live path's ray is intersected with the world, and
+ *                the hits finalized
+ *  - shade:      hits are grouped by material and each one scattered
+ *  - accumulate: each finished path's radiance is added to its pixel
+ * Each stage is a tight loop over the batch, so traversal runs back to back
+ * without material and texture code evicting it from the caches, and each
+ * material's scatter code and textures stay warm while its hits are shaded.
+ *
+ * Scattered rays point every which way, and consecutive ones would traverse
+ * unrelated parts of the BVH. Sorted, rays that start near each other and
+ * head the same way are traced one after the other, and find the nodes and
+ * primitives they share still in cache. That matters most for meshes too big
+ * for the caches.
+ *
+ * Per-path state is kept in parallel arrays, but rays and hit records stay
+ * whole: world.hit and material::scatter take a ray and a hit_record, so the
+ * extend and shade stages need every field of them anyway, and splitting them
+ * up would only mean gathering them back together for each call. What the
+ * stages scan on their own is split out instead: the sort stage works on a
+ * compact array of keys, and the shade stage groups hits by a compact array of
+ * their materials, so neither streams through whole records to do it.
+ *
+ * There is no shadow stage: materials only gather light by scattering into
+ * emitters, with no direct light sampling to cast shadow rays for. Paths are
+ * traced to the same depth as ray_color's recursion, so the two converge to
+ * the same image.
+ */
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "color.h"
+#include "material.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hittables/hittable.h"
+
+/**
+ * Traces camera samples through a world a batch at a time, keeping the state
+ * of every path in the batch in parallel arrays, and sums up their radiance
+ * per pixel.
+ */
+class wavefront_integrator {
+    public:
+        /**
+         * @param world the objects rays are traced against
+         * @param background the color of rays that escape the world
+         * @param max_depth how many surfaces a path may hit
+         * @param pixel_count how many pixels samples are accumulated into
+         * @param batch_size how many paths are traced together, and so how
+         *        many secondary rays are sorted together
+         * @param sort_rays whether to sort secondary rays before tracing them
+         */
+        wavefront_integrator(const hittable& world, const color& background, int max_depth, size_t pixel_count,
+                             size_t batch_size = 1 << 14, bool sort_rays = true)
+        : world_(world), background_(background), max_depth_(max_depth), batch_size_(batch_size),
+          sort_rays_(sort_rays), sums_(pixel_count, color(0, 0, 0)), counts_(pixel_count, 0) {
+            rays_.reserve(batch_size_);
+            pixels_.reserve(batch_size_);
+        }
+
+        /**
+         * Generate stage: queues a camera ray for a pixel, tracing the batch
+         * once it is full.
+         */
+        void add_sample(const ray& r, uint32_t pixel) {
+            rays_.push_back(r);
+            pixels_.push_back(pixel);
+            if (rays_.size() >= batch_size_) {
+                flush();
+            }
+        }
+
+        /**
+         * Traces the queued samples to the end of their paths.
+         */
+        void flush();
+
+        /**
+         * @return the average radiance of the samples of a pixel, once flushed
+         */
+        color pixel_color(uint32_t pixel) const {
+            return counts_[pixel] ? sums_[pixel] / counts_[pixel] : color(0, 0, 0);
+        }
+
+        /**
+         * @return the number of paths traced so far
+         */
+        size_t paths() const {
+            return paths_;
+        }
+
+        /**
+         * @return the number of rays traced so far, over all bounces
+         */
+        size_t rays() const {
+            return rays_traced_;
+        }
+
+        /**
+         * @return the time spent tracing rays in the extend stage, in seconds
+         */
+        double extend_seconds() const {
+            return extend_seconds_;
+        }
+
+        /**
+         * @return the time spent sorting secondary rays, in seconds
+         */
+        double sort_seconds() const {
+            return sort_seconds_;
+        }
+
+    private:
+        // The fewest live paths worth sorting
+        static const size_t min_sorted_rays = 2048;
+
+        const hittable& world_;
+        color background_;
+        int max_depth_;
+        size_t batch_size_;
+        bool sort_rays_;
+
+        // Per pixel
+        std::vector<color> sums_;
+        std::vector<uint32_t> counts_;
+
+        // Per path in the batch
+        std::vector<ray> rays_;
+        std::vector<uint32_t> pixels_;
+        std::vector<color> throughput_;
+        std::vector<color> radiance_;
+        std::vector<hit_record> hits_;
+
+        // The paths still being traced, and the ones whose rays hit something
+        // with the material they hit
+        std::vector<uint32_t> active_;
+        std::vector<uint32_t> hit_;
+        std::vector<const material*> hit_mats_;
+
+        // For grouping the hits by material: a bucket per material, the
+        // bucket of each hit, and the hits in bucket order
+        struct material_bucket {
+            size_t type;
+            const material* mat;
+            uint32_t start;
+
+            bool operator<(const material_bucket& other) const {
+                return type != other.type ? type < other.type : mat < other.mat;
+            }
+        };
+        std::unordered_map<const material*, uint32_t> bucket_of_;
+        std::vector<material_bucket> buckets_;
+        std::vector<uint32_t> hit_bucket_;
+        std::vector<uint32_t> grouped_;
+
+        // Sort keys for secondary rays: the origin's Morton code above the
+        // direction octant, then the path; and a buffer for sorting them
+        std::vector<uint64_t> ray_keys_;
+        std::vector<uint64_t> sorted_keys_;
+
+        size_t paths_ = 0;
+        size_t rays_traced_ = 0;
+        double extend_seconds_ = 0;
+        double sort_seconds_ = 0;
+
+        void sort();
+        void extend();
+        void shade();
+        void accumulate();
+};
+
+
+void wavefront_integrator::flush() {
+    size_t count = rays_.size();
+    throughput_.assign(count, color(1, 1, 1));
+    radiance_.assign(count, color(0, 0, 0));
+    hits_.resize(count);
+    active_.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        active_[i] = static_cast<uint32_t>(i);
+    }
+
+    for (int depth = 0; depth < max_depth_ && !active_.empty(); depth++) {
+        // Camera rays are queued in pixel order, which is coherent already,
+        // and the last few rays of a batch are too spread out to gain much
+        if (sort_rays_ && depth > 0 && active_.size() >= min_sorted_rays) {
+            sort();
+        }
+        extend();
+        shade();
+    }
+    // Paths still going after max_depth hits gather nothing more, as in ray_color
+    accumulate();
+
+    paths_ += count;
+    rays_.clear();
+    pixels_.clear();
+}
+
+
+/**
+ * Spreads the low 10 bits of a number out to every third bit.
+ */
+inline uint32_t spread_bits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x030000ff;
+    x = (x | x << 8) & 0x0300f00f;
+    x = (x | x << 4) & 0x030c30c3;
+    x = (x | x << 2) & 0x09249249;
+    return x;
+}
+
+
+/**
+ * Orders the live paths by the Morton code of their ray's origin, quantized
+ * to 9 bits per axis within the box around all the origins, then by the
+ * octant of its direction. The 27-bit code and 3-bit octant fill the key's
+ * top 32 bits without overlapping, and its low 32 bits hold the path, so
+ * sorting the keys sorts the paths.
+ *
+ * The keys are radix sorted on their top 32 bits, 11 bits per pass, which
+ * costs a few passes over the batch where a comparison sort was as slow as
+ * tracing small scenes.
+ */
+void wavefront_integrator::sort() {
+    auto start = std::chrono::steady_clock::now();
+    Real lo[3] = {real_infinity, real_infinity, real_infinity};
+    Real hi[3] = {-real_infinity, -real_infinity, -real_infinity};
+    for (uint32_t path : active_) {
+        const point3& o = rays_[path].orig;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], o[a]);
+            hi[a] = std::max(hi[a], o[a]);
+        }
+    }
+    Real scale[3];
+    for (int a = 0; a < 3; a++) {
+        scale[a] = hi[a] > lo[a] ? Real(511) / (hi[a] - lo[a]) : Real(0);
+    }
+
+    ray_keys_.resize(active_.size());
+    for (size_t i = 0; i < active_.size(); i++) {
+        uint32_t path = active_[i];
+        const ray& r = rays_[path];
+        uint32_t morton = 0;
+        for (int a = 0; a < 3; a++) {
+            uint32_t cell = static_cast<uint32_t>((r.orig[a] - lo[a]) * scale[a]);
+            morton |= spread_bits(cell) << (2 - a);
+        }
+        uint32_t octant = r.sign[0] | r.sign[1] << 1 | r.sign[2] << 2;
+        ray_keys_[i] = static_cast<uint64_t>(morton << 3 | octant) << 32 | path;
+    }
+    const int radix_bits = 11;
+    const uint32_t radix = 1u << radix_bits;
+    sorted_keys_.resize(ray_keys_.size());
+    for (int shift = 32; shift < 64; shift += radix_bits) {
+        uint32_t starts[radix] = {};
+        for (uint64_t key : ray_keys_) {
+            starts[(key >> shift) & (radix - 1)]++;
+        }
+        uint32_t start = 0;
+        for (uint32_t& bucket : starts) {
+            uint32_t count = bucket;
+            bucket = start;
+            start += count;
+        }
+        for (uint64_t key : ray_keys_) {
+            sorted_keys_[starts[(key >> shift) & (radix - 1)]++] = key;
+        }
+        ray_keys_.swap(sorted_keys_);
+    }
+    for (size_t i = 0; i < active_.size(); i++) {
+        active_[i] = static_cast<uint32_t>(ray_keys_[i]);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    sort_seconds_ += elapsed.count();
+}
+
+
+/**
+ * Intersects every live path's ray with the world and finalizes the hits.
+ * Paths that miss take the background color and end; the rest are kept in
+ * hit_ for shading.
+ */
+void wavefront_integrator::extend() {
+    auto start = std::chrono::steady_clock::now();
+    hit_.clear();
+    hit_mats_.clear();
+    for (uint32_t path : active_) {
+        hit_record& rec = hits_[path];
+        rec = hit_record();
+        if (world_.hit(rays_[path], rec, Real(0.001), real_infinity)) {
+            // Finalize while the primitive is still in cache
+            finalize_hit(rays_[path], rec);
+            hit_.push_back(path);
+            hit_mats_.push_back(rec.mat.get());
+        } else {
+            radiance_[path] += throughput_[path] * background_;
+        }
+    }
+    rays_traced_ += active_.size();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    extend_seconds_ += elapsed.count();
+}
+
+
+/**
+ * Shades the hits grouped by material type and by material, adding what each
+ * surface emits and replacing the path's ray with the scattered one. Paths
+ * whose ray is absorbed end.
+ *
+ * Scenes have few materials, so the hits are grouped with a counting sort
+ * over the materials seen in this bounce.
+ */
+void wavefront_integrator::shade() {
+    bucket_of_.clear();
+    buckets_.clear();
+    hit_bucket_.resize(hit_.size());
+    const material* last_mat = nullptr;
+    uint32_t last_bucket = 0;
+    for (size_t i = 0; i < hit_.size(); i++) {
+        const material* mat = hit_mats_[i];
+        // Neighbouring hits are often on the same object, so skip the lookup
+        if (mat != last_mat) {
+            auto found = bucket_of_.find(mat);
+            if (found == bucket_of_.end()) {
+                found = bucket_of_.emplace(mat, static_cast<uint32_t>(buckets_.size())).first;
+                buckets_.push_back(material_bucket{typeid(*mat).hash_code(), mat, 0});
+            }
+            last_mat = mat;
+            last_bucket = found->second;
+        }
+        hit_bucket_[i] = last_bucket;
+        buckets_[last_bucket].start++;
+    }
+
+    // Lay the buckets out by material type, then turn their counts into starts
+    std::vector<uint32_t> order(buckets_.size());
+    for (size_t b = 0; b < order.size(); b++) {
+        order[b] = static_cast<uint32_t>(b);
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return buckets_[a] < buckets_[b];
+    });
+    uint32_t start = 0;
+    for (uint32_t b : order) {
+        uint32_t count = buckets_[b].start;
+        buckets_[b].start = start;
+        start += count;
+    }
+    grouped_.resize(hit_.size());
+    for (size_t i = 0; i < hit_.size(); i++) {
+        grouped_[buckets_[hit_bucket_[i]].start++] = hit_[i];
+    }
+
+    active_.clear();
+    for (uint32_t path : grouped_) {
+        const material* mat = hits_[path].mat.get();
+        const ray& r = rays_[path];
+        radiance_[path] += throughput_[path] * mat->emitted();
+
+        ray scattered;
+        color attenuation;
+        if (mat->scatter(r, hits_[path], scattered, attenuation)) {
+            throughput_[path] = throughput_[path] * attenuation;
+            rays_[path] = scattered;
+            active_.push_back(path);
+        }
+    }
+}
+
+
+/**
+ * Adds each path's radiance to its pixel.
+ */
+void wavefront_integrator::accumulate() {
+    for (size_t path = 0; path < rays_.size(); path++) {
+        sums_[pixels_[path]] += radiance_[path];
+        counts_[pixels_[path]]++;
+    }
+}
+
+#endif
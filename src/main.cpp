@@ -18,13 +18,18 @@
 
 #include "camera.h"
 #include "color.h"
+#include "fast_math.h"
 #include "jitter.h"
 #include "material.h"
 #include "mesh.h"
 #include "ray.h"
+#include "scene.h"
 #include "scene_presets.h"
+#include "texture_cache.h"
+#include "texture_registry.h"
 #include "utils.h"
 #include "vec3.h"
+#include "wavefront.h"
 
 #include "hittables/hittable.h"
 #include "hittables/bvh_node.h"
@@ -51,10 +56,11 @@ using rudnick_rt::PNG;
 // --------------------------------------- VARIABLES --------------------------------------- //
 static bool perspective = true;
 static bool multisampling = true;
+static bool wavefront = false;
 static const int fine_grid = 128;
 static int coarse_grid = (int) std::sqrt(fine_grid);
 const int max_depth = 50;
-double infinity = numeric_limits<double>::infinity();
+Real infinity = real_infinity;
 
 // Image
 const static double aspect_ratio = 16.0 / 9.0;
@@ -62,15 +68,15 @@ const static int image_width = 200;
 const static int image_height = static_cast<int>(image_width / aspect_ratio);
 
 // Camera
-const float viewport_width = 4.0;
-const float s = viewport_width / image_width;
+const Real viewport_width = 4.0;
+const Real s = viewport_width / image_width;
 const vec3 direction = vec3(0, 0, -1);
 
 const point3 eye_point = point3(0, 0, 0);
 //const point3 eye_point(10, 3, 5);
 const point3 look_at_point(0, 0, -1);
 const vec3 up = vec3(0, 1, 0);
-double dir = 3.5;
+Real dir = 3.5;
 
 const camera cam = camera(eye_point, look_at_point, up, dir, image_width, image_height, s, 0.0, 1.0);
 
@@ -80,7 +86,7 @@ static color background(0.8, 0.9, 0.99);
 const int NUM_OBJECTS = 10;
 const double sphere_radius = 0.5;
 vector<shared_ptr<hittable>> objects;
-bvh_node scene;
+scene world;
 
 // Phong shading parameters
 const vec3 lightPosition = vec3(0.75, 0.75, 0.5);
@@ -89,7 +95,7 @@ const vec3 iAmbient = vec3(0,0,0);
 const vec3 iDiffuse = vec3(1,1,1);
 const vec3 kSpecular = vec3(1,1,1);
 const vec3 iSpecular = vec3(1,1,1);
-const float shininess = 20;
+const Real shininess = 20;
 
 // --------------------------------------- FUNCTIONS --------------------------------------- //
 
@@ -99,10 +105,10 @@ const float shininess = 20;
  * @return the corrected color
  */
 color gamma_correction(color& c) {
-    double ratio = 1.0 / fine_grid;
+    Real ratio = Real(1) / fine_grid;
     color output = c * ratio;
     output = vec_sqrt(output);
-    output = vec_clamp(output, 0.0, 1.0);
+    output = vec_clamp(output, 0, 1);
     return output;
 }
 
@@ -117,14 +123,14 @@ color phong_reflection(vec3 N, point3 position, vec3 kDiffuse) {
     vec3 L = unit_vector(lightPosition - position); // light vector
     vec3 V = unit_vector(eye_point - position);
     vec3 R = unit_vector(reflect(L, N));
-    double diffuseLight = fmax(dot(L, N), 0.0);
-    double specularLight = fmax(pow(dot(R, V), shininess), 0.0);
+    Real diffuseLight = std::max(dot(L, N), Real(0));
+    Real specularLight = fast_pow(std::max(dot(R, V), Real(0)), shininess);
 
     vec3 ambient = kAmbient * iAmbient;
     vec3 diffuse = kDiffuse * diffuseLight * iDiffuse;
     vec3 specular = kSpecular * specularLight * iSpecular;
     color c = ambient + diffuse + specular;
-    return vec_clamp(c, 0.0, 1.0);
+    return vec_clamp(c, 0, 1);
 }
 
 /**
@@ -135,14 +141,14 @@ color phong_reflection(vec3 N, point3 position, vec3 kDiffuse) {
  * @return the color based on if its in shadow
  */
 color apply_shadows(color original, hit_record rec) {
-    double epsilon = 0.0001;
+    Real epsilon = Real(0.0001);
     ray shadow_ray_before = ray(rec.point, lightPosition - rec.point);
     vec3 new_origin = shadow_ray_before.origin() + epsilon * shadow_ray_before.direction();
     ray shadow_ray = ray(new_origin, lightPosition - rec.point);
     hit_record tmp;
     color shadow = original;
     int i = 0;
-    bool hit = scene.hit(shadow_ray, tmp, 0.001, infinity);
+    bool hit = world.hit(shadow_ray, tmp, 0.001, infinity);
     if (hit) {
         shadow = shade(shadow, 0.4);
     }
@@ -160,10 +166,11 @@ color ray_color(const ray& r, int depth) {
     }
 
     hit_record rec;
-    bool hit = scene.hit(r, rec, 0.001, infinity);
+    bool hit = world.hit(r, rec, 0.001, infinity);
 
     color output;
     if (hit) {
+        finalize_hit(r, rec);
         ray scattered;
         color attenuation;
         color emitted = rec.mat->emitted();
@@ -187,8 +194,8 @@ color ray_color(const ray& r, int depth) {
  * @return the pixel center in the view plane
  */
 vec3 get_pixel_center(int i, int j) {
-    double x = s * (i - image_width / 2 + 0.5);
-    double y = s * (j - image_height / 2 + 0.5);
+    Real x = s * (i - image_width / 2 + Real(0.5));
+    Real y = s * (j - image_height / 2 + Real(0.5));
     return vec3(x, y, 0);
 }
 
@@ -199,26 +206,32 @@ vec3 get_pixel_center(int i, int j) {
  * @return a coordinate within the pixel in the view plane
  */
 vec3 get_grid_pixel_center(int i, int j, int k, int l) {
-    double delta_x = (k + 0.5) / fine_grid;
-    double delta_y = (l + 0.5) / fine_grid;
-    double x = s * (i - image_width / 2 + delta_x);
-    double y = s * (j - image_height / 2 + delta_y);
+    Real delta_x = (k + Real(0.5)) / fine_grid;
+    Real delta_y = (l + Real(0.5)) / fine_grid;
+    Real x = s * (i - image_width / 2 + delta_x);
+    Real y = s * (j - image_height / 2 + delta_y);
     return vec3(x, y, 0);
 }
 
+/**
+ * Makes the ray through the given point based on either perspective or orthographic projections
+ * @param pixel_center the point of the pixel we are shooting through
+ * @return the camera ray
+ */
+ray camera_ray(vec3& pixel_center) {
+    if (perspective) {
+        return cam.get_ray(pixel_center);
+    }
+    return ray(pixel_center, direction);
+}
+
 /**
  * Shoots a single ray at the given point based on either perspective or orthographic projections
  * @param pixel_center the point of the pixel we are shooting through
  * @return the ray color based on the objects it hits
  */
 color shoot_one_ray(vec3& pixel_center) {
-    ray r;
-    if (perspective) {
-        r = cam.get_ray(pixel_center);
-    } else {
-        r = ray(pixel_center, direction);
-    }
-    return ray_color(r, max_depth);
+    return ray_color(camera_ray(pixel_center), max_depth);
 }
 
 /**
@@ -239,13 +252,54 @@ color shoot_multiple_rays(int i, int j) {
             }
         }
     }
+    free_multi_jitter_mask(multi_jitter_mask, fine_grid);
 
     return get_average_color(colors);
 }
 
+/**
+ * Renders the whole image with a wavefront_integrator: queues every pixel's
+ * samples as ray_color would shoot them, then traces them in batches.
+ * @param image the image to write the pixels to
+ */
+void render_wavefront(PNG* image) {
+    wavefront_integrator integrator(world, background, max_depth, image_width * image_height);
+    for (int j = 0; j < image_height; ++j) {
+        for (int i = 0; i < image_width; ++i) {
+            uint32_t pixel = j * image_width + i;
+            if (!multisampling) {
+                vec3 pixel_center = get_pixel_center(i, j);
+                integrator.add_sample(camera_ray(pixel_center), pixel);
+                continue;
+            }
+            bool** multi_jitter_mask = get_multi_jitter_mask(fine_grid);
+            for (int k = 0; k < fine_grid; k++) {
+                for (int l = 0; l < fine_grid; l++) {
+                    if (multi_jitter_mask[k][l]) {
+                        vec3 grid_center = get_grid_pixel_center(i, j, k, l);
+                        integrator.add_sample(camera_ray(grid_center), pixel);
+                    }
+                }
+            }
+            free_multi_jitter_mask(multi_jitter_mask, fine_grid);
+        }
+    }
+    integrator.flush();
+    cout << "Wavefront: " << integrator.paths() << " paths, " << integrator.rays() << " rays, "
+         << integrator.extend_seconds() << " s tracing, " << integrator.sort_seconds() << " s sorting\n";
+
+    for (int j = 0; j < image_height; ++j) {
+        for (int i = 0; i < image_width; ++i) {
+            color pixel_color = integrator.pixel_color(j * image_width + i);
+            image->setPixel(i, image_height-1-j, pixel_color.x(), pixel_color.y(), pixel_color.z());
+        }
+    }
+}
+
 
 /**
- * Checks command line arguments for "p" and "j" to set perspective projection and multisampling respectively
+ * Checks command line arguments for "p" and "j" to set perspective projection and multisampling respectively,
+ * "b" to bake procedural textures, and "w" to trace paths in wavefront batches
  */
 void set_command_line_args(int argc, char* argv[]) {
     if (argc > 1) {
@@ -257,6 +311,14 @@ void set_command_line_args(int argc, char* argv[]) {
             if (!string(argv[i]).compare("j")) {
                 multisampling = true;
             }
+
+            if (!string(argv[i]).compare("b")) {
+                default_texture_registry().set_baking(true);
+            }
+
+            if (!string(argv[i]).compare("w")) {
+                wavefront = true;
+            }
         }
     }
 }
@@ -282,7 +344,7 @@ int main(int argc, char* argv[]) {
     set_command_line_args(argc, argv);
 
     // Set up the scene.
-    scene = three_spheres();
+    world = three_spheres();
 
     // Print performance info
     cout << "Image dimensions: " << image_width << "x" << image_height << "\n";
@@ -296,29 +358,38 @@ int main(int argc, char* argv[]) {
     PNG* image = new PNG(image_width, image_height);
 
     // Main rendering loop
-    for (int j = 0; j < image_height; ++j) {
-        cout << "\rScanlines remaining: " << image_height-j << ' ' << std::flush;
-
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0.0, 0.0, 0.0);
-            if (multisampling) {
-                pixel_color = shoot_multiple_rays(i, j);
-            }
-            else {
-                vec3 pixel_center = get_pixel_center(i, j);
-                pixel_color = shoot_one_ray(pixel_center);
+    if (wavefront) {
+        render_wavefront(image);
+    } else {
+        for (int j = 0; j < image_height; ++j) {
+            cout << "\rScanlines remaining: " << image_height-j << ' ' << std::flush;
+
+            for (int i = 0; i < image_width; ++i) {
+                color pixel_color(0.0, 0.0, 0.0);
+                if (multisampling) {
+                    pixel_color = shoot_multiple_rays(i, j);
+                }
+                else {
+                    vec3 pixel_center = get_pixel_center(i, j);
+                    pixel_color = shoot_one_ray(pixel_center);
+                }
+
+                // PNG image format is upside-down, so (0,0) is the top-left corner
+                // so we have to give image_height-1-j as the y-coordinate.
+                image->setPixel(i, image_height-1-j,
+                                pixel_color.x(),
+                                pixel_color.y(),
+                                pixel_color.z());
             }
-
-            // PNG image format is upside-down, so (0,0) is the top-left corner
-            // so we have to give image_height-1-j as the y-coordinate.
-            image->setPixel(i, image_height-1-j,
-                            pixel_color.x(),
-                            pixel_color.y(),
-                            pixel_color.z());
         }
     }
     cout << "\n\n";
 
+    texture_cache_stats tex_stats = default_texture_cache()->stats();
+    cout << "Texture cache: " << 100 * tex_stats.hit_rate() << "% hits, "
+         << tex_stats.misses << " pages loaded, " << tex_stats.evictions << " evicted, "
+         << tex_stats.resident_bytes / 1024 << " of " << tex_stats.budget_bytes / 1024 << " KB resident\n";
+
     // Encode the PNG data into the final image file.
     image->writeToFile("renders/" + image_name + ".png");
     delete image;